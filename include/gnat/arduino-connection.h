@@ -65,10 +65,22 @@ public:
     return true;
   }
 
+  // Reads only what has already arrived, never waits. Returns bytes read,
+  // -1 once the client is gone. For use with Server::HandleAvailable.
+  int ReadAvailable(uint8_t* buffer, size_t bytes) {
+    if (!client_->connected()) {
+      return -1;
+    }
+    const auto available = client_->available();
+    if (available < 1) return 0;
+    const auto read = client_->read(buffer, min(bytes, (size_t)available));
+    return (read < 0) ? 0 : read;
+  }
+
   bool Drain(size_t bytes) {
-    // If we ever start using the other core re-consider the static.
+    // On the stack so both cores can drain at once.
     constexpr size_t kBufferSize = 64;
-    static uint8_t buffer[kBufferSize];
+    uint8_t buffer[kBufferSize];
     while (bytes > 0) {
       const auto to_drain = min(bytes, kBufferSize);
       if (!Read(buffer, to_drain)) return false;
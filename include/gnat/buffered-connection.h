@@ -0,0 +1,149 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+#include "connection_traits.h"
+#include "log.h"
+
+namespace gnat {
+
+// Wraps any ClientConnection and serves reads out of an inline buffer so that
+// parsing a packet header field by field does not turn into one Read on the
+// underlying connection per byte.
+//
+// We can never ask the wrapped connection for bytes the peer has not sent, it
+// would block. So the buffer only reads ahead as far as it has been told is
+// safe through ExpectBytes(), Packet does this with the remaining size of each
+// packet once the fixed header is parsed. That also means the buffer is always
+// empty between packets and a wrapper can be created per packet like any other
+// connection.
+template<typename ClientConnection, size_t kBufferSize = 256>
+class BufferedConnection {
+public:
+  explicit BufferedConnection(ClientConnection connection)
+      : connection_(std::move(connection)) {}
+
+  BufferedConnection(BufferedConnection&& other)
+      : connection_(std::move(other.connection_)) {
+    TakeBuffer(&other);
+  }
+
+  BufferedConnection& operator=(BufferedConnection&& other) {
+    connection_ = std::move(other.connection_);
+    TakeBuffer(&other);
+    return *this;
+  }
+
+  // Subscribers only ever write to the copy, it doesn't need a read buffer.
+  auto CreateHeapCopy() -> decltype(std::declval<ClientConnection&>().CreateHeapCopy()) {
+    return connection_.CreateHeapCopy();
+  }
+
+  void ExpectBytes(size_t bytes) {
+    read_ahead_ = (bytes > buffered()) ? bytes - buffered() : 0;
+  }
+
+  bool Read(uint8_t* buffer, size_t bytes) {
+    const size_t from_buffer = std::min(bytes, buffered());
+    memcpy(buffer, buffer_ + begin_, from_buffer);
+    begin_ += from_buffer;
+    buffer += from_buffer;
+    bytes -= from_buffer;
+
+    if (bytes == 0) return true;
+
+    // Large reads (payloads) go straight to the destination, there is nothing
+    // to gain from copying them through the buffer.
+    if (bytes >= kBufferSize) {
+      Consumed(bytes);
+      return connection_.Read(buffer, bytes);
+    }
+
+    if (!Refill(bytes)) return false;
+    memcpy(buffer, buffer_, bytes);
+    begin_ = bytes;
+    return true;
+  }
+
+  bool Drain(size_t bytes) {
+    const size_t from_buffer = std::min(bytes, buffered());
+    begin_ += from_buffer;
+    bytes -= from_buffer;
+
+    if (bytes == 0) return true;
+    Consumed(bytes);
+    return connection_.Drain(bytes);
+  }
+
+  bool WritePartial(uint8_t* buffer, size_t bytes) {
+    return connection_.WritePartial(buffer, bytes);
+  }
+
+  bool Write(uint8_t* buffer, size_t bytes) {
+    return connection_.Write(buffer, bytes);
+  }
+
+  // Only offered when the wrapped connection has it.
+  template<typename Wrapped = ClientConnection>
+  auto WriteV(const IoVec* buffers, size_t count)
+      -> decltype(std::declval<Wrapped&>().WriteV(buffers, count)) {
+    return connection_.WriteV(buffers, count);
+  }
+
+  void Close() {
+    connection_.Close();
+  }
+
+  auto connection_type() -> decltype(std::declval<ClientConnection&>().connection_type()) {
+    return connection_.connection_type();
+  }
+
+  template<typename ConnectionType>
+  void set_connection_type(ConnectionType type) { connection_.set_connection_type(type); }
+
+  uint32_t id() { return connection_.id(); }
+
+  ClientConnection* wrapped() { return &connection_; }
+
+  size_t buffered() const { return end_ - begin_; }
+
+private:
+  void TakeBuffer(BufferedConnection* other) {
+    // Only move what is still unread.
+    read_ahead_ = other->read_ahead_;
+    begin_ = 0;
+    end_ = other->buffered();
+    memcpy(buffer_, other->buffer_ + other->begin_, end_);
+    other->begin_ = other->end_ = 0;
+    other->read_ahead_ = 0;
+  }
+
+  // Fills the empty buffer with atleast |bytes| bytes in a single read.
+  bool Refill(size_t bytes) {
+    const size_t to_read = std::max(bytes, std::min(read_ahead_, kBufferSize));
+    Consumed(to_read);
+    begin_ = end_ = 0;
+    if (!connection_.Read(buffer_, to_read)) {
+      return false;
+    }
+    end_ = to_read;
+    return true;
+  }
+
+  // Bytes taken from the wrapped connection count against the read ahead.
+  void Consumed(size_t bytes) {
+    read_ahead_ = (bytes > read_ahead_) ? 0 : read_ahead_ - bytes;
+  }
+
+  ClientConnection connection_;
+  size_t read_ahead_ = 0;
+  size_t begin_ = 0;
+  size_t end_ = 0;
+  uint8_t buffer_[kBufferSize];
+};
+
+}  // namespace gnat
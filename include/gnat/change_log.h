@@ -0,0 +1,18 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace gnat {
+
+// Where DataStore reports every value set, see DataStore::set_log and
+// FileLog in write_ahead_log.h.
+class ChangeLog {
+public:
+  virtual ~ChangeLog() = default;
+
+  virtual void Append(const char* topic, size_t topic_length, const uint8_t* data,
+                      uint32_t length, uint32_t timestamp) = 0;
+};
+
+}  // namespace gnat
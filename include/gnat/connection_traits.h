@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+
+namespace gnat {
+
+// Optional ClientConnection capabilities. These are detected at compile time so
+// a connection only needs to implement what it can do efficiently, everything
+// else falls back to the required Read/Write calls.
+
+// std::void_t is C++17, we still want to build on older arduino toolchains.
+template<typename... Ts>
+struct make_void { typedef void type; };
+template<typename... Ts>
+using void_t = typename make_void<Ts...>::type;
+
+// void ExpectBytes(size_t bytes);
+// Tells the connection that at least |bytes| more bytes are on their way so it
+// may fetch them before they are asked for.
+template<typename ClientConnection, typename = void>
+struct HasExpectBytes : std::false_type {};
+
+template<typename ClientConnection>
+struct HasExpectBytes<ClientConnection, void_t<decltype(
+    std::declval<ClientConnection&>().ExpectBytes(size_t()))>> : std::true_type {};
+
+template<typename ClientConnection>
+typename std::enable_if<HasExpectBytes<ClientConnection>::value>::type
+ExpectBytes(ClientConnection* connection, size_t bytes) {
+  connection->ExpectBytes(bytes);
+}
+
+template<typename ClientConnection>
+typename std::enable_if<!HasExpectBytes<ClientConnection>::value>::type
+ExpectBytes(ClientConnection*, size_t) {}
+
+// EncodeContext* encode_context();
+// Scratch space for serializing packets sent on this connection, see
+// EncodeContext in packets.h.
+template<typename ClientConnection, typename = void>
+struct HasEncodeContext : std::false_type {};
+
+template<typename ClientConnection>
+struct HasEncodeContext<ClientConnection, void_t<decltype(
+    std::declval<ClientConnection&>().encode_context())>> : std::true_type {};
+
+// One of the buffers handed to WriteV.
+struct IoVec {
+  const uint8_t* data;
+  size_t size;
+};
+
+// bool WriteV(const IoVec* buffers, size_t count);
+// Writes all |buffers| in order as a single write, like writev(2).
+template<typename ClientConnection, typename = void>
+struct HasWriteV : std::false_type {};
+
+template<typename ClientConnection>
+struct HasWriteV<ClientConnection, void_t<decltype(
+    std::declval<ClientConnection&>().WriteV((const IoVec*)nullptr, size_t()))>>
+    : std::true_type {};
+
+// Writes |buffers| back to back, in one call when the connection can gather
+// them itself, otherwise as partial writes followed by a final Write.
+template<typename ClientConnection>
+typename std::enable_if<HasWriteV<ClientConnection>::value, bool>::type
+WriteBuffers(ClientConnection* connection, const IoVec* buffers, size_t count) {
+  return connection->WriteV(buffers, count);
+}
+
+template<typename ClientConnection>
+typename std::enable_if<!HasWriteV<ClientConnection>::value, bool>::type
+WriteBuffers(ClientConnection* connection, const IoVec* buffers, size_t count) {
+  for (size_t i = 0; i + 1 < count; i++) {
+    if (!connection->WritePartial(const_cast<uint8_t*>(buffers[i].data), buffers[i].size)) {
+      return false;
+    }
+  }
+  return count == 0 ||
+      connection->Write(const_cast<uint8_t*>(buffers[count - 1].data), buffers[count - 1].size);
+}
+
+}  // namespace gnat
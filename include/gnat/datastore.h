@@ -1,144 +1,702 @@
 #pragma once
 
+#include "change_log.h"
+#include "eviction.h"
+#include "history.h"
+#include "inline_function.h"
+#include "inline_topic.h"
 #include "key.h"
+#include "key_mask_index.h"
+#include "payload_allocator.h"
+#include "snapshot_file.h"
+#include "snapshot_table.h"
+#include "storage.h"
+#include "subscription_index.h"
+#include "topic.h"
+#include "topic_dictionary.h"
+#include "topic_filter.h"
 
-#include <unordered_map>
-#include <list>
+#include <algorithm>
+#include <cstdint>
 #include <memory>
 #include <functional>
+#include <stdexcept>
 #include <string>
+#include <type_traits>
+#include <unordered_set>
 
 namespace gnat {
 
+// Tells whether a key is the one it was made for, or under it. Holds no more
+// than a copy of that key.
+template<typename Key>
+using KeyMatcher = InlineFunction<bool(const Key&), sizeof(Key)>;
+
 struct DataStoreEntry {
-    std::unique_ptr<uint8_t[]> data;
+    Payload data;
     uint32_t length = 0;
     uint32_t timestamp = 0;
+    // Bytes data can hold, an update that fits is written in place.
+    uint32_t capacity = 0;
 
     DataStoreEntry() = default;
     DataStoreEntry(uint32_t timestamp) : timestamp(timestamp) {}
 
     DataStoreEntry(DataStoreEntry&& other) = default;
+    DataStoreEntry& operator=(DataStoreEntry&& other) = default;
     DataStoreEntry(const DataStoreEntry&) = delete;
     DataStoreEntry& operator=(const DataStoreEntry&) = delete;
 };
 
+// Most bytes KeyTraits::Decode writes, the topic of a proto3::Publish. Longer
+// keys are cut, the server never makes one.
+static constexpr size_t kMaxDecodedTopicLength = 128;
+
+// Operations on a key type, this needs to be specialized below for each key
+// type DataStore supports.
 template<typename KeyType>
+struct KeyTraits;
+
+// |Storage| maps keys to entries, see storage.h for what it needs and the
+// policies to pick from. |Eviction| picks what to drop when the store is over
+// its limits, see eviction.h. |Subscriptions|::Index<Value> is where observers
+// are kept, TrieSubscriptions or, for uint64_t keys, KeyMaskSubscriptions.
+template<typename KeyType,
+         typename Storage = UnorderedStorage<KeyType, DataStoreEntry>,
+         typename Eviction = NoEviction<KeyType>,
+         typename Subscriptions = TrieSubscriptions>
 class DataStore {
 public:
+    static_assert(!std::is_same<Subscriptions, KeyMaskSubscriptions>::value ||
+                  std::is_same<KeyType, uint64_t>::value,
+                  "KeyMaskSubscriptions only matches uint64_t keys.");
+
+    // Room for what an observer captures, enough for the server's header
+    // cache and a copy of the client connection.
+    static constexpr size_t kObserverSize = 64;
+
     struct ObserverEntry {
+      using Handler =
+          InlineFunction<bool(const KeyType&, const DataStoreEntry&), kObserverSize>;
+
       uint32_t client_id = 0;
-      std::function<bool(const KeyType&, const DataStoreEntry&)> handler;
+      Handler handler;
     };
 
-    // Encode a string to this key type, this needs to be specialized below.
-    static KeyType EncodeKey(const char* decoded, size_t bytes);
-
-    // Decode a string from this key type, this needs to be specialized below.
-    static void DecodeKey(const KeyType& key, char* encoded, uint16_t* bytes);
+    // Bounds on what the store keeps. Bytes are payload buffer sizes.
+    struct Limits {
+      size_t max_bytes = SIZE_MAX;
+      size_t max_entries = SIZE_MAX;
+    };
 
-    static std::function<bool(const KeyType& key)> FullKeyMatcher(const KeyType& key);
-    static std::function<bool(const KeyType& key)> PrefixKeyMatcher(const KeyType& key);
+    struct RetentionStats {
+      size_t bytes = 0;
+      uint64_t evicted_entries = 0;
+      uint64_t evicted_bytes = 0;
+      // Values refused since nothing could be evicted to make room.
+      uint64_t rejected = 0;
+    };
 
     using Key = KeyType;
+    using Traits = KeyTraits<KeyType>;
+
+    // Payloads come from |allocator| if given, otherwise the heap.
+    explicit DataStore(PayloadAllocator* allocator = nullptr) : allocator_(allocator) {}
+
+    // Entry with room for a |length| byte payload from this store's
+    // allocator. data is null if the allocator is out of space.
+    DataStoreEntry CreateEntry(uint32_t length, uint32_t timestamp) {
+      DataStoreEntry entry(timestamp);
+      entry.data = AllocatePayload(allocator_, length);
+      if (entry.data) {
+        entry.length = length;
+        entry.capacity = length;
+      }
+      return entry;
+    }
+
+    PayloadAllocator* allocator() { return allocator_; }
+
+    // Writes that would go over |limits| first evict keys picked by the
+    // Eviction policy, or fail if it has none to give. Applies from the next
+    // write on, nothing is evicted right away. With TopicId keys an evicted
+    // key's topic stays in TopicDictionary::Global(), which never frees one,
+    // so the limits don't bound the dictionary.
+    void set_limits(Limits limits) { limits_ = limits; }
+
+    const RetentionStats& retention_stats() const { return stats_; }
+
+    Eviction& eviction() { return eviction_; }
+
+    // Also keep the last values of every key in |history|, read with
+    // HistoryLast and HistorySince. Null to stop.
+    void set_history(HistoryTable<KeyType>* history) { history_ = history; }
+
+    // Reports every value set to |log| from now on, see FileLog in
+    // write_ahead_log.h.
+    void set_log(ChangeLog* log) { log_ = log; }
+
+    // Serve values from |snapshot| as if they had been set, until they are
+    // set again, for a warm restart from MappedSnapshot. Nothing is read up
+    // front, a value is looked up in the snapshot the first time its key is.
+    // |snapshot| must outlive the store, its values are never copied.
+    void set_warm_start(const SnapshotView* snapshot) { warm_ = snapshot; }
+
+    // Also keep every value in |snapshots| for readers on other threads,
+    // which outlive any Set unlike the reference from Get. Null to stop.
+    void set_snapshots(SnapshotTable<KeyType>* snapshots) { snapshots_ = snapshots; }
+
+    // Encode a string to this key type.
+    static KeyType EncodeKey(const char* decoded, size_t bytes) {
+      return Traits::Encode(decoded, bytes);
+    }
+
+    // Decode a string from this key type into |encoded|, which holds
+    // kMaxDecodedTopicLength bytes.
+    static void DecodeKey(const KeyType& key, char* encoded, uint16_t* bytes) {
+      Traits::Decode(key, encoded, bytes);
+    }
+
+    static KeyMatcher<KeyType> FullKeyMatcher(const KeyType& key) {
+      return Traits::FullMatcher(key);
+    }
+
+    static KeyMatcher<KeyType> PrefixKeyMatcher(const KeyType& key) {
+      return Traits::PrefixMatcher(key);
+    }
+
+    // Returns false if there is no room for |entry|.
+    bool Set(const KeyType& key, DataStoreEntry entry) {
+        auto found = entries_.find(key);
+        if (!MakeRoom(key, Footprint(entry), &found)) {
+          return false;
+        }
+        found = Store(found, key, std::move(entry));
+        if (found == entries_.end()) {
+          return false;
+        }
+        Changed(found->first, found->second);
+        return true;
+    }
+
+    // Sets |key| to a |length| byte value written by |fill(uint8_t* data)|,
+    // reusing the current buffer when it is large enough. Returns false,
+    // without notifying, if there is no room for the value or |fill| returns
+    // false. A failed fill in place removes the key, it is half written.
+    template<typename Fill>
+    bool Update(const KeyType& key, uint32_t length, uint32_t timestamp, Fill&& fill) {
+        auto found = entries_.find(key);
+        if (found != entries_.end() && found->second.data &&
+            found->second.capacity >= length) {
+          auto& entry = found->second;
+          if (!fill(entry.data.get())) {
+            Erase(found);
+            return false;
+          }
+          entry.length = length;
+          entry.timestamp = timestamp;
+          eviction_.Touched(key);
+          Changed(found->first, entry);
+          return true;
+        }
 
-    void Set(const KeyType& key, DataStoreEntry entry) {
-        entries_.erase(key);
-        entries_.emplace(key, std::move(entry));
-        NotifyObservers(key);
+        // Evict first so the allocator can reuse what is freed.
+        if (!MakeRoom(key, length, &found)) {
+          return false;
+        }
+        auto entry = CreateEntry(length, timestamp);
+        if (!entry.data || !fill(entry.data.get())) {
+          return false;
+        }
+        found = Store(found, key, std::move(entry));
+        if (found == entries_.end()) {
+          return false;
+        }
+        Changed(found->first, found->second);
+        return true;
     }
 
     const DataStoreEntry& Get(const KeyType& key) {
-        return entries_.at(key);
+        const auto* entry = Find(key);
+        if (entry == nullptr) {
+          throw std::out_of_range("DataStore::Get");
+        }
+        return *entry;
+    }
+
+    // Like Get but null if |key| isn't set.
+    const DataStoreEntry* Find(const KeyType& key) {
+        auto found = entries_.find(key);
+        if (found == entries_.end() && warm_) {
+          found = LoadWarm(key);
+        }
+        return found == entries_.end() ? nullptr : &found->second;
+    }
+
+    // Calls |visit(const HistorySample&)| for the last |count| values of
+    // |key|, oldest first, without copying them. Returns false if there is no
+    // history for |key|. The samples are only valid until the next change.
+    template<typename Visit>
+    bool HistoryLast(const KeyType& key, size_t count, Visit&& visit) const {
+        const HistoryRing* ring = history_ ? history_->Find(key) : nullptr;
+        if (ring == nullptr) return false;
+        ring->ForEachLast(count, visit);
+        return true;
+    }
+
+    // Like HistoryLast for the values stamped at or after |since|.
+    template<typename Visit>
+    bool HistorySince(const KeyType& key, uint32_t since, Visit&& visit) const {
+        const HistoryRing* ring = history_ ? history_->Find(key) : nullptr;
+        if (ring == nullptr) return false;
+        ring->ForEachSince(since, visit);
+        return true;
+    }
+
+    // Entries in memory, values still only in the warm start snapshot are
+    // not counted.
+    size_t size() const {
+        return entries_.size();
+    }
+
+    // Calls |visit(key, entry)| for every key whose topic starts with
+    // |prefix|. Storage that keeps keys in topic order only visits those,
+    // anything else is a full scan.
+    template<typename Visit>
+    void ForEachPrefix(const char* prefix, size_t length, Visit&& visit) {
+        length = std::min(length, Traits::kMaxTopicLength);
+        ForEachPrefix(prefix, length, visit,
+            std::integral_constant<bool,
+                HasLowerBound<Storage>::value && Traits::kOrderedByTopic>());
+        ForEachWarm([prefix, length](const SnapshotEntry& entry) {
+          return entry.topic_length >= length && memcmp(entry.topic, prefix, length) == 0;
+        }, visit);
     }
 
     void RemoveObserversForClient(uint32_t client_id) {
-      observers_.remove_if([client_id](const ObserverEntry& observer) {
+      subscriptions_.RemoveIf([client_id](const ObserverEntry& observer) {
         return observer.client_id == client_id;
       });
     }
 
+    // Observer for every key, it can filter by matching topics itself.
     void AddObserver(ObserverEntry observer) {
-        observers_.emplace_back(std::move(observer));
+        AddObserver(std::move(observer), "#", 1);
+    }
+
+    // Observer for keys whose topic matches the MQTT topic |filter|. Returns
+    // false if the filter is not valid.
+    bool AddObserver(ObserverEntry observer, const char* filter, size_t filter_length) {
+        if (filter_length > kMaxFilterLength ||
+            !topic::IsValidFilter(filter, filter_length)) {
+          return false;
+        }
 
-        auto& handler = observers_.back().handler;
-        // Send observer all existing data so it can filter by matching topics.
-        for (const auto& entry : entries_) {
-          handler(entry.first, entry.second);
+        char normalized[kMaxFilterLength];
+        if (!Traits::NormalizeFilter(filter, filter_length, normalized, &filter_length)) {
+          return false;
         }
+
+        auto handler = observer.handler;
+        subscriptions_.Insert(normalized, filter_length, std::move(observer));
+
+        // Send observer all existing data matching its filter, only looking
+        // at keys that could.
+        const size_t prefix_length = topic::LiteralPrefixLength(normalized, filter_length);
+        if (prefix_length == filter_length) {
+          const auto key = Traits::Encode(normalized, filter_length);
+          const auto* entry = Find(key);
+          if (entry) handler(key, *entry);
+          return true;
+        }
+        const topic::CompiledFilter compiled(normalized, filter_length);
+        ForEachPrefix(normalized, prefix_length,
+            [&](const KeyType& key, const DataStoreEntry& entry) {
+              char scratch[Traits::kTopicScratchSize];
+              size_t topic_length = 0;
+              const char* topic = Traits::Topic(key, scratch, &topic_length);
+              if (compiled.Matches(topic, topic_length)) {
+                handler(key, entry);
+              }
+            });
+        return true;
+    }
+
+    // Longest filter AddObserver accepts.
+    static constexpr size_t kMaxFilterLength = 256;
+
+    // Whether AddObserver takes the valid filter |filter|. Keys that cut
+    // topics can't take a '+' before the cut.
+    static bool SupportsFilter(const char* filter, size_t filter_length) {
+        char normalized[kMaxFilterLength];
+        return filter_length <= kMaxFilterLength &&
+               Traits::NormalizeFilter(filter, filter_length, normalized, &filter_length);
     }
 
 private:
-    void NotifyObservers(const KeyType& key) {
-        const auto& value = entries_[key];
-        for (auto iter = observers_.begin(); iter != observers_.end(); iter++) {
-            auto& observer = *iter;
-            observer.handler(key, value);
+    using Iterator = typename Storage::iterator;
+
+    static size_t Footprint(const DataStoreEntry& entry) {
+        return std::max(entry.capacity, entry.length);
+    }
+
+    // Puts |entry| in |found|, or a new slot if it is end(). Returns end() if
+    // there is no room.
+    Iterator Store(Iterator found, const KeyType& key, DataStoreEntry entry) {
+        const size_t added = Footprint(entry);
+        if (found == entries_.end()) {
+          found = entries_.emplace(key, std::move(entry)).first;
+          if (found == entries_.end()) {
+            return found;
+          }
+          if (!dropped_.empty()) dropped_.erase(key);
+        } else {
+          stats_.bytes -= Footprint(found->second);
+          found->second = std::move(entry);
+        }
+        stats_.bytes += added;
+        eviction_.Touched(key);
+        return found;
+    }
+
+    // Evicts until |added| more bytes for |key|, replacing what it has at
+    // |*found|, fit in the limits. |*found| is looked up again if anything
+    // went. Returns false if the limits can't be met.
+    bool MakeRoom(const KeyType& key, size_t added, Iterator* found) {
+        const bool is_new = *found == entries_.end();
+        const size_t freed = is_new ? 0 : Footprint((*found)->second);
+        if (added > limits_.max_bytes) {
+          stats_.rejected++;
+          return false;
+        }
+
+        bool evicted = false;
+        while ((is_new && entries_.size() >= limits_.max_entries) ||
+               stats_.bytes - freed + added > limits_.max_bytes) {
+          KeyType victim;
+          if (!eviction_.Victim(key, &victim)) {
+            stats_.rejected++;
+            return false;
+          }
+          auto evicting = entries_.find(victim);
+          stats_.evicted_entries++;
+          stats_.evicted_bytes += Footprint(evicting->second);
+          Erase(evicting);
+          evicted = true;
+        }
+        if (evicted) {
+          *found = entries_.find(key);
         }
+        return true;
     }
 
-   std::unordered_map<KeyType, DataStoreEntry> entries_;
-   std::list<ObserverEntry> observers_;
+    void Erase(Iterator found) {
+        const KeyType key = found->first;
+        stats_.bytes -= Footprint(found->second);
+        entries_.erase(found);
+        eviction_.Removed(key);
+        if (snapshots_) snapshots_->Remove(key);
+        if (history_) history_->Remove(key);
+        // Don't let the warm start value come back. Keys the snapshot
+        // doesn't have are left out, or this would grow with every key.
+        if (warm_ && InWarm(key)) dropped_.insert(key);
+    }
+
+    bool InWarm(const KeyType& key, SnapshotEntry* warm = nullptr) const {
+        char scratch[Traits::kTopicScratchSize];
+        size_t topic_length = 0;
+        const char* topic = Traits::Topic(key, scratch, &topic_length);
+        SnapshotEntry found;
+        return warm_->Find(topic, topic_length, warm ? warm : &found);
+    }
+
+    // Whether |key| is only in the warm start snapshot.
+    bool OnlyWarm(const KeyType& key) {
+        return entries_.find(key) == entries_.end() && dropped_.count(key) == 0;
+    }
+
+    // Moves |key|'s value from the warm start snapshot into memory, evicting
+    // as Set would, or returns end() if it isn't there or doesn't fit.
+    Iterator LoadWarm(const KeyType& key) {
+        SnapshotEntry warm;
+        if (dropped_.count(key) != 0 || !InWarm(key, &warm)) {
+          return entries_.end();
+        }
+        auto found = entries_.end();
+        if (!MakeRoom(key, warm.length, &found)) {
+          return entries_.end();
+        }
+        return Store(found, key, WarmEntry(warm));
+    }
+
+    static DataStoreEntry WarmEntry(const SnapshotEntry& warm) {
+        // Capacity stays 0 so it is never written in place, the snapshot is
+        // read only.
+        DataStoreEntry entry(warm.timestamp);
+        entry.data = UnownedPayloads::Wrap(warm.data);
+        entry.length = warm.length;
+        return entry;
+    }
+
+    // Visits the values only in the warm start snapshot that |match|.
+    template<typename Match, typename Visit>
+    void ForEachWarm(Match&& match, Visit& visit) {
+        if (!warm_) return;
+        warm_->ForEach([&](const SnapshotEntry& warm) {
+          if (!match(warm)) return;
+          const auto key = Traits::Encode(warm.topic, warm.topic_length);
+          if (!OnlyWarm(key)) return;
+          const auto entry = WarmEntry(warm);
+          visit(key, entry);
+        });
+    }
+
+    template<typename Visit>
+    void ForEachPrefix(const char* prefix, size_t length, Visit& visit, std::true_type) {
+        const auto start = Traits::Encode(prefix, length);
+        for (auto entry = entries_.lower_bound(start); entry != entries_.end(); ++entry) {
+          if (!HasTopicPrefix(entry->first, prefix, length)) break;
+          visit(entry->first, entry->second);
+        }
+    }
+
+    template<typename Visit>
+    void ForEachPrefix(const char* prefix, size_t length, Visit& visit, std::false_type) {
+        for (auto& entry : entries_) {
+          if (HasTopicPrefix(entry.first, prefix, length)) {
+            visit(entry.first, entry.second);
+          }
+        }
+    }
+
+    static bool HasTopicPrefix(const KeyType& key, const char* prefix, size_t length) {
+        char scratch[Traits::kTopicScratchSize];
+        size_t topic_length = 0;
+        const char* topic = Traits::Topic(key, scratch, &topic_length);
+        return topic_length >= length && memcmp(topic, prefix, length) == 0;
+    }
+
+    void Changed(const KeyType& key, const DataStoreEntry& value) {
+        if (snapshots_) {
+          snapshots_->Publish(key, value.data.get(), value.length, value.timestamp);
+        }
+        if (history_) {
+          history_->Append(key, value.data.get(), value.length, value.timestamp);
+        }
+        char scratch[Traits::kTopicScratchSize];
+        size_t topic_length = 0;
+        const char* topic = Traits::Topic(key, scratch, &topic_length);
+        if (log_) {
+          log_->Append(topic, topic_length, value.data.get(), value.length, value.timestamp);
+        }
+        NotifyObservers(key, value, topic, topic_length);
+    }
+
+    void NotifyObservers(const KeyType& key, const DataStoreEntry& value,
+                         const char* topic, size_t topic_length) {
+        subscriptions_.Match(key, topic, topic_length, [&key, &value](ObserverEntry& observer) {
+            observer.handler(key, value);
+        });
+    }
+
+   PayloadAllocator* allocator_;
+   SnapshotTable<KeyType>* snapshots_ = nullptr;
+   ChangeLog* log_ = nullptr;
+   HistoryTable<KeyType>* history_ = nullptr;
+   const SnapshotView* warm_ = nullptr;
+   // Keys removed since the warm start, their snapshot values are stale.
+   std::unordered_set<KeyType> dropped_;
+   Storage entries_;
+   Eviction eviction_;
+   Limits limits_;
+   RetentionStats stats_;
+   typename Subscriptions::template Index<ObserverEntry> subscriptions_;
 };
 
+// Keys are the first 8 bytes of the topic packed into an integer.
 template<>
-uint64_t DataStore<uint64_t>::EncodeKey(const char* decoded, size_t bytes) {
-  return key::EncodeString(decoded, bytes);
-}
+struct KeyTraits<uint64_t> {
+  static constexpr size_t kTopicScratchSize = 8;
+  static constexpr size_t kMaxTopicLength = 8;
+  // Keys compare as integers, the first topic byte is the lowest.
+  static constexpr bool kOrderedByTopic = false;
 
-template<>
-void DataStore<uint64_t>::DecodeKey(const uint64_t& key, char* decoded, uint16_t* bytes) {
-  key::DecodeString(key, decoded, bytes);
-}
+  static uint64_t Encode(const char* decoded, size_t bytes) {
+    return key::EncodeString(decoded, bytes);
+  }
 
-template<>
-std::function<bool(const uint64_t&)> DataStore<uint64_t>::FullKeyMatcher(
-    const uint64_t& target_key) {
-  return [target_key](const uint64_t& other_key) {
-    return target_key == other_key;
-  };
-}
+  static void Decode(const uint64_t& key, char* decoded, uint16_t* bytes) {
+    key::DecodeString(key, decoded, bytes);
+  }
 
-template<>
-std::function<bool(const uint64_t&)> DataStore<uint64_t>::PrefixKeyMatcher(
-    const uint64_t& target_key) {
-  return [target_key](const uint64_t& other_key) {
-    // The parts of the target key that are not '0' are the prefix, after anding if
-    // the other key had the prefix we should be left with the target key.
-    return (target_key & other_key) == target_key;
-  };
-}
+  // Topic of |key|, decoded into |scratch| which holds kTopicScratchSize.
+  static const char* Topic(const uint64_t& key, char* scratch, size_t* length) {
+    uint16_t bytes = 0;
+    key::DecodeString(key, scratch, &bytes);
+    *length = bytes;
+    return scratch;
+  }
 
-template<>
-std::string DataStore<std::string>::EncodeKey(const char* decoded, size_t bytes) {
-  return {decoded, bytes};
-}
+  // Topics are cut to 8 bytes, so filters are too.
+  static bool NormalizeFilter(const char* filter, size_t length, char* out,
+                              size_t* out_length) {
+    return topic::CutFilter(filter, length, 8, out, out_length);
+  }
 
-template<>
-void DataStore<std::string>::DecodeKey(const std::string& key, char* decoded, uint16_t* bytes) {
-  // DANGER DANGER DNAGER!!! come back and assert the length of the thing we are
-  // putting this into!
-  memcpy(decoded, key.c_str(), key.length());
-  *bytes = key.length();
-}
+  static KeyMatcher<uint64_t> FullMatcher(const uint64_t& target_key) {
+    return [target_key](const uint64_t& other_key) {
+      return target_key == other_key;
+    };
+  }
+
+  static KeyMatcher<uint64_t> PrefixMatcher(const uint64_t& target_key) {
+    return [target_key](const uint64_t& other_key) {
+      // The parts of the target key that are not '0' are the prefix, after anding if
+      // the other key had the prefix we should be left with the target key.
+      return (target_key & other_key) == target_key;
+    };
+  }
+};
 
 template<>
-std::function<bool(const std::string&)> DataStore<std::string>::FullKeyMatcher(
-    const std::string& target_key) {
-  return [target_key](const std::string& other_key) {
-    return target_key == other_key;
-  };
-}
+struct KeyTraits<std::string> {
+  static constexpr size_t kTopicScratchSize = 1;
+  static constexpr size_t kMaxTopicLength = SIZE_MAX;
+  static constexpr bool kOrderedByTopic = true;
+
+  static std::string Encode(const char* decoded, size_t bytes) {
+    return {decoded, bytes};
+  }
+
+  static void Decode(const std::string& key, char* decoded, uint16_t* bytes) {
+    const size_t length = std::min(key.length(), kMaxDecodedTopicLength);
+    memcpy(decoded, key.data(), length);
+    *bytes = length;
+  }
+
+  // The key is the topic, nothing to decode.
+  static const char* Topic(const std::string& key, char*, size_t* length) {
+    *length = key.length();
+    return key.data();
+  }
+
+  static bool NormalizeFilter(const char* filter, size_t length, char* out,
+                              size_t* out_length) {
+    memcpy(out, filter, length);
+    *out_length = length;
+    return true;
+  }
 
+  static KeyMatcher<std::string> FullMatcher(const std::string& target_key) {
+    return [target_key](const std::string& other_key) {
+      return target_key == other_key;
+    };
+  }
+
+  static KeyMatcher<std::string> PrefixMatcher(const std::string& target_key) {
+    return [target_key](const std::string& other_key) {
+      return std::equal(target_key.begin(),
+          target_key.begin() + std::min(target_key.size(), other_key.size()),
+          other_key.begin());
+    };
+  }
+};
+
+// Keys are whole topics interned in TopicDictionary::Global(), so unlike
+// uint64_t keys topics don't collide and unlike std::string ones they hash and
+// compare as integers. Encoding a topic interns it.
 template<>
-std::function<bool(const std::string&)> DataStore<std::string>::PrefixKeyMatcher(
-    const std::string& target_key) {
-  return [target_key](const std::string& other_key) {
-    return std::equal(target_key.begin(),
-        target_key.begin() + std::min(target_key.size(), other_key.size()),
-        other_key.begin());
-  };
-}
+struct KeyTraits<TopicId> {
+  static constexpr size_t kTopicScratchSize = 1;
+  static constexpr size_t kMaxTopicLength = SIZE_MAX;
+  // Ids are in the order topics were first seen.
+  static constexpr bool kOrderedByTopic = false;
+
+  static TopicId Encode(const char* decoded, size_t bytes) {
+    return TopicDictionary::Global().Intern(decoded, bytes);
+  }
+
+  static void Decode(const TopicId& key, char* decoded, uint16_t* bytes) {
+    size_t length = 0;
+    const char* topic = TopicDictionary::Global().Topic(key, &length);
+    length = std::min(length, kMaxDecodedTopicLength);
+    memcpy(decoded, topic, length);
+    *bytes = length;
+  }
+
+  static const char* Topic(const TopicId& key, char*, size_t* length) {
+    return TopicDictionary::Global().Topic(key, length);
+  }
 
+  static bool NormalizeFilter(const char* filter, size_t length, char* out,
+                              size_t* out_length) {
+    memcpy(out, filter, length);
+    *out_length = length;
+    return true;
+  }
+
+  static KeyMatcher<TopicId> FullMatcher(const TopicId& target_key) {
+    return [target_key](const TopicId& other_key) {
+      return target_key == other_key;
+    };
+  }
+
+  static KeyMatcher<TopicId> PrefixMatcher(const TopicId& target_key) {
+    return [target_key](const TopicId& other_key) {
+      size_t target_length = 0;
+      size_t other_length = 0;
+      const char* target = TopicDictionary::Global().Topic(target_key, &target_length);
+      const char* other = TopicDictionary::Global().Topic(other_key, &other_length);
+      return memcmp(target, other, std::min(target_length, other_length)) == 0;
+    };
+  }
+};
+
+// Keys are whole topics up to kCapacity bytes held inline, like std::string
+// keys without the allocation. Longer topics are cut, and filters with them.
+template<size_t kCapacity>
+struct KeyTraits<InlineTopic<kCapacity>> {
+  using Key = InlineTopic<kCapacity>;
+
+  // Decode writes the whole topic into a buffer of this size.
+  static_assert(kCapacity <= kMaxDecodedTopicLength,
+                "InlineTopic keys can't be longer than a Publish topic.");
+
+  static constexpr size_t kTopicScratchSize = 1;
+  static constexpr size_t kMaxTopicLength = kCapacity;
+  static constexpr bool kOrderedByTopic = true;
+
+  static Key Encode(const char* decoded, size_t bytes) {
+    return Key(decoded, bytes);
+  }
+
+  static void Decode(const Key& key, char* decoded, uint16_t* bytes) {
+    memcpy(decoded, key.data(), key.size());
+    *bytes = key.size();
+  }
+
+  static const char* Topic(const Key& key, char*, size_t* length) {
+    *length = key.size();
+    return key.data();
+  }
+
+  static bool NormalizeFilter(const char* filter, size_t length, char* out,
+                              size_t* out_length) {
+    return topic::CutFilter(filter, length, kCapacity, out, out_length);
+  }
+
+  static KeyMatcher<Key> FullMatcher(const Key& target_key) {
+    return [target_key](const Key& other_key) {
+      return target_key == other_key;
+    };
+  }
+
+  static KeyMatcher<Key> PrefixMatcher(const Key& target_key) {
+    return [target_key](const Key& other_key) {
+      return memcmp(target_key.data(), other_key.data(),
+                    std::min(target_key.size(), other_key.size())) == 0;
+    };
+  }
+};
 
 } // namespace gnat
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstdint>
+#include <iterator>
+#include <list>
+#include <unordered_map>
+
+namespace gnat {
+
+// Eviction policies for DataStore, picked with its third template parameter.
+// They decide which key goes when the store is over its limits, see
+// DataStore::set_limits. Every call is O(1).
+//
+//   void Touched(const Key& key);  Key was set, new or not.
+//   void Removed(const Key& key);  Key is gone.
+//   bool Victim(const Key& keep, Key* victim);
+//     Next key to evict other than |keep|, false if there is none.
+
+// Never picks anything, a store at its limits refuses new values instead.
+template<typename Key>
+struct NoEviction {
+  void Touched(const Key&) {}
+  void Removed(const Key&) {}
+  bool Victim(const Key&, Key*) { return false; }
+};
+
+// Evicts the key set longest ago.
+template<typename Key>
+class LruEviction {
+public:
+  void Touched(const Key& key) {
+    auto found = positions_.find(key);
+    if (found != positions_.end()) {
+      // Most recent at the front.
+      order_.splice(order_.begin(), order_, found->second);
+      return;
+    }
+    order_.push_front(key);
+    positions_.emplace(key, order_.begin());
+  }
+
+  void Removed(const Key& key) {
+    auto found = positions_.find(key);
+    if (found == positions_.end()) return;
+    order_.erase(found->second);
+    positions_.erase(found);
+  }
+
+  bool Victim(const Key& keep, Key* victim) {
+    for (auto key = order_.rbegin(); key != order_.rend(); ++key) {
+      if (*key == keep) continue;
+      *victim = *key;
+      return true;
+    }
+    return false;
+  }
+
+private:
+  std::list<Key> order_;
+  std::unordered_map<Key, typename std::list<Key>::iterator> positions_;
+};
+
+// Evicts the key set the fewest times, the oldest of those on a tie. Keys
+// are kept in buckets by count so a set moves a key to the next bucket.
+template<typename Key>
+class LfuEviction {
+public:
+  void Touched(const Key& key) {
+    auto found = positions_.find(key);
+    if (found == positions_.end()) {
+      auto bucket = buckets_.begin();
+      if (bucket == buckets_.end() || bucket->count != 1) {
+        bucket = buckets_.insert(buckets_.begin(), Bucket{1, {}});
+      }
+      bucket->keys.push_front(key);
+      positions_.emplace(key, Position{bucket, bucket->keys.begin()});
+      return;
+    }
+
+    auto& position = found->second;
+    auto bucket = position.bucket;
+    auto next = std::next(bucket);
+    if (next == buckets_.end() || next->count != bucket->count + 1) {
+      next = buckets_.insert(next, Bucket{bucket->count + 1, {}});
+    }
+    next->keys.splice(next->keys.begin(), bucket->keys, position.key);
+    position.bucket = next;
+    if (bucket->keys.empty()) buckets_.erase(bucket);
+  }
+
+  void Removed(const Key& key) {
+    auto found = positions_.find(key);
+    if (found == positions_.end()) return;
+    auto bucket = found->second.bucket;
+    bucket->keys.erase(found->second.key);
+    if (bucket->keys.empty()) buckets_.erase(bucket);
+    positions_.erase(found);
+  }
+
+  bool Victim(const Key& keep, Key* victim) {
+    // Only |keep| can be skipped, so this looks at two keys at most.
+    for (auto& bucket : buckets_) {
+      for (auto key = bucket.keys.rbegin(); key != bucket.keys.rend(); ++key) {
+        if (*key == keep) continue;
+        *victim = *key;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  // Times |key| was set since it was added, 0 if it isn't tracked.
+  uint32_t count(const Key& key) const {
+    auto found = positions_.find(key);
+    return found == positions_.end() ? 0 : found->second.bucket->count;
+  }
+
+private:
+  struct Bucket {
+    uint32_t count;
+    // Most recent at the front.
+    std::list<Key> keys;
+  };
+  struct Position {
+    typename std::list<Bucket>::iterator bucket;
+    typename std::list<Key>::iterator key;
+  };
+
+  std::list<Bucket> buckets_;
+  std::unordered_map<Key, Position> positions_;
+};
+
+}  // namespace gnat
@@ -0,0 +1,228 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+namespace gnat {
+
+// Finalizer from MurmurHash3, every input bit affects every output bit.
+inline uint64_t Mix64(uint64_t value) {
+  value ^= value >> 33;
+  value *= 0xff51afd7ed558ccdull;
+  value ^= value >> 33;
+  value *= 0xc4ceb9fe1a85ec53ull;
+  value ^= value >> 33;
+  return value;
+}
+
+// std::hash run through Mix64. libstdc++ hashes integers to themselves and
+// keys packed from topics share their low bytes, which a power of two table
+// would index by.
+template<typename Key>
+struct MixedHash {
+  size_t operator()(const Key& key) const {
+    return Mix64(std::hash<Key>()(key));
+  }
+};
+
+// Open addressing hash map with linear probing, entries live in one array so
+// a lookup is usually a single cache miss. Erase shifts the following entries
+// back instead of leaving tombstones, so probes stay short under churn.
+//
+// Implements the subset of std::unordered_map DataStore needs. Unlike it,
+// inserting or erasing may move other entries, invalidating references and
+// iterators to them.
+template<typename Key, typename Value, typename Hash = MixedHash<Key>>
+class FlatHashMap {
+public:
+  using key_type = Key;
+  using mapped_type = Value;
+  using value_type = std::pair<Key, Value>;
+
+  template<typename Map, typename Entry>
+  class Iterator {
+  public:
+    Iterator(Map* map, size_t slot) : map_(map), slot_(slot) { SkipEmpty(); }
+
+    Entry& operator*() const { return *map_->entry(slot_); }
+    Entry* operator->() const { return map_->entry(slot_); }
+
+    Iterator& operator++() {
+      slot_++;
+      SkipEmpty();
+      return *this;
+    }
+
+    bool operator==(const Iterator& other) const { return slot_ == other.slot_; }
+    bool operator!=(const Iterator& other) const { return slot_ != other.slot_; }
+
+  private:
+    friend class FlatHashMap;
+
+    void SkipEmpty() {
+      while (slot_ < map_->capacity_ && !map_->used_[slot_]) slot_++;
+    }
+
+    Map* map_;
+    size_t slot_;
+  };
+
+  using iterator = Iterator<FlatHashMap, value_type>;
+  using const_iterator = Iterator<const FlatHashMap, const value_type>;
+
+  FlatHashMap() = default;
+  FlatHashMap(const FlatHashMap&) = delete;
+  FlatHashMap& operator=(const FlatHashMap&) = delete;
+
+  ~FlatHashMap() {
+    clear();
+  }
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, capacity_); }
+  const_iterator begin() const { return const_iterator(this, 0); }
+  const_iterator end() const { return const_iterator(this, capacity_); }
+
+  size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  iterator find(const Key& key) {
+    return iterator(this, Find(key));
+  }
+
+  const_iterator find(const Key& key) const {
+    return const_iterator(this, Find(key));
+  }
+
+  Value& at(const Key& key) {
+    const size_t slot = Find(key);
+    if (slot == capacity_) throw std::out_of_range("FlatHashMap::at");
+    return entry(slot)->second;
+  }
+
+  // Does nothing and returns the existing entry if |key| is already present.
+  template<typename... Args>
+  std::pair<iterator, bool> emplace(const Key& key, Args&&... args) {
+    const size_t existing = Find(key);
+    if (existing != capacity_) return {iterator(this, existing), false};
+
+    // Keep the load under 7/8 so probes stay short.
+    if ((size_ + 1) * 8 > capacity_ * 7) Grow();
+
+    size_t slot = Home(key);
+    while (used_[slot]) slot = Next(slot);
+    new (entry(slot)) value_type(std::piecewise_construct, std::forward_as_tuple(key),
+                                 std::forward_as_tuple(std::forward<Args>(args)...));
+    used_[slot] = true;
+    size_++;
+    return {iterator(this, slot), true};
+  }
+
+  iterator erase(iterator position) {
+    EraseSlot(position.slot_);
+    // Something may have shifted back into this slot.
+    return iterator(this, position.slot_);
+  }
+
+  size_t erase(const Key& key) {
+    const size_t slot = Find(key);
+    if (slot == capacity_) return 0;
+    EraseSlot(slot);
+    return 1;
+  }
+
+  void clear() {
+    for (size_t slot = 0; slot < capacity_; slot++) {
+      if (used_[slot]) {
+        entry(slot)->~value_type();
+        used_[slot] = false;
+      }
+    }
+    size_ = 0;
+  }
+
+private:
+  using Storage = typename std::aligned_storage<sizeof(value_type), alignof(value_type)>::type;
+
+  value_type* entry(size_t slot) {
+    return reinterpret_cast<value_type*>(&slots_[slot]);
+  }
+
+  const value_type* entry(size_t slot) const {
+    return reinterpret_cast<const value_type*>(&slots_[slot]);
+  }
+
+  size_t Home(const Key& key) const {
+    return Hash()(key) & (capacity_ - 1);
+  }
+
+  size_t Next(size_t slot) const {
+    return (slot + 1) & (capacity_ - 1);
+  }
+
+  // Slot holding |key|, or capacity_ if there is none.
+  size_t Find(const Key& key) const {
+    if (size_ == 0) return capacity_;
+    for (size_t slot = Home(key); used_[slot]; slot = Next(slot)) {
+      if (entry(slot)->first == key) return slot;
+    }
+    return capacity_;
+  }
+
+  void EraseSlot(size_t slot) {
+    entry(slot)->~value_type();
+    used_[slot] = false;
+    size_--;
+
+    // Shift back every following entry whose probe passed through the hole,
+    // otherwise lookups for it would stop early at the empty slot.
+    size_t hole = slot;
+    for (size_t next = Next(slot); used_[next]; next = Next(next)) {
+      const size_t home = Home(entry(next)->first);
+      // Whether |home| is cyclically in (hole, next], if so it can't move.
+      const bool stays = hole <= next ? (hole < home && home <= next)
+                                      : (hole < home || home <= next);
+      if (stays) continue;
+
+      new (entry(hole)) value_type(std::move(*entry(next)));
+      entry(next)->~value_type();
+      used_[hole] = true;
+      used_[next] = false;
+      hole = next;
+    }
+  }
+
+  void Grow() {
+    const size_t old_capacity = capacity_;
+    std::unique_ptr<Storage[]> old_slots = std::move(slots_);
+    std::unique_ptr<bool[]> old_used = std::move(used_);
+
+    capacity_ = old_capacity == 0 ? 16 : old_capacity * 2;
+    slots_.reset(new Storage[capacity_]);
+    used_.reset(new bool[capacity_]());
+
+    for (size_t old = 0; old < old_capacity; old++) {
+      if (!old_used[old]) continue;
+      auto* moving = reinterpret_cast<value_type*>(&old_slots[old]);
+      size_t slot = Home(moving->first);
+      while (used_[slot]) slot = Next(slot);
+      new (entry(slot)) value_type(std::move(*moving));
+      used_[slot] = true;
+      moving->~value_type();
+    }
+  }
+
+  std::unique_ptr<Storage[]> slots_;
+  std::unique_ptr<bool[]> used_;
+  size_t capacity_ = 0;
+  size_t size_ = 0;
+};
+
+}  // namespace gnat
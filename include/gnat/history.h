@@ -0,0 +1,147 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <unordered_map>
+
+namespace gnat {
+
+// One past value of a key, pointing into its HistoryRing.
+struct HistorySample {
+  const uint8_t* data;
+  uint32_t length;
+  uint32_t timestamp;
+};
+
+// The last values of one key, in a fixed block of bytes allocated up front.
+// Values are written one after another and wrap to the start when they don't
+// fit at the end, the oldest ones they overwrite are dropped. Holds at most
+// |max_samples| values of at most |max_bytes| in total.
+class HistoryRing {
+public:
+  HistoryRing(size_t max_samples, size_t max_bytes)
+      : samples_(new Sample[max_samples]), max_samples_(max_samples),
+        bytes_(new uint8_t[max_bytes]), max_bytes_(max_bytes) {}
+
+  // Returns false if |length| is more than the ring holds.
+  bool Append(const uint8_t* data, uint32_t length, uint32_t timestamp) {
+    if (length > max_bytes_ || max_samples_ == 0) return false;
+
+    size_t start = write_;
+    if (max_bytes_ - start < length) {
+      // What's left at the end goes unused, values in it are the oldest.
+      while (count_ > 0 && Oldest().offset >= start) Pop();
+      start = 0;
+    }
+    while (count_ > 0 && OverwritesOldest(start, length)) Pop();
+    if (count_ == max_samples_) Pop();
+
+    memcpy(bytes_.get() + start, data, length);
+    samples_[(head_ + count_) % max_samples_] = {(uint32_t)start, length, timestamp};
+    count_++;
+    write_ = start + length;
+    return true;
+  }
+
+  // Calls |visit(const HistorySample&)| for the last |count| values, oldest
+  // first. The samples are only valid until the next Append.
+  template<typename Visit>
+  void ForEachLast(size_t count, Visit&& visit) const {
+    const size_t skip = count_ > count ? count_ - count : 0;
+    for (size_t i = skip; i < count_; i++) {
+      visit(At(i));
+    }
+  }
+
+  // Like ForEachLast but for the values stamped at or after |since|, wrap of
+  // the millisecond clock is allowed for.
+  template<typename Visit>
+  void ForEachSince(uint32_t since, Visit&& visit) const {
+    size_t first = count_;
+    while (first > 0 && (int32_t)(samples_[Index(first - 1)].timestamp - since) >= 0) {
+      first--;
+    }
+    for (size_t i = first; i < count_; i++) {
+      visit(At(i));
+    }
+  }
+
+  size_t size() const { return count_; }
+
+private:
+  struct Sample {
+    uint32_t offset;
+    uint32_t length;
+    uint32_t timestamp;
+  };
+
+  size_t Index(size_t i) const { return (head_ + i) % max_samples_; }
+
+  HistorySample At(size_t i) const {
+    const Sample& sample = samples_[Index(i)];
+    return {bytes_.get() + sample.offset, sample.length, sample.timestamp};
+  }
+
+  const Sample& Oldest() const { return samples_[head_]; }
+
+  void Pop() {
+    head_ = (head_ + 1) % max_samples_;
+    count_--;
+  }
+
+  // Whether writing |length| bytes at |start| overwrites the oldest value. An
+  // empty value goes with the bytes at its offset, the values after it start
+  // there, unless it is the only one and nothing is after it.
+  bool OverwritesOldest(size_t start, size_t length) const {
+    const Sample& oldest = Oldest();
+    if (length == 0) return false;
+    if (oldest.length == 0) {
+      return count_ > 1 && start <= oldest.offset && oldest.offset < start + length;
+    }
+    return oldest.offset < start + length && start < oldest.offset + oldest.length;
+  }
+
+  std::unique_ptr<Sample[]> samples_;
+  size_t max_samples_;
+  size_t head_ = 0;
+  size_t count_ = 0;
+  std::unique_ptr<uint8_t[]> bytes_;
+  size_t max_bytes_;
+  size_t write_ = 0;
+};
+
+// A HistoryRing per key, see DataStore::set_history. Each key's ring is
+// allocated in full the first time it is set, so budget |max_bytes| for
+// every key that will be.
+template<typename KeyType>
+class HistoryTable {
+public:
+  HistoryTable(size_t max_samples, size_t max_bytes)
+      : max_samples_(max_samples), max_bytes_(max_bytes) {}
+
+  void Append(const KeyType& key, const uint8_t* data, uint32_t length, uint32_t timestamp) {
+    auto found = rings_.find(key);
+    if (found == rings_.end()) {
+      found = rings_.emplace(key, HistoryRing(max_samples_, max_bytes_)).first;
+    }
+    found->second.Append(data, length, timestamp);
+  }
+
+  void Remove(const KeyType& key) {
+    rings_.erase(key);
+  }
+
+  // Null if |key| has no history.
+  const HistoryRing* Find(const KeyType& key) const {
+    const auto found = rings_.find(key);
+    return found == rings_.end() ? nullptr : &found->second;
+  }
+
+private:
+  size_t max_samples_;
+  size_t max_bytes_;
+  std::unordered_map<KeyType, HistoryRing> rings_;
+};
+
+}  // namespace gnat
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace gnat {
+
+template<typename Signature, size_t kSize = 4 * sizeof(void*)>
+class InlineFunction;
+
+// Like std::function but the callable always lives inside, in |kSize| bytes,
+// so making and copying one never allocates. A callable that doesn't fit is
+// a compile error rather than a trip to the heap. Calls go through a single
+// function pointer.
+template<typename R, typename... Args, size_t kSize>
+class InlineFunction<R(Args...), kSize> {
+public:
+  InlineFunction() = default;
+  InlineFunction(std::nullptr_t) {}
+
+  template<typename F, typename Callable = typename std::decay<F>::type,
+           typename = typename std::enable_if<
+               !std::is_same<Callable, InlineFunction>::value>::type>
+  InlineFunction(F&& callable) {
+    static_assert(sizeof(Callable) <= kSize,
+                  "Callable doesn't fit in this InlineFunction, capture less or make it larger.");
+    static_assert(alignof(Callable) <= alignof(Storage),
+                  "Callable is over aligned for InlineFunction.");
+    new (&storage_) Callable(std::forward<F>(callable));
+    invoke_ = &Invoke<Callable>;
+    manage_ = &Manage<Callable>;
+  }
+
+  InlineFunction(const InlineFunction& other) {
+    CopyFrom(other);
+  }
+
+  InlineFunction(InlineFunction&& other) {
+    MoveFrom(&other);
+  }
+
+  InlineFunction& operator=(const InlineFunction& other) {
+    if (this != &other) {
+      Reset();
+      CopyFrom(other);
+    }
+    return *this;
+  }
+
+  InlineFunction& operator=(InlineFunction&& other) {
+    if (this != &other) {
+      Reset();
+      MoveFrom(&other);
+    }
+    return *this;
+  }
+
+  ~InlineFunction() {
+    Reset();
+  }
+
+  // Callables are called as non-const like std::function does, so mutable
+  // lambdas work.
+  R operator()(Args... args) const {
+    return invoke_(&storage_, std::forward<Args>(args)...);
+  }
+
+  explicit operator bool() const { return invoke_ != nullptr; }
+
+private:
+  using Storage = typename std::aligned_storage<kSize, alignof(std::max_align_t)>::type;
+
+  enum class Operation { kCopy, kMove, kDestroy };
+
+  template<typename Callable>
+  static R Invoke(void* storage, Args... args) {
+    return (*static_cast<Callable*>(storage))(std::forward<Args>(args)...);
+  }
+
+  // Copies or moves |from| into |to|, or destroys |to|.
+  template<typename Callable>
+  static void Manage(Operation operation, void* to, void* from) {
+    switch (operation) {
+      case Operation::kCopy:
+        new (to) Callable(*static_cast<const Callable*>(from));
+        break;
+      case Operation::kMove:
+        new (to) Callable(std::move(*static_cast<Callable*>(from)));
+        break;
+      case Operation::kDestroy:
+        static_cast<Callable*>(to)->~Callable();
+        break;
+    }
+  }
+
+  void CopyFrom(const InlineFunction& other) {
+    if (!other.manage_) return;
+    other.manage_(Operation::kCopy, &storage_, &other.storage_);
+    invoke_ = other.invoke_;
+    manage_ = other.manage_;
+  }
+
+  void MoveFrom(InlineFunction* other) {
+    if (!other->manage_) return;
+    other->manage_(Operation::kMove, &storage_, &other->storage_);
+    invoke_ = other->invoke_;
+    manage_ = other->manage_;
+    other->Reset();
+  }
+
+  void Reset() {
+    if (manage_) manage_(Operation::kDestroy, &storage_, nullptr);
+    invoke_ = nullptr;
+    manage_ = nullptr;
+  }
+
+  mutable Storage storage_;
+  R (*invoke_)(void*, Args...) = nullptr;
+  void (*manage_)(Operation, void*, void*) = nullptr;
+};
+
+}  // namespace gnat
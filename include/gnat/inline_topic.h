@@ -0,0 +1,64 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+
+#include "topic.h"
+
+namespace gnat {
+
+// A topic of up to |kCapacity| bytes held inline with its length and hash,
+// so making and copying one never allocates and keys with different hashes
+// compare unequal without looking at their bytes. Longer topics are cut to
+// kCapacity. The server refuses publish topics over 128 bytes, the size of
+// a proto3::Publish topic, so InlineTopic<128> holds any it accepts.
+template<size_t kCapacity>
+class InlineTopic {
+public:
+  static_assert(kCapacity <= UINT16_MAX, "InlineTopic length is 16 bits.");
+
+  static constexpr size_t kMaxLength = kCapacity;
+
+  InlineTopic() { Rehash(); }
+
+  InlineTopic(const char* topic, size_t length) {
+    length_ = static_cast<uint16_t>(std::min(length, kCapacity));
+    memcpy(data_, topic, length_);
+    Rehash();
+  }
+
+  const char* data() const { return data_; }
+  size_t size() const { return length_; }
+  uint32_t hash() const { return hash_; }
+
+  bool operator==(const InlineTopic& other) const {
+    return hash_ == other.hash_ && length_ == other.length_ &&
+           memcmp(data_, other.data_, length_) == 0;
+  }
+  bool operator!=(const InlineTopic& other) const { return !(*this == other); }
+
+  // Byte order of the topics, so ordered storage can scan by prefix.
+  bool operator<(const InlineTopic& other) const {
+    const int compared = memcmp(data_, other.data_, std::min(length_, other.length_));
+    return compared != 0 ? compared < 0 : length_ < other.length_;
+  }
+
+private:
+  void Rehash() { hash_ = topic::Hash(data_, length_); }
+
+  uint32_t hash_ = 0;
+  uint16_t length_ = 0;
+  char data_[kCapacity];
+};
+
+}  // namespace gnat
+
+template<size_t kCapacity>
+struct std::hash<gnat::InlineTopic<kCapacity>> {
+  size_t operator()(const gnat::InlineTopic<kCapacity>& topic) const {
+    return topic.hash();
+  }
+};
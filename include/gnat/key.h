@@ -24,23 +24,32 @@ constexpr uint64_t Encode(char const (&decoded)[N]) {
     return encoded;
 }
 
-uint64_t EncodeString(const char* decoded, size_t topic_bytes) {
+// Same as Encode, with the first byte lowest, as one load of up to 8 bytes.
+// Bytes past the first 8 are dropped.
+inline uint64_t EncodeString(const char* decoded, size_t topic_bytes) {
     uint64_t encoded = 0;
-    for (size_t i = 0; i < topic_bytes; i++) {
-      encoded |= GetChar(decoded, i);
-    }
+    memcpy(&encoded, decoded, topic_bytes < 8 ? topic_bytes : 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+    encoded = __builtin_bswap64(encoded);
+#endif
     return encoded;
 }
 
+// Bytes of topic in an encoded key, a full key has no terminator to stop at.
+inline size_t DecodedLength(const char* encoded_str) {
+    const void* end = memchr(encoded_str, '\0', 8);
+    return end ? static_cast<const char*>(end) - encoded_str : 8;
+}
+
 std::string Decode(uint64_t encoded) {
     char* encoded_str = reinterpret_cast<char*>(&encoded);
-    return std::string(encoded_str, std::min((size_t)8, strlen(encoded_str)));
+    return std::string(encoded_str, DecodedLength(encoded_str));
 }
 
 // decode_to should be atleast 8 bytes;
 void DecodeString(uint64_t encoded, char* decode_to, uint16_t* decoded_size) {
     char* encoded_str = reinterpret_cast<char*>(&encoded);
-    *decoded_size = std::min((size_t)8, strlen(encoded_str));
+    *decoded_size = DecodedLength(encoded_str);
     memcpy(decode_to, encoded_str, *decoded_size);
 }
 
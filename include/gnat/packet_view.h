@@ -0,0 +1,307 @@
+#pragma once
+
+#include <algorithm>
+
+#include "packets.h"
+
+namespace gnat {
+
+// Parsing mode for when a whole packet is already sitting in a receive buffer.
+// Unlike Packet/ReadFrom nothing is copied out of the buffer, strings and
+// payloads point into it so the buffer must outlive the views.
+
+struct StringView {
+  const char* data = nullptr;
+  uint16_t length = 0;
+};
+
+struct BytesView {
+  const uint8_t* data = nullptr;
+  uint32_t length = 0;
+};
+
+// Client over a contiguous buffer, fixed width fields are read through the same
+// ReadField helpers as the streaming path.
+class SpanReader {
+public:
+  SpanReader(const uint8_t* data, size_t size) : position_(data), end_(data + size) {}
+
+  bool Read(uint8_t* out, size_t bytes) {
+    if (bytes > bytes_remaining()) return false;
+    memcpy(out, position_, bytes);
+    position_ += bytes;
+    return true;
+  }
+
+  bool Drain(size_t bytes) {
+    if (bytes > bytes_remaining()) return false;
+    position_ += bytes;
+    return true;
+  }
+
+  // Length prefixed string, points into the buffer.
+  bool ReadString(StringView* out) {
+    uint16_t length = 0;
+    if (!ReadField<PacketField<2>>(this, &length) || length > bytes_remaining()) {
+      return false;
+    }
+    out->data = reinterpret_cast<const char*>(position_);
+    out->length = length;
+    position_ += length;
+    return true;
+  }
+
+  // Everything left, points into the buffer.
+  BytesView Rest() {
+    BytesView out{position_, bytes_remaining()};
+    position_ = end_;
+    return out;
+  }
+
+  uint32_t bytes_remaining() const {
+    return end_ - position_;
+  }
+
+private:
+  const uint8_t* position_;
+  const uint8_t* end_;
+};
+
+// A complete packet inside a receive buffer.
+struct PacketView {
+  // The remaining size is encoded in at most 4 bytes.
+  static constexpr size_t kMaxHeaderSize = 5;
+
+  // Parses the packet at the start of |data|. Returns nothing when |data| does
+  // not hold the whole packet yet, |malformed| is set if it never will.
+  static std::optional<PacketView> Parse(const uint8_t* data, size_t size,
+                                         bool* malformed = nullptr) {
+    size_t header_size = 0;
+    uint32_t remaining_size = 0;
+    if (!ParseHeader(data, size, &header_size, &remaining_size, malformed)) {
+      return {};
+    }
+
+    if (size - header_size < remaining_size) return {};
+
+    PacketView out;
+    out.control = data[0];
+    out.header_size = header_size;
+    out.body = {data + header_size, remaining_size};
+    return out;
+  }
+
+  // Parses only the fixed header, enough to know how big the packet is.
+  static bool ParseHeader(const uint8_t* data, size_t size, size_t* header_size,
+                          uint32_t* remaining_size, bool* malformed = nullptr) {
+    if (malformed) *malformed = false;
+
+    *remaining_size = 0;
+    uint32_t multiplier = 1;
+    size_t position = 1;
+    while (true) {
+      if (position >= kMaxHeaderSize) {
+        LOG("Remaining size too long.\n");
+        if (malformed) *malformed = true;
+        return false;
+      }
+      if (position >= size) return false;
+
+      const uint8_t next_byte = data[position++];
+      *remaining_size += (next_byte & 127) * multiplier;
+      multiplier *= 128;
+      if (!(next_byte & 128)) break;
+    }
+
+    *header_size = position;
+    return true;
+  }
+
+  PacketType type() const {
+    return static_cast<PacketType>(control >> 4);
+  }
+
+  uint8_t type_flags() const {
+    return control & 0xF;
+  }
+
+  // Bytes taken up in the buffer, header included.
+  size_t size() const {
+    return header_size + body.length;
+  }
+
+  SpanReader reader() const {
+    return SpanReader(body.data, body.length);
+  }
+
+  uint8_t control = 0;
+  uint8_t header_size = 0;
+  BytesView body;
+};
+
+// Holds the start of a packet split across two receive buffers until the rest
+// of it arrives, see Server::HandleMessages. Only the split packet is ever
+// copied in here, it has to fit in kCapacity bytes.
+template<size_t kCapacity = 512>
+class PacketCarry {
+public:
+  static constexpr size_t kSize = kCapacity;
+
+  // Takes bytes from |*data| until the carried packet is complete or |*data|
+  // runs out, advancing |*data| and |*size| past what was taken. Returns false
+  // if the packet is malformed or too big to carry.
+  bool Append(const uint8_t** data, size_t* size) {
+    // The header decides how much we need, take it a byte at a time.
+    size_t header_size = 0;
+    uint32_t remaining_size = 0;
+    bool malformed = false;
+    while (!PacketView::ParseHeader(buffer_, length_, &header_size, &remaining_size,
+                                    &malformed)) {
+      if (malformed) return false;
+      if (*size == 0) return true;
+      if (!Take(data, size, 1)) return false;
+    }
+
+    const size_t packet_size = header_size + remaining_size;
+    if (packet_size > kCapacity) {
+      LOG("Packet too large to carry: %u\n", (uint32_t)packet_size);
+      return false;
+    }
+    return Take(data, size, std::min(*size, packet_size - length_));
+  }
+
+  // The carried packet once it is complete.
+  std::optional<PacketView> packet() const {
+    return PacketView::Parse(buffer_, length_);
+  }
+
+  bool empty() const { return length_ == 0; }
+  size_t size() const { return length_; }
+  void Clear() { length_ = 0; }
+
+private:
+  bool Take(const uint8_t** data, size_t* size, size_t bytes) {
+    if (bytes > kCapacity - length_) {
+      LOG("Packet too large to carry.\n");
+      return false;
+    }
+    memcpy(buffer_ + length_, *data, bytes);
+    length_ += bytes;
+    *data += bytes;
+    *size -= bytes;
+    return true;
+  }
+
+  uint8_t buffer_[kCapacity];
+  size_t length_ = 0;
+};
+
+namespace proto3 {
+
+struct ConnectView {
+  static std::optional<ConnectView> ReadFrom(const PacketView& packet) {
+    auto reader = packet.reader();
+    ConnectView out;
+    if (!reader.ReadString(&out.protocol_name)) {
+      DEBUG_LOG("Failed to read protocol name.\n");
+      return {};
+    }
+
+    if (!ReadField<Connect::ProtocolLevel>(&reader, &out.protocol_level) ||
+        !ReadField<Connect::ConnectFlags>(&reader, &out.flags) ||
+        !ReadField<Connect::KeepAlive>(&reader, &out.keep_alive)) {
+      DEBUG_LOG("Failed to read connect fields.\n");
+      return {};
+    }
+
+    // MQTT 3.1.1 allows an empty payload to mean an empty client id.
+    if (reader.bytes_remaining() > 0 && !reader.ReadString(&out.client_id)) {
+      DEBUG_LOG("Failed to read client id.\n");
+      return {};
+    }
+
+    return out;
+  }
+
+  StringView protocol_name;
+  uint8_t protocol_level = 0;
+  uint8_t flags = 0;
+  uint16_t keep_alive = 0;
+  StringView client_id;
+};
+
+struct PublishView {
+  static std::optional<PublishView> ReadFrom(const PacketView& packet) {
+    auto reader = packet.reader();
+    PublishView out;
+    if (!reader.ReadString(&out.topic)) {
+      DEBUG_LOG("Failed to read topic.\n");
+      return {};
+    }
+    // Longer than Publish can send on, as Publish::ReadFrom rejects.
+    if (out.topic.length > decltype(Publish::topic)::kSize) {
+      DEBUG_LOG("Topic too long.\n");
+      return {};
+    }
+
+    if (((packet.type_flags() >> 1) & 0b11) != 0) {
+      // We don't support QoS but the id has to be skipped to find the payload.
+      if (!ReadField<Publish::PacketId>(&reader, &out.packet_id)) {
+        DEBUG_LOG("Failed to read packet id.\n");
+        return {};
+      }
+    }
+
+    out.payload = reader.Rest();
+    return out;
+  }
+
+  StringView topic;
+  uint16_t packet_id = 0;
+  BytesView payload;
+};
+
+struct SubscribeView {
+  static std::optional<SubscribeView> ReadFrom(const PacketView& packet) {
+    auto reader = packet.reader();
+    SubscribeView out;
+    if (!ReadField<Subscribe::PacketId>(&reader, &out.packet_id)) {
+      DEBUG_LOG("Failed to read packet id.\n");
+      return {};
+    }
+    out.topics = reader.Rest();
+    return out;
+  }
+
+  // Calls |callback(const char* topic, size_t length)| for each topic filter,
+  // stops and returns false if the topics are malformed or callback fails.
+  template<typename TopicCallback>
+  bool ForEachTopic(TopicCallback&& callback) const {
+    SpanReader reader(topics.data, topics.length);
+    while (reader.bytes_remaining() > 0) {
+      StringView topic;
+      if (!reader.ReadString(&topic)) {
+        DEBUG_LOG("Failed to read topic.\n");
+        return false;
+      }
+
+      // These are reserved in MQTT 3.1.1, ignore it.
+      uint8_t flags;
+      if (!ReadField<Subscribe::Flags>(&reader, &flags)) {
+        DEBUG_LOG("Failed to read flags.\n");
+        return false;
+      }
+
+      if (!callback(topic.data, topic.length)) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  uint16_t packet_id = 0;
+  BytesView topics;
+};
+
+}  // namespace proto3
+}  // namespace gnat
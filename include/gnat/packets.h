@@ -2,7 +2,10 @@
 
 #include <assert.h>
 
+#include <algorithm>
+
 #include "optional_fill.h"
+#include "connection_traits.h"
 #include "log.h"
 #include "key.h"
 
@@ -50,14 +53,18 @@ struct StringBuffer {
 
 namespace {
 
+// |next_byte| is the first byte of the integer when the caller already has it.
 template<typename T, typename Client>
-static bool ReadVariableByteInteger(T* out, Client* client) {
+static bool ReadVariableByteInteger(T* out, Client* client, int next_byte = -1) {
     int multiplier = 1;
     *out = 0;
     while (true) {
-      uint8_t next_byte = 0;
-      if (!client->Read(&next_byte, 1)) {
-          return false;
+      if (next_byte < 0) {
+        uint8_t read_byte = 0;
+        if (!client->Read(&read_byte, 1)) {
+            return false;
+        }
+        next_byte = read_byte;
       }
 
       *out += (next_byte & 127) * multiplier;
@@ -66,6 +73,7 @@ static bool ReadVariableByteInteger(T* out, Client* client) {
 
       if (!(next_byte & 128))
         return true;
+      next_byte = -1;
     }
 }
 
@@ -93,13 +101,20 @@ struct TypedReadField<Field, TYPE_BYTES> {
 template<typename T, typename Client>
 static bool Read(Client* client, T* out) {
   static_assert(sizeof(*out) >= Field::byte_count, "");
-  bool result = true;
-  // Wire format is big endian but all target arch are little.
-  // For noop loops the compiler will remove all the garbage.
-  for (int i = Field::byte_count - 1; i >= 0 && result; i--) {
-    client->Read((uint8_t*)out + i, 1);
+  // One read for the whole field, buffered connections serve this as a
+  // single copy.
+  uint8_t raw[Field::byte_count];
+  if (!client->Read(raw, Field::byte_count)) {
+    return false;
+  }
+
+  // Wire format is big endian, the compiler turns this into a byte swap.
+  T value = 0;
+  for (size_t i = 0; i < Field::byte_count; i++) {
+    value = (value << 8) | raw[i];
   }
-  return result;
+  *out = value;
+  return true;
 }
 };
 
@@ -134,12 +149,16 @@ struct FixedHeader {
     template<typename Client>
     static std::optional<FixedHeader> ReadFrom(Client* client) {
         FixedHeader out;
-        if (!ReadField<Control>(client, &out.control)) {
+        // Every packet has atleast the control byte and one byte of size so
+        // read both together.
+        uint8_t start[2];
+        if (!client->Read(start, sizeof(start))) {
             DEBUG_LOG("Failed to read control.\n");
             return {};
         }
+        out.control = start[0];
 
-        if (!ReadField<RemainingSize>(client, &out.remaining_size)) {
+        if (!ReadVariableByteInteger(&out.remaining_size, client, start[1])) {
             DEBUG_LOG("Failed to read size.\n");
             return {};
         }
@@ -150,6 +169,30 @@ struct FixedHeader {
     uint32_t remaining_size = 0;
 };
 
+// Scratch space packets are serialized into before being written. Nothing else
+// on the send path is shared, so threads each sending with their own context
+// need no locking around serialization.
+struct EncodeContext {
+  // Fits the largest header we build, a publish with a 128 byte topic.
+  static constexpr size_t kSize = 256;
+  uint8_t buffer[kSize];
+};
+
+// Calls |send(EncodeContext*)| with the connection's own context when it
+// offers one through encode_context(), otherwise with one on the stack.
+template<typename ClientConnection, typename Send>
+typename std::enable_if<HasEncodeContext<ClientConnection>::value, bool>::type
+WithEncodeContext(ClientConnection* connection, Send&& send) {
+  return send(connection->encode_context());
+}
+
+template<typename ClientConnection, typename Send>
+typename std::enable_if<!HasEncodeContext<ClientConnection>::value, bool>::type
+WithEncodeContext(ClientConnection*, Send&& send) {
+  EncodeContext context;
+  return send(&context);
+}
+
 // Packets for MQTT <= 3.1.1
 // Things changed dramatically for MQTT 5.
 namespace proto3 {
@@ -188,7 +231,14 @@ struct Connect {
 
   template<typename Client>
   bool SendOn(Client* client) const {
-    static uint8_t buffer[128] = {0};
+    return WithEncodeContext(client, [&](EncodeContext* context) {
+      return SendOn(client, context);
+    });
+  }
+
+  template<typename Client>
+  bool SendOn(Client* client, EncodeContext* context) const {
+    uint8_t* buffer = context->buffer;
     uint8_t current_byte = 0;
     buffer[current_byte++] = (((uint8_t)PacketType::CONNECT << 4) & 0xF0);
 
@@ -257,7 +307,14 @@ struct ConnectAck {
 
   template<typename Client>
   bool SendOn(Client* client) {
-    static uint8_t buffer[128] = {0};
+    return WithEncodeContext(client, [&](EncodeContext* context) {
+      return SendOn(client, context);
+    });
+  }
+
+  template<typename Client>
+  bool SendOn(Client* client, EncodeContext* context) {
+    uint8_t* buffer = context->buffer;
     uint8_t current_byte = 0;
     buffer[current_byte++] = ((uint8_t)PacketType::CONNACK << 4) & 0xF0;
 
@@ -314,12 +371,12 @@ struct Publish {
     return out;
   }
 
-  template<typename ClientConnection>
-  bool SendOn(ClientConnection* connection, uint8_t* payload) {
-    // This buffer contains the topic as well which can be long.
-    constexpr auto kBufferSize = 256;
-    static uint8_t buffer[kBufferSize] = {0};
+  // Control byte, up to 4 bytes of size, topic length and topic.
+  static constexpr size_t kMaxHeaderSize = 1 + 4 + 2 + 128;
 
+  // Encodes everything but the payload into |buffer|, which must hold
+  // kMaxHeaderSize bytes. Returns the number of bytes used.
+  uint8_t EncodeHeader(uint8_t* buffer) const {
     uint8_t current_byte = 0;
     constexpr uint8_t flags = 0; // We can expand functionality here.
     buffer[current_byte++] =
@@ -342,13 +399,32 @@ struct Publish {
     memcpy(buffer + current_byte, topic.data, topic.length);
     current_byte += topic.length;
 
-    assert(current_byte < kBufferSize);
-    const auto header_size = current_byte;
+    assert(current_byte <= kMaxHeaderSize);
+    return current_byte;
+  }
+
+  // Sends an already encoded header followed by the payload.
+  template<typename ClientConnection>
+  static bool SendEncoded(ClientConnection* connection, const uint8_t* header,
+                          size_t header_size, const uint8_t* payload, uint32_t payload_bytes) {
+    // Header and payload go out together where the connection supports it.
+    const IoVec buffers[] = {{header, header_size}, {payload, payload_bytes}};
+    return WriteBuffers(connection, buffers, 2);
+  }
+
+  template<typename ClientConnection>
+  bool SendOn(ClientConnection* connection, uint8_t* payload) {
+    return WithEncodeContext(connection, [&](EncodeContext* context) {
+      return SendOn(connection, payload, context);
+    });
+  }
 
-    // Write buffered data.
-    if (!connection->WritePartial(buffer, header_size)) return false;
-    // Write payload.
-    return connection->Write(payload, payload_bytes);
+  template<typename ClientConnection>
+  bool SendOn(ClientConnection* connection, uint8_t* payload, EncodeContext* context) {
+    // This buffer contains the topic as well which can be long.
+    uint8_t* buffer = context->buffer;
+    const auto header_size = EncodeHeader(buffer);
+    return SendEncoded(connection, buffer, header_size, payload, payload_bytes);
   }
 
   StringBuffer<128> topic;
@@ -392,7 +468,14 @@ struct Subscribe {
 
     template<typename Client>
     bool SendOn(Client* client) const {
-      static uint8_t buffer[128] = {0};
+      return WithEncodeContext(client, [&](EncodeContext* context) {
+        return SendOn(client, context);
+      });
+    }
+
+    template<typename Client>
+    bool SendOn(Client* client, EncodeContext* context) const {
+      uint8_t* buffer = context->buffer;
       uint8_t current_byte = 0;
       // Spec requires bit 1 be set to 1.
       buffer[current_byte++] = (((uint8_t)PacketType::SUBSCRIBE << 4) | 0b10);
@@ -429,6 +512,9 @@ struct SubscribeAck {
   using PacketId = PacketField<2>;
   using Response = PacketField<1>;
 
+  // Return code refusing one topic filter, the others are the granted QoS.
+  static constexpr uint8_t kFailure = 0x80;
+
   uint16_t subscribe_packet_id = 0;
   uint8_t responses[32] = {0};
   uint8_t responses_count = 0;
@@ -452,7 +538,14 @@ struct SubscribeAck {
 
   template<typename ClientConnection>
   bool SendOn(ClientConnection* connection) {
-    static uint8_t buffer[32] = {0};
+    return WithEncodeContext(connection, [&](EncodeContext* context) {
+      return SendOn(connection, context);
+    });
+  }
+
+  template<typename ClientConnection>
+  bool SendOn(ClientConnection* connection, EncodeContext* context) {
+    uint8_t* buffer = context->buffer;
     uint8_t current_byte = 0;
     buffer[current_byte++] = ((uint8_t)PacketType::SUBACK << 4) & 0xF0;
     // We will come back to set the length last, it will be one byte though.
@@ -477,7 +570,7 @@ struct SubscribeAck {
 struct PingResp {
   template<typename ClientConnection>
   static bool SendOn(ClientConnection* connection) {
-    static uint8_t buffer[] = {
+    uint8_t buffer[] = {
       ((uint8_t)PacketType::PINGRESP << 4) & 0xF0,
       0}; // Size is always zero.
     DEBUG_LOG("Sending Ping Response.\n");
@@ -504,6 +597,8 @@ public:
   Packet(uint8_t control, size_t bytes_remaining, ClientConnection connection)
       : control_(control), bytes_remaining_(bytes_remaining), connection_(std::move(connection)) {
     DEBUG_LOG("New packet, size: %u\n", (uint32_t)bytes_remaining);
+    // The whole packet is on its way, buffered connections can fetch it now.
+    ExpectBytes(&connection_, bytes_remaining_);
   }
 
   Packet(Packet&& from)
@@ -541,13 +636,14 @@ public:
   }
 
   void Dump() {
-    static uint8_t buffer[1024];
-    size_t to_read = bytes_remaining_;
-    Read(buffer, to_read);
-
+    uint8_t buffer[32];
     LOG("--\n");
-    for(int i = 0; i < to_read; i++) {
-      LOG("%X ", buffer[i]);
+    while (bytes_remaining_ > 0) {
+      const size_t to_read = std::min<size_t>(bytes_remaining_, sizeof(buffer));
+      if (!Read(buffer, to_read)) break;
+      for(size_t i = 0; i < to_read; i++) {
+        LOG("%X ", buffer[i]);
+      }
     }
     LOG("--\n");
   }
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <memory>
+
+namespace gnat {
+
+// Where publish payloads stored in the DataStore come from. The default,
+// a null allocator, is the general heap.
+class PayloadAllocator {
+public:
+  virtual ~PayloadAllocator() = default;
+
+  // Returns nullptr if |bytes| can't be had.
+  virtual uint8_t* Allocate(size_t bytes) = 0;
+  virtual void Free(uint8_t* data) = 0;
+};
+
+// Returns a payload to the allocator it came from.
+struct PayloadDeleter {
+  PayloadAllocator* allocator = nullptr;
+
+  PayloadDeleter() = default;
+  explicit PayloadDeleter(PayloadAllocator* allocator) : allocator(allocator) {}
+  // So heap buffers from std::unique_ptr<uint8_t[]> can still be stored.
+  PayloadDeleter(std::default_delete<uint8_t[]>) {}
+
+  void operator()(uint8_t* data) const {
+    if (allocator) {
+      allocator->Free(data);
+    } else {
+      delete[] data;
+    }
+  }
+};
+
+using Payload = std::unique_ptr<uint8_t[], PayloadDeleter>;
+
+// Allocates |bytes| from |allocator|, or the heap if it is null. The result
+// is empty if the allocator is out of space.
+inline Payload AllocatePayload(PayloadAllocator* allocator, size_t bytes) {
+  if (allocator == nullptr) {
+    return Payload(new uint8_t[bytes]);
+  }
+  return Payload(allocator->Allocate(bytes), PayloadDeleter(allocator));
+}
+
+// For payloads that point into memory owned by someone else, like a mapped
+// snapshot file. Nothing is allocated and nothing is freed.
+class UnownedPayloads : public PayloadAllocator {
+public:
+  uint8_t* Allocate(size_t) override { return nullptr; }
+  void Free(uint8_t*) override {}
+
+  // Payload pointing at |data| which must outlive it.
+  static Payload Wrap(const uint8_t* data) {
+    static UnownedPayloads instance;
+    return Payload(const_cast<uint8_t*>(data), PayloadDeleter(&instance));
+  }
+};
+
+// Fixed size slots carved out of one arena allocated up front, so memory use
+// is bounded and publishing never touches the general heap. Each size class
+// keeps its free slots on a list threaded through the slots themselves. A
+// request goes to the smallest class that fits with a free slot, so a full
+// class spills into the next larger one.
+//
+// Not thread safe, like DataStore it should be used from one thread or
+// behind a lock.
+class SlabAllocator : public PayloadAllocator {
+public:
+  static constexpr size_t kMaxClasses = 8;
+
+  struct SizeClass {
+    size_t slot_size;
+    size_t slots;
+  };
+
+  struct Stats {
+    // Bytes in the arena and in slots currently handed out.
+    size_t capacity_bytes = 0;
+    size_t used_bytes = 0;
+    size_t used_slots = 0;
+    size_t peak_slots = 0;
+    uint32_t allocations = 0;
+    // Allocations that found no free slot large enough.
+    uint32_t failures = 0;
+  };
+
+  // |classes| in increasing slot_size, at most kMaxClasses of them.
+  explicit SlabAllocator(std::initializer_list<SizeClass> classes) {
+    for (const auto& size_class : classes) {
+      if (class_count_ == kMaxClasses) break;
+      auto& slab = slabs_[class_count_++];
+      // Free slots hold the link to the next one.
+      slab.slot_size = std::max(size_class.slot_size, sizeof(uint8_t*));
+      slab.slots = size_class.slots;
+      stats_.capacity_bytes += slab.slot_size * slab.slots;
+    }
+
+    arena_.reset(new uint8_t[stats_.capacity_bytes]);
+    uint8_t* next = arena_.get();
+    for (size_t i = 0; i < class_count_; i++) {
+      auto& slab = slabs_[i];
+      slab.begin = next;
+      next += slab.slot_size * slab.slots;
+      slab.end = next;
+      for (size_t slot = slab.slots; slot > 0; slot--) {
+        Push(&slab, slab.begin + (slot - 1) * slab.slot_size);
+      }
+    }
+  }
+
+  SlabAllocator(const SlabAllocator&) = delete;
+  SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+  uint8_t* Allocate(size_t bytes) override {
+    for (size_t i = 0; i < class_count_; i++) {
+      auto& slab = slabs_[i];
+      if (slab.slot_size < bytes || slab.free == nullptr) continue;
+
+      uint8_t* slot = slab.free;
+      memcpy(&slab.free, slot, sizeof(uint8_t*));
+      slab.free_slots--;
+
+      stats_.allocations++;
+      stats_.used_bytes += slab.slot_size;
+      stats_.used_slots++;
+      stats_.peak_slots = std::max(stats_.peak_slots, stats_.used_slots);
+      return slot;
+    }
+    stats_.failures++;
+    return nullptr;
+  }
+
+  void Free(uint8_t* data) override {
+    if (data == nullptr) return;
+    for (size_t i = 0; i < class_count_; i++) {
+      auto& slab = slabs_[i];
+      if (data < slab.begin || data >= slab.end) continue;
+
+      Push(&slab, data);
+      stats_.used_bytes -= slab.slot_size;
+      stats_.used_slots--;
+      return;
+    }
+  }
+
+  const Stats& stats() const { return stats_; }
+
+  // Free slots left in the |index|th size class.
+  size_t free_slots(size_t index) const { return slabs_[index].free_slots; }
+
+private:
+  struct Slab {
+    size_t slot_size = 0;
+    size_t slots = 0;
+    size_t free_slots = 0;
+    uint8_t* begin = nullptr;
+    uint8_t* end = nullptr;
+    uint8_t* free = nullptr;
+  };
+
+  static void Push(Slab* slab, uint8_t* slot) {
+    memcpy(slot, &slab->free, sizeof(uint8_t*));
+    slab->free = slot;
+    slab->free_slots++;
+  }
+
+  std::unique_ptr<uint8_t[]> arena_;
+  Slab slabs_[kMaxClasses];
+  size_t class_count_ = 0;
+  Stats stats_;
+};
+
+}  // namespace gnat
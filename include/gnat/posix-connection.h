@@ -0,0 +1,165 @@
+// ClientConnection over a posix socket, for running the broker on a host.
+
+#pragma once
+
+#if !defined(ARDUINO) && __has_include(<sys/uio.h>)
+
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#include "server.h"
+
+namespace gnat {
+namespace posix {
+
+class Connection {
+public:
+  // Longest a read or write on a non-blocking socket waits for it to become
+  // ready before giving up on the client, so a stalled subscriber can't hold
+  // up the thread publishing to it for longer than this.
+  static constexpr int kDefaultWaitTimeoutMs = 1000;
+
+  // Borrows the socket, Close() closes it.
+  explicit Connection(int fd) : fd_(fd) {}
+
+  Connection CreateHeapCopy() {
+    Connection copy(fd_);
+    copy.wait_timeout_ms_ = wait_timeout_ms_;
+    return copy;
+  }
+
+  // Negative waits forever.
+  void set_wait_timeout_ms(int timeout_ms) { wait_timeout_ms_ = timeout_ms; }
+
+  bool Read(uint8_t* buffer, size_t bytes) {
+    while (bytes > 0) {
+      const auto read = recv(fd_, buffer, bytes, 0);
+      if (read == 0) {
+        LOG("Client disconnected..\n");
+        return false;
+      }
+      if (read < 0) {
+        if (errno == EINTR) continue;
+        // Non-blocking socket, wait for the rest.
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && Wait(POLLIN)) continue;
+        LOG("\tRead failed errno: %d\n", errno);
+        return false;
+      }
+      buffer += read;
+      bytes -= read;
+    }
+    return true;
+  }
+
+  // Reads only what has already arrived, never waits. Returns bytes read,
+  // -1 once the client is gone. For use with Server::HandleAvailable.
+  int ReadAvailable(uint8_t* buffer, size_t bytes) {
+    while (true) {
+      const auto read = recv(fd_, buffer, bytes, MSG_DONTWAIT);
+      if (read > 0) return read;
+      if (read == 0) return -1;
+      if (errno == EINTR) continue;
+      return (errno == EAGAIN || errno == EWOULDBLOCK) ? 0 : -1;
+    }
+  }
+
+  bool Drain(size_t bytes) {
+    constexpr size_t kBufferSize = 64;
+    uint8_t buffer[kBufferSize];
+    while (bytes > 0) {
+      const auto to_drain = std::min(bytes, kBufferSize);
+      if (!Read(buffer, to_drain)) return false;
+      bytes -= to_drain;
+    }
+    return true;
+  }
+
+  bool WritePartial(uint8_t* buffer, size_t bytes) {
+    return Write(buffer, bytes);
+  }
+
+  bool Write(uint8_t* buffer, size_t bytes) {
+    const IoVec buffers[] = {{buffer, bytes}};
+    return WriteV(buffers, 1);
+  }
+
+  // Gathers all |buffers| into one call, so a publish header and payload
+  // leave in one syscall and usually one segment. This is writev(2) but
+  // through sendmsg so we can ask for no SIGPIPE.
+  bool WriteV(const IoVec* buffers, size_t count) {
+    constexpr size_t kMaxBuffers = 8;
+    if (count > kMaxBuffers) {
+      return WriteV(buffers, kMaxBuffers) &&
+             WriteV(buffers + kMaxBuffers, count - kMaxBuffers);
+    }
+
+    iovec iov[kMaxBuffers];
+    for (size_t i = 0; i < count; i++) {
+      iov[i].iov_base = const_cast<uint8_t*>(buffers[i].data);
+      iov[i].iov_len = buffers[i].size;
+    }
+
+    iovec* next = iov;
+    while (count > 0) {
+      msghdr message = {};
+      message.msg_iov = next;
+      message.msg_iovlen = count;
+      auto written = sendmsg(fd_, &message, MSG_NOSIGNAL);
+      if (written < 0) {
+        if (errno == EINTR) continue;
+        if ((errno == EAGAIN || errno == EWOULDBLOCK) && Wait(POLLOUT)) continue;
+        LOG("\tWrite failed errno: %d\n", errno);
+        return false;
+      }
+
+      // Skip whatever went out, the kernel may have taken only part of it.
+      while (count > 0 && (size_t)written >= next->iov_len) {
+        written -= next->iov_len;
+        next++;
+        count--;
+      }
+      if (count > 0) {
+        next->iov_base = (uint8_t*)next->iov_base + written;
+        next->iov_len -= written;
+      }
+    }
+    return true;
+  }
+
+  void Close() {
+    close(fd_);
+  }
+
+  ConnectionType connection_type() { return connection_type_; }
+  void set_connection_type(ConnectionType type) { connection_type_ = type; }
+
+  uint32_t id() { return fd_; }
+
+private:
+  bool Wait(short events) {
+    pollfd poll_fd = {fd_, events, 0};
+    while (true) {
+      const int ready = poll(&poll_fd, 1, wait_timeout_ms_);
+      if (ready > 0) return true;
+      if (ready < 0 && errno == EINTR) continue;
+      if (ready == 0) {
+        LOG("\tClient not ready after %d ms.\n", wait_timeout_ms_);
+      }
+      return false;
+    }
+  }
+
+  int fd_;
+  int wait_timeout_ms_ = kDefaultWaitTimeoutMs;
+  ConnectionType connection_type_ = ConnectionType::UNKNOWN;
+};
+
+} // namespace posix
+} // namespace gnat
+
+#endif // !ARDUINO
@@ -1,12 +1,17 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <memory>
+#include <vector>
 
 #include "status.h"
 #include "datastore.h"
 #include "log.h"
 #include "packets.h"
+#include "packet_view.h"
+#include "stream_parser.h"
 
 namespace gnat {
 
@@ -34,128 +39,430 @@ enum class ConnectionType {
 template<typename DataStore, typename Clock>
 class Server {
 public:
-    Server(DataStore* data, Clock* clock) : data_(data), clock_(clock) {}
+    Server(DataStore* data, Clock* clock)
+        : data_(data), clock_(clock), header_cache_(std::make_shared<PublishHeaderCache>()) {}
 
     template<typename ClientConnection>
     Status HandleMessage(Packet<ClientConnection>* packet) {
       DEBUG_LOG("Handling message: %u\n", (uint8_t)packet->type());
+      auto* connection = packet->connection();
       if (packet->type() == PacketType::CONNECT) {
         const auto connect = proto3::Connect::ReadFrom(packet);
-        DEBUG_LOG("Header Read, proto: %s\n", (*connect).protocol_name.data);
-        proto3::ConnectAck ack;
-        if (!connect.has_value() || (
-            strcmp("MQTT", (*connect).protocol_name.data) == 0 &&
-            strcmp("MQIsdp", (*connect).protocol_name.data) == 0)) {
-            LOG("Connect packet has wrong header or wrong protocol.\n");
-            ack.error = true;
-        }
-
-        if ((*connect).protocol_level == 3) {
-            packet->connection()->set_connection_type(ConnectionType::MQTT_31);
-        } else if ((*connect).protocol_level == 4) {
-            packet->connection()->set_connection_type(ConnectionType::MQTT_311);
-        } else if ((*connect).protocol_level == 5) {
-            packet->connection()->set_connection_type(ConnectionType::MQTT_5);
-        } else {
-            LOG("Connect packet has unsupported protocol version.\n");
-            ack.error = true;
-        }
-
-        if(!ack.SendOn(packet->connection())) {
-          LOG("Failed to send response.\n");
-          return Status::Failure("Unable to send response.");
+        if (!connect.has_value()) {
+          LOG("Connect packet has wrong header.\n");
+          return SendConnectAck(connection, /*error=*/true);
         }
+        return HandleConnect(connection, connect->protocol_name.data,
+                             connect->protocol_name.length, connect->protocol_level);
       } else if (packet->type() == PacketType::PUBLISH) {
         const auto publish_opt = proto3::Publish::ReadFrom(packet, packet->type_flags());
         if (!publish_opt.has_value()) {
           return Status::Failure("No publish header!");
         }
         const auto& publish = *publish_opt;
+        if (!topic::IsValidName(publish.topic.data, publish.topic.length)) {
+          return Status::Failure("Invalid topic name.");
+        }
 
-        DataStoreEntry entry(clock_->timestamp());
-        entry.length = publish.payload_bytes;
-        entry.data = std::unique_ptr<uint8_t[]>(new uint8_t[entry.length]);
-        if (!packet->Read(entry.data.get(), entry.length)) {
-          LOG("Failed to read publish. Size: %u \n", entry.length);
+        const auto key = DataStore::EncodeKey(publish.topic.data, publish.topic.length);
+        bool read_failed = false;
+        const bool updated = data_->Update(key, publish.payload_bytes, clock_->timestamp(),
+            [&](uint8_t* data) {
+              read_failed = !packet->Read(data, publish.payload_bytes);
+              return !read_failed;
+            });
+        if (read_failed) {
+          LOG("Failed to read publish. Size: %u \n", publish.payload_bytes);
           return Status::Failure("Unable to complete read.");
         }
+        if (!updated) {
+          // The rest of the packet is drained when it goes away.
+          LOG("No room for publish. Size: %u \n", publish.payload_bytes);
+          return Status::Ok();
+        }
         DEBUG_LOG("Read publish.\n");
-        const auto key = DataStore::EncodeKey(publish.topic.data, publish.topic.length);
-        data_->Set(key, std::move(entry));
       } else if (packet->type() == PacketType::SUBSCRIBE) {
-        std::function<bool(const typename DataStore::Key&, const DataStoreEntry&)> observer;
-        auto topic_callback = [&](char* topic, size_t topic_length) {
-            auto connection_heap = packet->connection()->CreateHeapCopy();
-
-            if (memchr(topic, '+', topic_length) != nullptr) {
-              LOG("Use of + wildcard in topics not supported.");
-              return false;
-            }
-
-            const bool is_prefix = (memchr(topic, '#', topic_length) != nullptr);
-
-            const auto target_key = DataStore::EncodeKey(
-                topic, (is_prefix) ? topic_length -1 : topic_length);
-
-            const auto key_matcher = is_prefix ?
-              DataStore::PrefixKeyMatcher(target_key) :
-              DataStore::FullKeyMatcher(target_key);
-
-            observer =
-                [key_matcher, conn = std::move(connection_heap)]
-                (typename DataStore::Key key, const DataStoreEntry& entry) mutable {
-                  if (key_matcher(key)) {
-                    proto3::Publish packet;
-                    DataStore::DecodeKey(key, packet.topic.data, &packet.topic.length);
-                    packet.payload_bytes = entry.length;
-                    if (!packet.SendOn<ClientConnection>(&conn, entry.data.get())) {
-                      return false;
-                    }
-                  }
-                  return true;
-            };
-            return true;
+        Subscription subscription;
+        auto topic_callback = [&](const char* topic, size_t topic_length) {
+          return AddFilter(connection, topic, topic_length, &subscription);
         };
 
         const auto subscribe_opt = proto3::Subscribe::ReadFrom(packet, topic_callback);
         if (!subscribe_opt.has_value()) {
           return Status::Failure("");
         }
+        return CompleteSubscribe(connection, subscribe_opt->packet_id, std::move(subscription));
+      } else {
+        return HandleEmptyPacket(connection, packet->type());
+      }
 
-        proto3::SubscribeAck ack {
-          .subscribe_packet_id = subscribe_opt->packet_id,
-          .responses = {0},
-          .responses_count = 1,
-        };
-        if(!ack.SendOn(packet->connection())) {
-          LOG("Failed to send response.\n");
-          return Status::Failure("Unable to send response.");
+      return Status::Ok();
+    }
+
+    // Same as above for a packet already fully in memory, see packet_view.h.
+    // Nothing is copied out of |packet| except the publish payload which is
+    // copied once, straight into the DataStore entry.
+    template<typename ClientConnection>
+    Status HandleMessage(const PacketView& packet, ClientConnection* connection) {
+      DEBUG_LOG("Handling message view: %u\n", (uint8_t)packet.type());
+      if (packet.type() == PacketType::CONNECT) {
+        const auto connect = proto3::ConnectView::ReadFrom(packet);
+        if (!connect.has_value()) {
+          LOG("Connect packet has wrong header.\n");
+          return SendConnectAck(connection, /*error=*/true);
+        }
+        return HandleConnect(connection, connect->protocol_name.data,
+                             connect->protocol_name.length, connect->protocol_level);
+      } else if (packet.type() == PacketType::PUBLISH) {
+        const auto publish = proto3::PublishView::ReadFrom(packet);
+        if (!publish.has_value()) {
+          return Status::Failure("No publish header!");
+        }
+
+        if (!topic::IsValidName(publish->topic.data, publish->topic.length)) {
+          return Status::Failure("Invalid topic name.");
+        }
+
+        const auto& payload = publish->payload;
+        const auto key = DataStore::EncodeKey(publish->topic.data, publish->topic.length);
+        const bool updated = data_->Update(key, payload.length, clock_->timestamp(),
+            [&payload](uint8_t* data) {
+              memcpy(data, payload.data, payload.length);
+              return true;
+            });
+        if (!updated) {
+          LOG("No room for publish. Size: %u \n", payload.length);
+          return Status::Ok();
         }
-        if (observer) {
-          // Add the observer last, if subscribe failed we don't want it.
-          // We also don't want to send any data until the client has
-          // received the suback.
-          data_->AddObserver({.client_id = packet->connection()->id(), .handler = observer});
+      } else if (packet.type() == PacketType::SUBSCRIBE) {
+        const auto subscribe = proto3::SubscribeView::ReadFrom(packet);
+        if (!subscribe.has_value()) {
+          return Status::Failure("");
         }
-      } else if (packet->type() == PacketType::PINGREQ) {
-        if (!proto3::PingResp::SendOn(packet->connection())) {
+
+        Subscription subscription;
+        const bool topics_ok = subscribe->ForEachTopic(
+            [&](const char* topic, size_t topic_length) {
+              return AddFilter(connection, topic, topic_length, &subscription);
+            });
+        if (!topics_ok) {
+          return Status::Failure("");
+        }
+        return CompleteSubscribe(connection, subscribe->packet_id, std::move(subscription));
+      } else {
+        return HandleEmptyPacket(connection, packet.type());
+      }
+
+      return Status::Ok();
+    }
+
+    // Handles every complete packet in |data| in order, as read off the
+    // connection in one go. A packet cut off at the end is held in |carry| and
+    // finished by the next call, |carry| must stay with the connection.
+    // Stops at the first packet that fails or at a disconnect.
+    template<typename ClientConnection, size_t kCarrySize>
+    Status HandleMessages(const uint8_t* data, size_t size, ClientConnection* connection,
+                          PacketCarry<kCarrySize>* carry) {
+      if (!carry->empty()) {
+        if (!carry->Append(&data, &size)) {
+          carry->Clear();
+          return Status::Failure("Packet can not be carried.");
+        }
+        const auto packet = carry->packet();
+        if (!packet.has_value()) {
+          // Still waiting on the rest of it.
+          return Status::Ok();
+        }
+        auto status = HandleMessage(*packet, connection);
+        carry->Clear();
+        if (!status.IsOk() || packet->type() == PacketType::DISCONNECT) {
+          return status;
+        }
+      }
+
+      while (size > 0) {
+        bool malformed = false;
+        const auto packet = PacketView::Parse(data, size, &malformed);
+        if (!packet.has_value()) {
+          if (malformed) {
+            return Status::Failure("Malformed packet.");
+          }
+          if (!carry->Append(&data, &size)) {
+            carry->Clear();
+            return Status::Failure("Packet can not be carried.");
+          }
+          break;
+        }
+
+        auto status = HandleMessage(*packet, connection);
+        if (!status.IsOk() || packet->type() == PacketType::DISCONNECT) {
+          return status;
+        }
+        data += packet->size();
+        size -= packet->size();
+      }
+
+      return Status::Ok();
+    }
+
+    // Per connection progress for HandleAvailable.
+    struct StreamState;
+
+    // Resumable version of HandleMessage for non-blocking connections, give it
+    // whatever bytes the connection has ready and it picks up where the last
+    // call left off, even mid field. |state| must stay with the connection.
+    // Stops at the first packet that fails or at a disconnect.
+    template<typename ClientConnection>
+    Status HandleAvailable(const uint8_t* data, size_t size, ClientConnection* connection,
+                           StreamState* state) {
+      auto& parser = state->parser;
+      parser.set_allocator(data_->allocator());
+      while (true) {
+        size_t consumed = 0;
+        const auto result = parser.Consume(data, size, &consumed);
+        data += consumed;
+        size -= consumed;
+
+        if (result == StreamParser::Result::NEED_MORE) {
+          return Status::Ok();
+        } else if (result == StreamParser::Result::ERROR) {
+          state->subscription = Subscription();
+          return Status::Failure("Malformed packet.");
+        } else if (result == StreamParser::Result::TOPIC) {
+          if (!AddFilter(connection, parser.topic().data, parser.topic().length,
+                         &state->subscription)) {
+            return Status::Failure("");
+          }
+          continue;
+        }
+
+        auto status = HandleParsed(&parser, connection, state);
+        if (!status.IsOk() || parser.type() == PacketType::DISCONNECT) {
+          return status;
+        }
+      }
+    }
+
+private:
+    using Observer = typename DataStore::ObserverEntry::Handler;
+
+    // What a subscribe asks for, built up one topic filter at a time.
+    struct Subscription {
+      Observer observer;
+      // The filters granted, observed once the suback is sent.
+      std::vector<std::string> filters;
+      // Suback return code for each filter in the subscribe, in order.
+      std::vector<uint8_t> responses;
+    };
+
+    static bool ValidProtocolName(const char* name, size_t length) {
+      return (length == 4 && memcmp(name, "MQTT", 4) == 0) ||
+             (length == 6 && memcmp(name, "MQIsdp", 6) == 0);
+    }
+
+    template<typename ClientConnection>
+    Status SendConnectAck(ClientConnection* connection, bool error) {
+      proto3::ConnectAck ack;
+      ack.error = error;
+      if(!ack.SendOn(connection)) {
+        LOG("Failed to send response.\n");
+        return Status::Failure("Unable to send response.");
+      }
+      return Status::Ok();
+    }
+
+    template<typename ClientConnection>
+    Status HandleConnect(ClientConnection* connection, const char* protocol_name,
+                         size_t protocol_name_length, uint8_t protocol_level) {
+      bool error = false;
+      if (!ValidProtocolName(protocol_name, protocol_name_length)) {
+          LOG("Connect packet has wrong protocol.\n");
+          error = true;
+      }
+
+      if (protocol_level == 3) {
+          connection->set_connection_type(ConnectionType::MQTT_31);
+      } else if (protocol_level == 4) {
+          connection->set_connection_type(ConnectionType::MQTT_311);
+      } else if (protocol_level == 5) {
+          connection->set_connection_type(ConnectionType::MQTT_5);
+      } else {
+          LOG("Connect packet has unsupported protocol version.\n");
+          error = true;
+      }
+
+      return SendConnectAck(connection, error);
+    }
+
+    // The wire header of the last publish sent to a subscriber, shared by all
+    // subscriptions made through this server. A header only depends on the
+    // topic and payload size, so a Set fanned out to many subscribers encodes
+    // it once and every subscriber after the first only pays for the write.
+    struct PublishHeaderCache {
+      template<typename ClientConnection>
+      bool Send(ClientConnection* connection, const typename DataStore::Key& key,
+                const DataStoreEntry& entry) {
+        if (busy.test_and_set(std::memory_order_acquire)) {
+          // Another thread is sending from the cache, rather than wait encode
+          // our own copy.
+          return WithEncodeContext(connection, [&](EncodeContext* context) {
+            const auto header_size = Encode(key, entry.length, context->buffer);
+            return proto3::Publish::SendEncoded(connection, context->buffer, header_size,
+                                                entry.data.get(), entry.length);
+          });
+        }
+
+        if (!valid || entry.length != payload_bytes || !(key == this->key)) {
+          size = Encode(key, entry.length, header);
+          this->key = key;
+          payload_bytes = entry.length;
+          valid = true;
+        }
+        const bool sent = proto3::Publish::SendEncoded(connection, header, size,
+                                                       entry.data.get(), entry.length);
+        busy.clear(std::memory_order_release);
+        return sent;
+      }
+
+      static uint8_t Encode(const typename DataStore::Key& key, uint32_t payload_bytes,
+                            uint8_t* buffer) {
+        static_assert(decltype(proto3::Publish::topic)::kSize >= kMaxDecodedTopicLength,
+                      "DecodeKey writes up to kMaxDecodedTopicLength bytes.");
+        proto3::Publish packet;
+        DataStore::DecodeKey(key, packet.topic.data, &packet.topic.length);
+        packet.payload_bytes = payload_bytes;
+        return packet.EncodeHeader(buffer);
+      }
+
+      std::atomic_flag busy = ATOMIC_FLAG_INIT;
+      bool valid = false;
+      typename DataStore::Key key{};
+      uint32_t payload_bytes = 0;
+      uint8_t size = 0;
+      uint8_t header[proto3::Publish::kMaxHeaderSize];
+    };
+
+    // Adds the topic filter |topic| to |subscription|, building the observer
+    // delivering matches to a copy of |connection| on the first one. A filter
+    // the DataStore can't match is refused with 0x80 in the suback, the others
+    // in the subscribe still are granted. Returns false if the subscribe is
+    // malformed.
+    template<typename ClientConnection>
+    bool AddFilter(ClientConnection* connection, const char* topic,
+                   size_t topic_length, Subscription* subscription) {
+      const auto scan = topic::Scan(topic, topic_length);
+      if (topic_length == 0 || !scan.valid_utf8 || !scan.valid_wildcards) {
+        LOG("Invalid topic filter.\n");
+        return false;
+      }
+      if (subscription->responses.size() == sizeof(proto3::SubscribeAck::responses)) {
+        LOG("Too many topics in one subscribe.\n");
+        return false;
+      }
+      if (!DataStore::SupportsFilter(topic, topic_length)) {
+        LOG("Topic filter not supported by this key type.\n");
+        subscription->responses.push_back(proto3::SubscribeAck::kFailure);
+        return true;
+      }
+      subscription->responses.push_back(0);
+      subscription->filters.emplace_back(topic, topic_length);
+
+      if (!subscription->observer) {
+        // Matching is done by the DataStore, the observer only sends.
+        subscription->observer =
+            [cache = header_cache_, conn = connection->CreateHeapCopy()]
+            (typename DataStore::Key key, const DataStoreEntry& entry) mutable {
+              return cache->Send(&conn, key, entry);
+        };
+      }
+      return true;
+    }
+
+    template<typename ClientConnection>
+    Status CompleteSubscribe(ClientConnection* connection, uint16_t packet_id,
+                             Subscription subscription) {
+      proto3::SubscribeAck ack;
+      ack.subscribe_packet_id = packet_id;
+      ack.responses_count = std::max<size_t>(subscription.responses.size(), 1);
+      if (!subscription.responses.empty()) {
+        memcpy(ack.responses, subscription.responses.data(), subscription.responses.size());
+      }
+      if(!ack.SendOn(connection)) {
+        LOG("Failed to send response.\n");
+        return Status::Failure("Unable to send response.");
+      }
+      // Add the observers last, if subscribe failed we don't want them.
+      // We also don't want to send any data until the client has
+      // received the suback.
+      for (const auto& filter : subscription.filters) {
+        data_->AddObserver({.client_id = connection->id(), .handler = subscription.observer},
+                           filter.data(), filter.size());
+      }
+      return Status::Ok();
+    }
+
+    // Packets that carry nothing we need to read.
+    template<typename ClientConnection>
+    Status HandleEmptyPacket(ClientConnection* connection, PacketType type) {
+      if (type == PacketType::PINGREQ) {
+        if (!proto3::PingResp::SendOn(connection)) {
           LOG("Failed to send response.\n");
           return Status::Failure("Unable to send response.");
         }
-      } else if (packet->type() == PacketType::DISCONNECT) {
+      } else if (type == PacketType::DISCONNECT) {
         LOG("Client disconnected..\n");
-        packet->connection()->Close();
+        connection->Close();
       } else {
-        LOG("Unsupported packet type: %u\n", (uint8_t)packet->type());
+        LOG("Unsupported packet type: %u\n", (uint8_t)type);
         return Status::Failure("Unsupported packet type.");
       }
+      return Status::Ok();
+    }
 
+    template<typename ClientConnection>
+    Status HandleParsed(StreamParser* parser, ClientConnection* connection,
+                        StreamState* state) {
+      DEBUG_LOG("Handling parsed message: %u\n", (uint8_t)parser->type());
+      if (parser->type() == PacketType::CONNECT) {
+        const auto& connect = parser->connect();
+        return HandleConnect(connection, connect.protocol_name.data,
+                             connect.protocol_name.length, connect.protocol_level);
+      } else if (parser->type() == PacketType::PUBLISH) {
+        const auto& publish = parser->publish();
+        if (!topic::IsValidName(publish.topic.data, publish.topic.length)) {
+          return Status::Failure("Invalid topic name.");
+        }
+        DataStoreEntry entry(clock_->timestamp());
+        entry.data = parser->TakePayload();
+        if (!entry.data) {
+          LOG("No room for publish. Size: %u \n", publish.payload_bytes);
+          return Status::Ok();
+        }
+        entry.length = publish.payload_bytes;
+        const auto key = DataStore::EncodeKey(publish.topic.data, publish.topic.length);
+        if (!data_->Set(key, std::move(entry))) {
+          LOG("No room for topic.\n");
+        }
+      } else if (parser->type() == PacketType::SUBSCRIBE) {
+        Subscription subscription = std::move(state->subscription);
+        state->subscription = Subscription();
+        return CompleteSubscribe(connection, parser->packet_id(), std::move(subscription));
+      } else {
+        return HandleEmptyPacket(connection, parser->type());
+      }
       return Status::Ok();
     }
 
-private:
     DataStore* data_;
     Clock* clock_;
+    std::shared_ptr<PublishHeaderCache> header_cache_;
+};
+
+template<typename DataStore, typename Clock>
+struct Server<DataStore, Clock>::StreamState {
+  StreamParser parser;
+  // Subscription built from the topics of a subscribe still being read.
+  Subscription subscription;
 };
 
 } // namespace gnat
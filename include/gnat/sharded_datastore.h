@@ -0,0 +1,214 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "datastore.h"
+#include "flat_hash_map.h"
+
+namespace gnat {
+
+// DataStore that can be used from many threads at once, for running one
+// Server::HandleMessage per connection in parallel. Keys are spread over
+// |kShards| DataStores each behind its own lock, so publishes to topics in
+// different shards don't wait on each other.
+//
+// Observers for a single topic live in that topic's shard, wildcard ones in
+// every shard. Observers are called with their shard locked and deliveries to
+// one client are serialized, so a client never sees two at once even from
+// different shards. An observer must not call back into the store. Every
+// other publish and delivery in the shard waits while an observer runs, so
+// observers writing to clients must bound how long a write can block, as
+// posix::Connection does with its wait timeout.
+//
+// Entries are only reachable under the lock, so instead of Get there is
+// Read which runs a callback while the shard is held. With snapshots enabled
+// Snapshot reads the latest value without waiting on any shard.
+//
+// |Storage| and |Subscriptions| are used by every shard, see DataStore.
+template<typename KeyType, size_t kShards = 16,
+         typename Storage = UnorderedStorage<KeyType, DataStoreEntry>,
+         typename Subscriptions = TrieSubscriptions>
+class ShardedDataStore {
+public:
+    using Shard = DataStore<KeyType, Storage, NoEviction<KeyType>, Subscriptions>;
+    using Key = KeyType;
+    using Traits = KeyTraits<KeyType>;
+    using ObserverEntry = typename Shard::ObserverEntry;
+    using Handler = typename ObserverEntry::Handler;
+
+    // |allocator| is shared by every shard so it must be thread safe.
+    explicit ShardedDataStore(PayloadAllocator* allocator = nullptr) : allocator_(allocator) {
+      for (auto& shard : shards_) shard.data.reset(new Shard(allocator));
+    }
+
+    static KeyType EncodeKey(const char* decoded, size_t bytes) {
+      return Shard::EncodeKey(decoded, bytes);
+    }
+
+    static void DecodeKey(const KeyType& key, char* encoded, uint16_t* bytes) {
+      Shard::DecodeKey(key, encoded, bytes);
+    }
+
+    DataStoreEntry CreateEntry(uint32_t length, uint32_t timestamp) {
+      DataStoreEntry entry(timestamp);
+      entry.data = AllocatePayload(allocator_, length);
+      if (entry.data) {
+        entry.length = length;
+        entry.capacity = length;
+      }
+      return entry;
+    }
+
+    PayloadAllocator* allocator() { return allocator_; }
+
+    bool Set(const KeyType& key, DataStoreEntry entry) {
+      auto& shard = ShardFor(key);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      return shard.data->Set(key, std::move(entry));
+    }
+
+    // Like DataStore::Update but |fill| writes a new buffer before the shard
+    // is locked, it may be reading from a slow client. Nothing is written in
+    // place, the buffer then replaces the value as with Set.
+    template<typename Fill>
+    bool Update(const KeyType& key, uint32_t length, uint32_t timestamp, Fill&& fill) {
+      auto entry = CreateEntry(length, timestamp);
+      if (!entry.data || !fill(entry.data.get())) {
+        return false;
+      }
+      return Set(key, std::move(entry));
+    }
+
+    // Copies every value into a SnapshotTable from now on so Snapshot works.
+    // Costs a copy of each payload, call before sharing the store.
+    void EnableSnapshots() {
+      snapshots_.reset(new SnapshotTable<KeyType>());
+      for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.data->set_snapshots(snapshots_.get());
+      }
+    }
+
+    // Latest value for |key|, null if it has none or snapshots are off.
+    SnapshotPtr Snapshot(const KeyType& key) const {
+      return snapshots_ ? snapshots_->Get(key) : nullptr;
+    }
+
+    // Calls |visit(const DataStoreEntry&)| with the entry for |key| if there
+    // is one. Returns whether there was.
+    template<typename Visit>
+    bool Read(const KeyType& key, Visit&& visit) {
+      auto& shard = ShardFor(key);
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      const auto* entry = shard.data->Find(key);
+      if (entry == nullptr) return false;
+      visit(*entry);
+      return true;
+    }
+
+    size_t size() {
+      size_t size = 0;
+      for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        size += shard.data->size();
+      }
+      return size;
+    }
+
+    // Shards are visited one at a time, each under its lock.
+    template<typename Visit>
+    void ForEachPrefix(const char* prefix, size_t length, Visit&& visit) {
+      for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.data->ForEachPrefix(prefix, length, visit);
+      }
+    }
+
+    void RemoveObserversForClient(uint32_t client_id) {
+      for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.data->RemoveObserversForClient(client_id);
+      }
+      std::lock_guard<std::mutex> lock(clients_mutex_);
+      client_locks_.erase(client_id);
+    }
+
+    void AddObserver(ObserverEntry observer) {
+      AddObserver(std::move(observer), "#", 1);
+    }
+
+    // See DataStore::AddObserver.
+    bool AddObserver(ObserverEntry observer, const char* filter, size_t filter_length) {
+      if (filter_length > Shard::kMaxFilterLength ||
+          !topic::IsValidFilter(filter, filter_length)) {
+        return false;
+      }
+      char normalized[Shard::kMaxFilterLength];
+      size_t normalized_length = 0;
+      if (!Traits::NormalizeFilter(filter, filter_length, normalized, &normalized_length)) {
+        return false;
+      }
+
+      // Shared by the shards rather than copied, a handler wrapping another
+      // wouldn't fit in one.
+      observer.handler = [lock = ClientLock(observer.client_id),
+                          handler = std::make_shared<const Handler>(std::move(observer.handler))]
+          (const KeyType& key, const DataStoreEntry& entry) {
+            std::lock_guard<std::mutex> guard(*lock);
+            return (*handler)(key, entry);
+          };
+
+      if (!topic::HasWildcard(normalized, normalized_length)) {
+        // Only ever matches the one key.
+        auto& shard = ShardFor(Traits::Encode(normalized, normalized_length));
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        return shard.data->AddObserver(std::move(observer), normalized, normalized_length);
+      }
+
+      for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        if (!shard.data->AddObserver(observer, normalized, normalized_length)) {
+          return false;
+        }
+      }
+      return true;
+    }
+
+    // See DataStore::SupportsFilter.
+    static bool SupportsFilter(const char* filter, size_t filter_length) {
+      return Shard::SupportsFilter(filter, filter_length);
+    }
+
+private:
+    struct ShardState {
+      std::mutex mutex;
+      std::unique_ptr<Shard> data;
+    };
+
+    ShardState& ShardFor(const KeyType& key) {
+      // Mixed again so shards don't all get keys with the same low hash bits,
+      // which a FlatHashMap inside them would index by.
+      const auto hash = Mix64(MixedHash<KeyType>()(key) + 0x9e3779b97f4a7c15ull);
+      return shards_[hash % kShards];
+    }
+
+    // Shared by every observer of |client_id|.
+    std::shared_ptr<std::mutex> ClientLock(uint32_t client_id) {
+      std::lock_guard<std::mutex> lock(clients_mutex_);
+      auto& client_lock = client_locks_[client_id];
+      if (!client_lock) client_lock = std::make_shared<std::mutex>();
+      return client_lock;
+    }
+
+    PayloadAllocator* allocator_;
+    std::unique_ptr<SnapshotTable<KeyType>> snapshots_;
+    ShardState shards_[kShards];
+
+    std::mutex clients_mutex_;
+    std::unordered_map<uint32_t, std::shared_ptr<std::mutex>> client_locks_;
+};
+
+}  // namespace gnat
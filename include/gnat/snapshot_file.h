@@ -0,0 +1,299 @@
+// Snapshot of a DataStore in a flat layout that can be used straight from
+// memory, for a warm restart from a memory mapped file.
+//
+// Layout, all integers native endian and every part 8 byte aligned:
+//   SnapshotHeader
+//   records, each a SnapshotRecord followed by the topic then the payload
+//   index, index_slots uint64_t offsets of records by topic hash, 0 if empty
+// Nothing is parsed on open, lookups hash the topic and probe the index.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "flat_hash_map.h"
+
+namespace gnat {
+
+struct SnapshotHeader {
+  static constexpr char kMagic[8] = {'G', 'N', 'A', 'T', 'S', 'N', 'A', 'P'};
+  static constexpr uint32_t kVersion = 1;
+
+  char magic[8];
+  uint32_t version;
+  uint32_t count;
+  uint64_t index_offset;
+  uint64_t index_slots;
+};
+
+struct SnapshotRecord {
+  uint32_t length;
+  uint32_t timestamp;
+  uint16_t topic_length;
+};
+
+// One value in a snapshot, pointing into the snapshot's memory.
+struct SnapshotEntry {
+  const char* topic;
+  size_t topic_length;
+  const uint8_t* data;
+  uint32_t length;
+  uint32_t timestamp;
+};
+
+// Reads a snapshot in memory, checking every offset against |size| so a
+// truncated or corrupt file can't send us outside of it.
+class SnapshotView {
+public:
+  // Null if |data| doesn't start with a snapshot header we understand.
+  static std::unique_ptr<SnapshotView> Open(const uint8_t* data, size_t size) {
+    if (size < sizeof(SnapshotHeader)) return nullptr;
+    SnapshotHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, SnapshotHeader::kMagic, sizeof(header.magic)) != 0 ||
+        header.version != SnapshotHeader::kVersion ||
+        header.index_slots == 0 || (header.index_slots & (header.index_slots - 1)) != 0 ||
+        header.index_offset > size ||
+        header.index_slots > (size - header.index_offset) / sizeof(uint64_t)) {
+      return nullptr;
+    }
+    return std::unique_ptr<SnapshotView>(new SnapshotView(data, size, header));
+  }
+
+  static uint64_t Hash(const char* topic, size_t length) {
+    // FNV-1a, stable across runs and builds unlike std::hash.
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i < length; i++) {
+      hash = (hash ^ (uint8_t)topic[i]) * 0x100000001b3ull;
+    }
+    return Mix64(hash);
+  }
+
+  bool Find(const char* topic, size_t length, SnapshotEntry* out) const {
+    const uint64_t mask = header_.index_slots - 1;
+    uint64_t slot = Hash(topic, length) & mask;
+    for (uint64_t probes = 0; probes < header_.index_slots; probes++) {
+      uint64_t offset = 0;
+      memcpy(&offset, data_ + header_.index_offset + slot * sizeof(uint64_t), sizeof(offset));
+      if (offset == 0) return false;
+      if (!Read(offset, out, nullptr)) return false;
+      if (out->topic_length == length && memcmp(out->topic, topic, length) == 0) {
+        return true;
+      }
+      slot = (slot + 1) & mask;
+    }
+    return false;
+  }
+
+  // Calls |visit(const SnapshotEntry&)| for every value, stops early if the
+  // records are corrupt.
+  template<typename Visit>
+  void ForEach(Visit&& visit) const {
+    uint64_t offset = sizeof(SnapshotHeader);
+    SnapshotEntry entry;
+    for (uint32_t i = 0; i < header_.count; i++) {
+      if (!Read(offset, &entry, &offset)) return;
+      visit(entry);
+    }
+  }
+
+  size_t size() const { return header_.count; }
+
+private:
+  SnapshotView(const uint8_t* data, size_t size, const SnapshotHeader& header)
+      : data_(data), size_(size), header_(header) {}
+
+  // Record at |offset|, |next| is set to the one after it.
+  bool Read(uint64_t offset, SnapshotEntry* out, uint64_t* next) const {
+    const uint64_t end = header_.index_offset;
+    if (offset < sizeof(SnapshotHeader) || offset > end ||
+        end - offset < sizeof(SnapshotRecord)) {
+      return false;
+    }
+    SnapshotRecord record;
+    memcpy(&record, data_ + offset, sizeof(record));
+    const uint64_t body = offset + sizeof(SnapshotRecord);
+    if (end - body < (uint64_t)record.topic_length + record.length) return false;
+
+    out->topic = reinterpret_cast<const char*>(data_ + body);
+    out->topic_length = record.topic_length;
+    out->data = data_ + body + record.topic_length;
+    out->length = record.length;
+    out->timestamp = record.timestamp;
+    if (next) *next = Align(body + record.topic_length + record.length);
+    return true;
+  }
+
+  static uint64_t Align(uint64_t offset) {
+    return (offset + 7) & ~uint64_t(7);
+  }
+
+  friend class SnapshotWriter;
+
+  const uint8_t* data_;
+  size_t size_;
+  SnapshotHeader header_;
+};
+
+// Serializes a store into the layout above, see WriteSnapshot.
+class SnapshotWriter {
+public:
+  void Add(const char* topic, size_t topic_length, const uint8_t* data, uint32_t length,
+           uint32_t timestamp) {
+    entries_.push_back({topic, topic_length, data, length, timestamp});
+  }
+
+  // Passes the snapshot to |write(const uint8_t*, size_t)| in order, which
+  // returns false to give up. The added entries must still be valid.
+  template<typename Write>
+  bool Finish(Write&& write) {
+    std::vector<uint64_t> offsets;
+    offsets.reserve(entries_.size());
+    uint64_t offset = sizeof(SnapshotHeader);
+    for (const auto& entry : entries_) {
+      offsets.push_back(offset);
+      offset = SnapshotView::Align(
+          offset + sizeof(SnapshotRecord) + entry.topic_length + entry.length);
+    }
+
+    SnapshotHeader header;
+    memcpy(header.magic, SnapshotHeader::kMagic, sizeof(header.magic));
+    header.version = SnapshotHeader::kVersion;
+    header.count = entries_.size();
+    header.index_offset = offset;
+    // At most half full so probes stay short.
+    header.index_slots = 16;
+    while (header.index_slots < entries_.size() * 2) header.index_slots *= 2;
+
+    std::vector<uint64_t> index(header.index_slots, 0);
+    for (size_t i = 0; i < entries_.size(); i++) {
+      const auto& entry = entries_[i];
+      uint64_t slot = SnapshotView::Hash(entry.topic, entry.topic_length) &
+                      (header.index_slots - 1);
+      while (index[slot] != 0) slot = (slot + 1) & (header.index_slots - 1);
+      index[slot] = offsets[i];
+    }
+
+    static const uint8_t kPadding[8] = {0};
+    if (!write(reinterpret_cast<const uint8_t*>(&header), sizeof(header))) return false;
+    for (const auto& entry : entries_) {
+      SnapshotRecord record;
+      memset(&record, 0, sizeof(record));
+      record.length = entry.length;
+      record.timestamp = entry.timestamp;
+      record.topic_length = entry.topic_length;
+      const size_t used = sizeof(record) + entry.topic_length + entry.length;
+      if (!write(reinterpret_cast<const uint8_t*>(&record), sizeof(record)) ||
+          !write(reinterpret_cast<const uint8_t*>(entry.topic), entry.topic_length) ||
+          !write(entry.data, entry.length) ||
+          !write(kPadding, SnapshotView::Align(used) - used)) {
+        return false;
+      }
+    }
+    return write(reinterpret_cast<const uint8_t*>(index.data()),
+                 index.size() * sizeof(uint64_t));
+  }
+
+private:
+  std::vector<SnapshotEntry> entries_;
+};
+
+// Snapshot of everything in |store|, see SnapshotWriter::Finish for |write|.
+template<typename DataStore, typename Write>
+bool WriteSnapshot(DataStore* store, Write&& write) {
+  SnapshotWriter writer;
+  // Topics of packed keys are decoded into here, so they outlive the visit.
+  std::deque<std::string> topics;
+  store->ForEachPrefix("", 0, [&](const typename DataStore::Key& key,
+                                   const auto& entry) {
+    char scratch[DataStore::Traits::kTopicScratchSize];
+    size_t topic_length = 0;
+    const char* topic = DataStore::Traits::Topic(key, scratch, &topic_length);
+    if (topic == scratch) {
+      topics.emplace_back(topic, topic_length);
+      topic = topics.back().data();
+    }
+    writer.Add(topic, topic_length, entry.data.get(), entry.length, entry.timestamp);
+  });
+  return writer.Finish(write);
+}
+
+}  // namespace gnat
+
+#if !defined(ARDUINO) && __has_include(<sys/mman.h>)
+
+#include <cstdio>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace gnat {
+
+// A snapshot file mapped read only. Pages are only read in as values are
+// looked up, so opening costs the same whatever the size of the store.
+class MappedSnapshot {
+public:
+  // Null if the file is missing or not a snapshot.
+  static std::unique_ptr<MappedSnapshot> Open(const char* path) {
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) return nullptr;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+      close(fd);
+      return nullptr;
+    }
+    void* data = mmap(nullptr, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) return nullptr;
+
+    std::unique_ptr<MappedSnapshot> out(new MappedSnapshot(data, info.st_size));
+    out->view_ = SnapshotView::Open(static_cast<const uint8_t*>(data), info.st_size);
+    if (!out->view_) return nullptr;
+    return out;
+  }
+
+  // Writes |store| to |path|, replacing it only once the new file is
+  // complete so a crash mid save keeps the old snapshot.
+  template<typename DataStore>
+  static bool Save(const char* path, DataStore* store) {
+    const std::string temporary = std::string(path) + ".tmp";
+    FILE* file = fopen(temporary.c_str(), "wb");
+    if (file == nullptr) return false;
+    const bool written = WriteSnapshot(store, [file](const uint8_t* data, size_t size) {
+      return size == 0 || fwrite(data, 1, size, file) == size;
+    });
+    const bool closed = fflush(file) == 0 && fsync(fileno(file)) == 0;
+    fclose(file);
+    if (!written || !closed || rename(temporary.c_str(), path) != 0) {
+      remove(temporary.c_str());
+      return false;
+    }
+    return true;
+  }
+
+  ~MappedSnapshot() {
+    munmap(data_, size_);
+  }
+
+  MappedSnapshot(const MappedSnapshot&) = delete;
+  MappedSnapshot& operator=(const MappedSnapshot&) = delete;
+
+  const SnapshotView* view() const { return view_.get(); }
+
+private:
+  MappedSnapshot(void* data, size_t size) : data_(data), size_(size) {}
+
+  void* data_;
+  size_t size_;
+  std::unique_ptr<SnapshotView> view_;
+};
+
+}  // namespace gnat
+
+#endif  // !ARDUINO
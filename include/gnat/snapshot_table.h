@@ -0,0 +1,121 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+#include "flat_hash_map.h"
+
+namespace gnat {
+
+// An immutable copy of a value at one point in time, it stays valid for as
+// long as the reader holds on to it whatever happens to the key.
+struct ValueSnapshot {
+  std::unique_ptr<uint8_t[]> data;
+  uint32_t length = 0;
+  uint32_t timestamp = 0;
+};
+
+using SnapshotPtr = std::shared_ptr<const ValueSnapshot>;
+
+// Latest value for every key, readable from any thread while writers publish
+// new versions.
+//
+// Keys are spread over kStripes copy on write indexes of slots, each slot
+// holding the key's latest snapshot. Readers load the index and then the
+// slot with std::atomic_load and never take a lock a writer holds, so a read
+// doesn't wait on a payload copy, an index copy or a DataStore shard. The
+// atomic shared_ptr operations themselves may use a short internal spinlock,
+// as libstdc++'s do, held only for the pointer copy.
+//
+// Publishing to a known key swaps its slot. A new or removed key copies its
+// stripe's index under that stripe's writer lock, 1/kStripes of the keys, so
+// indexes only hold live keys. Old versions are freed when their last reader
+// lets go.
+//
+// Writers of one key must be serialized by the caller, DataStore is.
+template<typename KeyType>
+class SnapshotTable {
+public:
+  static constexpr size_t kStripes = 64;
+
+  // Null if |key| has no value.
+  SnapshotPtr Get(const KeyType& key) const {
+    const auto index = std::atomic_load(&StripeFor(key).index);
+    const auto slot = index->find(key);
+    if (slot == index->end()) return nullptr;
+    return std::atomic_load(&slot->second->value);
+  }
+
+  void Publish(const KeyType& key, const uint8_t* data, uint32_t length,
+               uint32_t timestamp) {
+    auto snapshot = std::make_shared<ValueSnapshot>();
+    snapshot->data.reset(new uint8_t[length]);
+    memcpy(snapshot->data.get(), data, length);
+    snapshot->length = length;
+    snapshot->timestamp = timestamp;
+    std::atomic_store(&SlotFor(key)->value, SnapshotPtr(std::move(snapshot)));
+  }
+
+  void Remove(const KeyType& key) {
+    Stripe& stripe = StripeFor(key);
+    std::lock_guard<std::mutex> lock(stripe.writer_mutex);
+    const auto index = std::atomic_load(&stripe.index);
+    const auto slot = index->find(key);
+    if (slot == index->end()) return;
+    // Readers still holding the old index see the key gone too.
+    std::atomic_store(&slot->second->value, SnapshotPtr());
+    auto updated = std::make_shared<Index>(*index);
+    updated->erase(key);
+    std::atomic_store(&stripe.index, std::shared_ptr<const Index>(std::move(updated)));
+  }
+
+  size_t size() const {
+    size_t size = 0;
+    for (const auto& stripe : stripes_) size += std::atomic_load(&stripe.index)->size();
+    return size;
+  }
+
+private:
+  struct Slot {
+    SnapshotPtr value;
+  };
+  using Index = std::unordered_map<KeyType, std::shared_ptr<Slot>>;
+
+  struct Stripe {
+    std::shared_ptr<const Index> index = std::make_shared<const Index>();
+    std::mutex writer_mutex;
+  };
+
+  Stripe& StripeFor(const KeyType& key) {
+    return stripes_[MixedHash<KeyType>()(key) % kStripes];
+  }
+  const Stripe& StripeFor(const KeyType& key) const {
+    return stripes_[MixedHash<KeyType>()(key) % kStripes];
+  }
+
+  std::shared_ptr<Slot> SlotFor(const KeyType& key) {
+    Stripe& stripe = StripeFor(key);
+    auto index = std::atomic_load(&stripe.index);
+    auto slot = index->find(key);
+    if (slot != index->end()) return slot->second;
+
+    std::lock_guard<std::mutex> lock(stripe.writer_mutex);
+    // Someone may have added it while we waited.
+    index = std::atomic_load(&stripe.index);
+    slot = index->find(key);
+    if (slot != index->end()) return slot->second;
+
+    auto updated = std::make_shared<Index>(*index);
+    auto added = std::make_shared<Slot>();
+    updated->emplace(key, added);
+    std::atomic_store(&stripe.index, std::shared_ptr<const Index>(std::move(updated)));
+    return added;
+  }
+
+  Stripe stripes_[kStripes];
+};
+
+}  // namespace gnat
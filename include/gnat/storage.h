@@ -0,0 +1,154 @@
+#pragma once
+
+#include <cstddef>
+#include <map>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+#include "connection_traits.h"
+#include "flat_hash_map.h"
+#include "optional_fill.h"
+
+namespace gnat {
+
+// Storage policies for DataStore, picked with its second template parameter.
+//
+// A Storage is a map from Key to Value with the std::unordered_map subset:
+//   iterator find(const Key&);
+//   std::pair<iterator, bool> emplace(const Key&, Value&&);
+//     Inserts unless the key exists. A storage that is full returns end().
+//   iterator erase(iterator);
+//   Value& at(const Key&);   Throws std::out_of_range if missing.
+//   size_t size() const;
+//   begin()/end() iterating entries with ->first and ->second.
+// Iterators and references may be invalidated by emplace and erase.
+//
+// Optionally:
+//   iterator lower_bound(const Key&);
+//     Entries in key order, DataStore uses this for prefix scans on keys
+//     that sort like their topics.
+//
+// Shipped policies:
+//   UnorderedStorage    std::unordered_map, one heap node per key.
+//   FlatStorage         FlatHashMap, one array, for lots of keys.
+//   OrderedStorage      std::map, sorted for prefix scans.
+//   StaticArrayStorage  Fixed capacity array, never allocates, for
+//                       microcontrollers with a known set of topics.
+
+template<typename Key, typename Value>
+using UnorderedStorage = std::unordered_map<Key, Value>;
+
+template<typename Key, typename Value>
+using FlatStorage = FlatHashMap<Key, Value>;
+
+template<typename Key, typename Value>
+using OrderedStorage = std::map<Key, Value>;
+
+// Up to |kCapacity| entries held inline and found by a linear scan, which for
+// the few dozen topics a microcontroller keeps beats hashing. Once full new
+// keys are refused.
+template<typename Key, typename Value, size_t kCapacity>
+class StaticArrayStorage {
+public:
+  using key_type = Key;
+  using mapped_type = Value;
+  using value_type = std::pair<Key, Value>;
+
+  class iterator {
+  public:
+    iterator(StaticArrayStorage* storage, size_t slot) : storage_(storage), slot_(slot) {
+      SkipEmpty();
+    }
+
+    value_type& operator*() const { return *storage_->slots_[slot_]; }
+    value_type* operator->() const { return &*storage_->slots_[slot_]; }
+
+    iterator& operator++() {
+      slot_++;
+      SkipEmpty();
+      return *this;
+    }
+
+    bool operator==(const iterator& other) const { return slot_ == other.slot_; }
+    bool operator!=(const iterator& other) const { return slot_ != other.slot_; }
+
+  private:
+    friend class StaticArrayStorage;
+
+    void SkipEmpty() {
+      while (slot_ < kCapacity && !storage_->slots_[slot_]) slot_++;
+    }
+
+    StaticArrayStorage* storage_;
+    size_t slot_;
+  };
+
+  iterator begin() { return iterator(this, 0); }
+  iterator end() { return iterator(this, kCapacity); }
+
+  size_t size() const { return size_; }
+  static constexpr size_t capacity() { return kCapacity; }
+
+  iterator find(const Key& key) {
+    return iterator(this, Find(key));
+  }
+
+  Value& at(const Key& key) {
+    const size_t slot = Find(key);
+    if (slot == kCapacity) throw std::out_of_range("StaticArrayStorage::at");
+    return slots_[slot]->second;
+  }
+
+  template<typename... Args>
+  std::pair<iterator, bool> emplace(const Key& key, Args&&... args) {
+    const size_t existing = Find(key);
+    if (existing != kCapacity) return {iterator(this, existing), false};
+
+    for (size_t slot = 0; slot < kCapacity; slot++) {
+      if (slots_[slot]) continue;
+      slots_[slot].emplace(std::piecewise_construct, std::forward_as_tuple(key),
+                           std::forward_as_tuple(std::forward<Args>(args)...));
+      size_++;
+      return {iterator(this, slot), true};
+    }
+    return {end(), false};
+  }
+
+  iterator erase(iterator position) {
+    slots_[position.slot_].reset();
+    size_--;
+    return iterator(this, position.slot_);
+  }
+
+  size_t erase(const Key& key) {
+    const size_t slot = Find(key);
+    if (slot == kCapacity) return 0;
+    erase(iterator(this, slot));
+    return 1;
+  }
+
+private:
+  size_t Find(const Key& key) const {
+    for (size_t slot = 0; slot < kCapacity; slot++) {
+      if (slots_[slot] && slots_[slot]->first == key) return slot;
+    }
+    return kCapacity;
+  }
+
+  std::optional<value_type> slots_[kCapacity];
+  size_t size_ = 0;
+};
+
+// Whether |Storage| keeps its keys in order, see lower_bound above.
+template<typename Storage, typename = void>
+struct HasLowerBound : std::false_type {};
+
+template<typename Storage>
+struct HasLowerBound<Storage, void_t<decltype(
+    std::declval<Storage&>().lower_bound(std::declval<const typename Storage::key_type&>()))>>
+    : std::true_type {};
+
+}  // namespace gnat
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <algorithm>
+#include <cstring>
+#include <memory>
+
+#include "packets.h"
+#include "payload_allocator.h"
+
+namespace gnat {
+
+// Resumable packet decoder for connections that can't block on Read. Feed it
+// whatever bytes are available, it remembers where it was between calls down
+// to the middle of a field, including the remaining size of the fixed header.
+//
+// Fields are decoded into the same structs as Packet/ReadFrom. The publish
+// payload is written straight to its final buffer as it arrives and anything
+// we don't use (the rest of a connect, unknown packets) is skipped without
+// being buffered.
+class StreamParser {
+public:
+  enum class Result {
+    // Everything given was consumed, call again when more is available.
+    NEED_MORE,
+    // A subscribe topic is ready in topic(), more may follow.
+    TOPIC,
+    // A whole packet was decoded, the accessors for type() are valid until
+    // the next call.
+    PACKET,
+    // The stream is corrupt, the connection should be dropped.
+    ERROR,
+  };
+
+  // Consumes bytes from |data| until an event, |*consumed| is set to how many
+  // were used. Remaining bytes should be passed to the next call.
+  Result Consume(const uint8_t* data, size_t size, size_t* consumed) {
+    const uint8_t* position = data;
+    const uint8_t* end = data + size;
+    const auto result = Run(&position, end);
+    *consumed = position - data;
+    return result;
+  }
+
+  PacketType type() const {
+    return static_cast<PacketType>(control_ >> 4);
+  }
+
+  uint8_t type_flags() const {
+    return control_ & 0xF;
+  }
+
+  const proto3::Connect& connect() const { return connect_; }
+
+  // Topic and size of the last publish.
+  const proto3::Publish& publish() const { return publish_; }
+
+  // Payload of the last publish, publish().payload_bytes long. Null if it
+  // could not be allocated, the payload was skipped.
+  Payload TakePayload() { return std::move(payload_); }
+
+  // Where publish payloads are allocated, null for the heap.
+  void set_allocator(PayloadAllocator* allocator) { allocator_ = allocator; }
+
+  // Packet id of the subscribe being decoded.
+  uint16_t packet_id() const { return packet_id_; }
+
+  // The subscribe topic for the last TOPIC event.
+  const StringBuffer<128>& topic() const { return topic_; }
+
+private:
+  enum class State {
+    CONTROL,
+    REMAINING_SIZE,
+    CONNECT_NAME_LENGTH,
+    CONNECT_NAME,
+    CONNECT_LEVEL,
+    CONNECT_FLAGS,
+    CONNECT_KEEP_ALIVE,
+    PUBLISH_TOPIC_LENGTH,
+    PUBLISH_TOPIC,
+    PUBLISH_PACKET_ID,
+    PUBLISH_PAYLOAD,
+    SUBSCRIBE_PACKET_ID,
+    SUBSCRIBE_TOPIC_LENGTH,
+    SUBSCRIBE_TOPIC,
+    SUBSCRIBE_FLAGS,
+    // Throw away the rest of the packet.
+    SKIP,
+  };
+
+  Result Run(const uint8_t** position, const uint8_t* end) {
+    while (true) {
+      if (state_ == State::CONTROL) {
+        if (*position == end) return Result::NEED_MORE;
+        control_ = *(*position)++;
+        remaining_size_ = 0;
+        size_multiplier_ = 1;
+        state_ = State::REMAINING_SIZE;
+        continue;
+      }
+
+      if (state_ == State::REMAINING_SIZE) {
+        if (*position == end) return Result::NEED_MORE;
+        const uint8_t next_byte = *(*position)++;
+        remaining_size_ += (next_byte & 127) * size_multiplier_;
+        size_multiplier_ *= 128;
+        if (next_byte & 128) {
+          // Size is at most 4 bytes.
+          if (size_multiplier_ > 128 * 128 * 128) {
+            LOG("Remaining size too long.\n");
+            return Result::ERROR;
+          }
+          continue;
+        }
+        StartBody();
+        continue;
+      }
+
+      if (remaining_size_ == 0) return FinishBody();
+      if (*position == end) return Result::NEED_MORE;
+
+      // Never read into the next packet.
+      const uint8_t* body_end = *position +
+          std::min<size_t>(end - *position, remaining_size_);
+      const uint8_t* start = *position;
+      const auto result = RunBody(position, body_end);
+      remaining_size_ -= *position - start;
+
+      if (result == Result::ERROR || result == Result::TOPIC) return result;
+    }
+  }
+
+  void StartBody() {
+    field_offset_ = 0;
+    body_size_ = remaining_size_;
+    switch (type()) {
+      case PacketType::CONNECT:
+        connect_ = proto3::Connect();
+        state_ = State::CONNECT_NAME_LENGTH;
+        break;
+      case PacketType::PUBLISH:
+        publish_ = proto3::Publish();
+        payload_.reset();
+        state_ = State::PUBLISH_TOPIC_LENGTH;
+        break;
+      case PacketType::SUBSCRIBE:
+        packet_id_ = 0;
+        state_ = State::SUBSCRIBE_PACKET_ID;
+        break;
+      default:
+        state_ = State::SKIP;
+        break;
+    }
+  }
+
+  Result FinishBody() {
+    // Packets like PINGREQ have no body at all, otherwise we must be between
+    // fields.
+    if (state_ != State::SKIP && state_ != State::SUBSCRIBE_TOPIC_LENGTH &&
+        state_ != State::PUBLISH_PAYLOAD) {
+      LOG("Packet ended mid field.\n");
+      state_ = State::CONTROL;
+      return Result::ERROR;
+    }
+    state_ = State::CONTROL;
+    return Result::PACKET;
+  }
+
+  // Copies bytes of the current field into |out| until |bytes| have been
+  // collected, returns true once the field is complete.
+  bool Fill(uint8_t* out, size_t bytes, const uint8_t** position, const uint8_t* end) {
+    const size_t to_copy = std::min<size_t>(bytes - field_offset_, end - *position);
+    memcpy(out + field_offset_, *position, to_copy);
+    *position += to_copy;
+    field_offset_ += to_copy;
+    if (field_offset_ < bytes) return false;
+    field_offset_ = 0;
+    return true;
+  }
+
+  // Fixed width big endian field through the scratch bytes.
+  template<typename T>
+  bool FillInteger(T* out, const uint8_t** position, const uint8_t* end) {
+    if (!Fill(scratch_, sizeof(T), position, end)) return false;
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); i++) {
+      value = (value << 8) | scratch_[i];
+    }
+    *out = value;
+    return true;
+  }
+
+  template<typename Buffer>
+  bool FillLength(Buffer* buffer, const uint8_t** position, const uint8_t* end,
+                  Result* error) {
+    if (!FillInteger(&buffer->length, position, end)) return false;
+    if (buffer->length > Buffer::kSize) {
+      LOG("String too long for buffer!\n");
+      *error = Result::ERROR;
+    }
+    return true;
+  }
+
+  Result RunBody(const uint8_t** position, const uint8_t* end) {
+    Result error = Result::NEED_MORE;
+    while (*position < end) {
+      switch (state_) {
+        case State::CONNECT_NAME_LENGTH:
+          if (!FillLength(&connect_.protocol_name, position, end, &error)) break;
+          state_ = State::CONNECT_NAME;
+          break;
+        case State::CONNECT_NAME:
+          if (!Fill((uint8_t*)connect_.protocol_name.data, connect_.protocol_name.length,
+                    position, end)) break;
+          state_ = State::CONNECT_LEVEL;
+          break;
+        case State::CONNECT_LEVEL:
+          connect_.protocol_level = *(*position)++;
+          state_ = State::CONNECT_FLAGS;
+          break;
+        case State::CONNECT_FLAGS:
+          connect_.flags = *(*position)++;
+          state_ = State::CONNECT_KEEP_ALIVE;
+          break;
+        case State::CONNECT_KEEP_ALIVE:
+          if (!FillInteger(&connect_.keep_alive, position, end)) break;
+          // The client id and the rest are not used.
+          state_ = State::SKIP;
+          break;
+        case State::PUBLISH_TOPIC_LENGTH:
+          if (!FillLength(&publish_.topic, position, end, &error)) break;
+          state_ = State::PUBLISH_TOPIC;
+          break;
+        case State::PUBLISH_TOPIC:
+          if (!Fill((uint8_t*)publish_.topic.data, publish_.topic.length, position, end)) break;
+          if (((type_flags() >> 1) & 0b11) != 0) {
+            state_ = State::PUBLISH_PACKET_ID;
+          } else {
+            StartPayload();
+          }
+          break;
+        case State::PUBLISH_PACKET_ID: {
+          // We currently don't support QoS and ignore this.
+          uint16_t id = 0;
+          if (!FillInteger(&id, position, end)) break;
+          StartPayload();
+          break;
+        }
+        case State::PUBLISH_PAYLOAD:
+          Fill(payload_.get(), publish_.payload_bytes, position, end);
+          break;
+        case State::SUBSCRIBE_PACKET_ID:
+          if (!FillInteger(&packet_id_, position, end)) break;
+          state_ = State::SUBSCRIBE_TOPIC_LENGTH;
+          break;
+        case State::SUBSCRIBE_TOPIC_LENGTH:
+          if (!FillLength(&topic_, position, end, &error)) break;
+          state_ = State::SUBSCRIBE_TOPIC;
+          break;
+        case State::SUBSCRIBE_TOPIC:
+          if (!Fill((uint8_t*)topic_.data, topic_.length, position, end)) break;
+          state_ = State::SUBSCRIBE_FLAGS;
+          break;
+        case State::SUBSCRIBE_FLAGS:
+          // These are reserved in MQTT 3.1.1, ignore it.
+          (*position)++;
+          state_ = State::SUBSCRIBE_TOPIC_LENGTH;
+          return Result::TOPIC;
+        case State::SKIP:
+          *position = end;
+          break;
+        default:
+          return Result::ERROR;
+      }
+      if (error == Result::ERROR) return error;
+    }
+    return Result::NEED_MORE;
+  }
+
+  void StartPayload() {
+    // Everything after the topic and packet id.
+    const uint32_t header_bytes = 2 + publish_.topic.length +
+        ((((type_flags() >> 1) & 0b11) != 0) ? 2 : 0);
+    if (header_bytes > body_size_) {
+      publish_.payload_bytes = 0;
+    } else {
+      publish_.payload_bytes = body_size_ - header_bytes;
+    }
+    payload_ = AllocatePayload(allocator_, publish_.payload_bytes);
+    state_ = payload_ ? State::PUBLISH_PAYLOAD : State::SKIP;
+  }
+
+  State state_ = State::CONTROL;
+  uint8_t control_ = 0;
+  uint32_t remaining_size_ = 0;
+  uint32_t body_size_ = 0;
+  uint32_t size_multiplier_ = 1;
+  uint32_t field_offset_ = 0;
+  uint8_t scratch_[2] = {0};
+
+  proto3::Connect connect_;
+  proto3::Publish publish_;
+  PayloadAllocator* allocator_ = nullptr;
+  Payload payload_;
+  uint16_t packet_id_ = 0;
+  StringBuffer<128> topic_;
+};
+
+}  // namespace gnat
@@ -0,0 +1,179 @@
+#pragma once
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "topic.h"
+
+namespace gnat {
+
+// Subscriptions indexed by topic filter, a trie with one node per filter
+// level. Matching a topic walks only the branches that can match it: the
+// literal child for each level plus any '+' child, collecting '#' along the
+// way. So publish cost grows with the depth of the topic and the number of
+// matches rather than with the number of subscriptions.
+template<typename Value>
+class SubscriptionIndex {
+public:
+  // Adds |value| under |filter|, which must be a valid filter.
+  void Insert(const char* filter, size_t length, Value value) {
+    Node* node = &root_;
+    size_t position = 0;
+    while (true) {
+      const size_t level = topic::LevelLength(filter + position, length - position);
+      const char* start = filter + position;
+      if (level == 1 && *start == '#') {
+        node->multi.emplace_back(std::move(value));
+        break;
+      }
+
+      std::unique_ptr<Node>* child = nullptr;
+      if (level == 1 && *start == '+') {
+        child = &node->single;
+      } else {
+        child = &node->children[std::string(start, level)];
+      }
+      if (!*child) child->reset(new Node());
+      node = child->get();
+
+      position += level + 1;
+      if (position > length) {
+        node->exact.emplace_back(std::move(value));
+        break;
+      }
+    }
+    size_++;
+  }
+
+  // Removes every value |predicate(const Value&)| returns true for.
+  template<typename Predicate>
+  void RemoveIf(Predicate&& predicate) {
+    RemoveIf(&root_, predicate);
+  }
+
+  // Calls |visit(Value&)| for every value with a filter matching |topic|.
+  template<typename Visit>
+  void Match(const char* topic, size_t length, Visit&& visit) {
+    // The root's '#' and '+' are wildcard first levels.
+    Match(&root_, topic, length, visit, !topic::IsSystemTopic(topic, length));
+  }
+
+  // Same as Match, for callers that have the key of |topic| too.
+  template<typename Key, typename Visit>
+  void Match(const Key&, const char* topic, size_t length, Visit&& visit) {
+    Match(topic, length, visit);
+  }
+
+  // Calls |visit(Value&)| for every value.
+  template<typename Visit>
+  void ForEach(Visit&& visit) {
+    ForEach(&root_, visit);
+  }
+
+  size_t size() const { return size_; }
+
+private:
+  struct Node {
+    std::unordered_map<std::string, std::unique_ptr<Node>> children;
+    // The '+' child.
+    std::unique_ptr<Node> single;
+    // Filters ending at this level.
+    std::vector<Value> exact;
+    // Filters ending with '#' after this level.
+    std::vector<Value> multi;
+
+    bool empty() const {
+      return children.empty() && !single && exact.empty() && multi.empty();
+    }
+  };
+
+  // |wildcards| is false to skip |node|'s '#' and '+' filters.
+  template<typename Visit>
+  void Match(Node* node, const char* topic, size_t length, Visit& visit,
+             bool wildcards = true) {
+    if (wildcards) {
+      for (auto& value : node->multi) visit(value);
+    }
+
+    const size_t level = topic::LevelLength(topic, length);
+    if (!node->children.empty()) {
+      // Reused so lookups don't allocate once it has grown.
+      level_.assign(topic, level);
+      const auto child = node->children.find(level_);
+      if (child != node->children.end()) {
+        MatchChild(child->second.get(), topic, length, level, visit);
+      }
+    }
+    if (wildcards && node->single) {
+      MatchChild(node->single.get(), topic, length, level, visit);
+    }
+  }
+
+  // |node| matched the first |level| bytes of |topic|.
+  template<typename Visit>
+  void MatchChild(Node* node, const char* topic, size_t length, size_t level, Visit& visit) {
+    if (level == length) {
+      for (auto& value : node->exact) visit(value);
+      // "a/#" matches "a" as well.
+      for (auto& value : node->multi) visit(value);
+    } else {
+      Match(node, topic + level + 1, length - level - 1, visit);
+    }
+  }
+
+  template<typename Predicate>
+  void RemoveIf(Node* node, Predicate& predicate) {
+    RemoveFrom(&node->exact, predicate);
+    RemoveFrom(&node->multi, predicate);
+
+    for (auto child = node->children.begin(); child != node->children.end();) {
+      RemoveIf(child->second.get(), predicate);
+      if (child->second->empty()) {
+        child = node->children.erase(child);
+      } else {
+        ++child;
+      }
+    }
+
+    if (node->single) {
+      RemoveIf(node->single.get(), predicate);
+      if (node->single->empty()) node->single.reset();
+    }
+  }
+
+  template<typename Predicate>
+  void RemoveFrom(std::vector<Value>* values, Predicate& predicate) {
+    for (auto value = values->begin(); value != values->end();) {
+      if (predicate(static_cast<const Value&>(*value))) {
+        value = values->erase(value);
+        size_--;
+      } else {
+        ++value;
+      }
+    }
+  }
+
+  template<typename Visit>
+  void ForEach(Node* node, Visit& visit) {
+    for (auto& value : node->exact) visit(value);
+    for (auto& value : node->multi) visit(value);
+    for (auto& child : node->children) ForEach(child.second.get(), visit);
+    if (node->single) ForEach(node->single.get(), visit);
+  }
+
+  Node root_;
+  size_t size_ = 0;
+  std::string level_;
+};
+
+// DataStore Subscriptions policy for SubscriptionIndex, the default for
+// every key type.
+struct TrieSubscriptions {
+  template<typename Value>
+  using Index = SubscriptionIndex<Value>;
+};
+
+}  // namespace gnat
@@ -0,0 +1,134 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "topic_scan.h"
+
+namespace gnat {
+
+// MQTT topic names and filters. Topics are split into levels by '/', filters
+// may use '+' for exactly one level and '#' as the last level for any number
+// of levels, including none.
+namespace topic {
+
+// FNV-1a, stable across runs and builds unlike std::hash.
+inline uint32_t Hash(const char* topic, size_t length) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < length; i++) {
+    hash = (hash ^ (uint8_t)topic[i]) * 16777619u;
+  }
+  return hash;
+}
+
+// Length of the level starting at |topic|, up to the next '/' or the end.
+inline size_t LevelLength(const char* topic, size_t length) {
+  const void* separator = memchr(topic, '/', length);
+  return separator ? static_cast<const char*>(separator) - topic : length;
+}
+
+// Wildcards must take up a whole level and '#' must be the last one. Like
+// names, filters must be UTF-8.
+inline bool IsValidFilter(const char* filter, size_t length) {
+  if (length == 0) return false;
+  const ScanResult scan = Scan(filter, length);
+  return scan.valid_utf8 && scan.valid_wildcards;
+}
+
+// Names are what is published to, they can't have wildcards.
+inline bool IsValidName(const char* name, size_t length) {
+  if (length == 0) return false;
+  const ScanResult scan = Scan(name, length);
+  return scan.valid_utf8 && !scan.has_plus && !scan.has_hash;
+}
+
+inline bool HasWildcard(const char* filter, size_t length) {
+  return memchr(filter, '+', length) != nullptr || memchr(filter, '#', length) != nullptr;
+}
+
+// Copies the valid filter |filter| to |out| for keys that keep only the first
+// |max| bytes of a topic. Literal filters and '#' filters with a prefix past
+// |max| bytes are cut to match the cut key exactly, as if they were encoded
+// as a key. False for a filter with a '+' whose levels, before any "/#", are
+// longer than |max|, those after the cut can't be matched.
+inline bool CutFilter(const char* filter, size_t length, size_t max, char* out,
+                      size_t* out_length) {
+  const bool is_prefix = filter[length - 1] == '#';
+  if (memchr(filter, '+', length) != nullptr) {
+    if ((is_prefix ? length - 2 : length) > max) return false;
+  } else if (!is_prefix || length - 1 > max) {
+    length = length < max ? length : max;
+  }
+  memcpy(out, filter, length);
+  *out_length = length;
+  return true;
+}
+
+// Length of the start of the valid filter |filter| that every topic it
+// matches starts with, the whole filter if it has no wildcards. A trailing
+// "/#" isn't included since "a/#" also matches "a".
+inline size_t LiteralPrefixLength(const char* filter, size_t length) {
+  size_t position = 0;
+  while (position < length && filter[position] != '+' && filter[position] != '#') {
+    position++;
+  }
+  if (position < length && filter[position] == '#' && position > 0) {
+    position--;  // The '/' before it.
+  }
+  return position;
+}
+
+// Whether |topic| is one of the server's, like "$SYS/uptime". A wildcard
+// first level of a filter doesn't match these, MQTT 3.1.1 section 4.7.2.
+inline bool IsSystemTopic(const char* topic, size_t length) {
+  return length > 0 && topic[0] == '$';
+}
+
+// Whether the valid filter |filter| has a wildcard first level, so doesn't
+// match system topics.
+inline bool StartsWithWildcard(const char* filter, size_t length) {
+  return length > 0 && (filter[0] == '#' || filter[0] == '+');
+}
+
+// Whether |topic| matches the valid filter |filter|.
+inline bool MatchesFilter(const char* filter, size_t filter_length,
+                          const char* topic, size_t topic_length) {
+  if (IsSystemTopic(topic, topic_length) && StartsWithWildcard(filter, filter_length)) {
+    return false;
+  }
+  size_t filter_position = 0;
+  size_t topic_position = 0;
+  while (true) {
+    const char* filter_level = filter + filter_position;
+    const size_t filter_level_length =
+        LevelLength(filter_level, filter_length - filter_position);
+
+    // Matches this level and everything below, "a/#" also matches "a".
+    if (filter_level_length == 1 && *filter_level == '#') return true;
+
+    const char* topic_level = topic + topic_position;
+    const size_t topic_level_length =
+        LevelLength(topic_level, topic_length - topic_position);
+
+    if (!(filter_level_length == 1 && *filter_level == '+') &&
+        (filter_level_length != topic_level_length ||
+         memcmp(filter_level, topic_level, topic_level_length) != 0)) {
+      return false;
+    }
+
+    filter_position += filter_level_length + 1;
+    topic_position += topic_level_length + 1;
+    if (filter_position > filter_length) {
+      // Filter is done, so must the topic be.
+      return topic_position > topic_length;
+    }
+    if (topic_position > topic_length) {
+      // Topic is done, only a trailing "/#" can still match.
+      return filter_length - filter_position == 1 && filter[filter_position] == '#';
+    }
+  }
+}
+
+}  // namespace topic
+}  // namespace gnat
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+#include "flat_hash_map.h"
+
+namespace gnat {
+
+// A whole topic interned by a TopicDictionary. Ids are dense, from 0 in the
+// order topics were first seen.
+struct TopicId {
+  uint32_t value = 0;
+
+  bool operator==(const TopicId& other) const { return value == other.value; }
+  bool operator!=(const TopicId& other) const { return value != other.value; }
+  bool operator<(const TopicId& other) const { return value < other.value; }
+};
+
+}  // namespace gnat
+
+template<>
+struct std::hash<gnat::TopicId> {
+  size_t operator()(const gnat::TopicId& id) const { return id.value; }
+};
+
+namespace gnat {
+
+// Interns topics to TopicIds, so a topic is hashed as a string once when it
+// is first published or subscribed to and routed as an integer after. Names
+// are packed into blocks that never move, looking a name up by id is an
+// index into an array.
+//
+// Safe to use from many threads, Global() is shared by every DataStore and
+// ShardedDataStore shard. Intern and Find take a reader lock, and Intern a
+// writer one for a topic not seen before. Topic takes no lock, the names are
+// in chunks that are never moved or freed, so an id handed over from another
+// thread can always be read.
+//
+// Topics are never forgotten, memory grows with the number of distinct
+// topics seen, including ones whose keys were since evicted.
+class TopicDictionary {
+public:
+  static constexpr size_t kBlockSize = 4096;
+  // Names for the first this many ids, each chunk after is twice as large.
+  static constexpr size_t kFirstChunk = 256;
+
+  // Used by KeyTraits<TopicId>, which can't carry one of its own.
+  static TopicDictionary& Global() {
+    static TopicDictionary dictionary;
+    return dictionary;
+  }
+
+  TopicDictionary() = default;
+  TopicDictionary(const TopicDictionary&) = delete;
+  TopicDictionary& operator=(const TopicDictionary&) = delete;
+
+  ~TopicDictionary() {
+    for (auto& chunk : chunks_) delete[] chunk.load(std::memory_order_relaxed);
+  }
+
+  TopicId Intern(const char* topic, size_t length) {
+    const std::string_view name(topic, length);
+    {
+      std::shared_lock<std::shared_mutex> lock(mutex_);
+      const auto found = ids_.find(name);
+      if (found != ids_.end()) return found->second;
+    }
+
+    std::lock_guard<std::shared_mutex> lock(mutex_);
+    // Another thread may have added it in between.
+    const auto found = ids_.find(name);
+    if (found != ids_.end()) return found->second;
+
+    const uint32_t next = size_.load(std::memory_order_relaxed);
+    const TopicId id{next};
+    size_t chunk, offset;
+    Locate(id, &chunk, &offset);
+    Name* names = chunks_[chunk].load(std::memory_order_relaxed);
+    if (names == nullptr) {
+      names = new Name[kFirstChunk << chunk];
+      chunks_[chunk].store(names, std::memory_order_release);
+    }
+    const char* stored = Store(topic, length);
+    names[offset] = {stored, static_cast<uint32_t>(length)};
+    ids_.emplace(std::string_view(stored, length), id);
+    size_.store(next + 1, std::memory_order_release);
+    return id;
+  }
+
+  // Like Intern but false if |topic| hasn't been seen, adding nothing.
+  bool Find(const char* topic, size_t length, TopicId* id) const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    const auto found = ids_.find(std::string_view(topic, length));
+    if (found == ids_.end()) return false;
+    *id = found->second;
+    return true;
+  }
+
+  // Name of |id|, which must have come from this dictionary. Not null
+  // terminated.
+  const char* Topic(TopicId id, size_t* length) const {
+    size_t chunk, offset;
+    Locate(id, &chunk, &offset);
+    const Name& name = chunks_[chunk].load(std::memory_order_acquire)[offset];
+    *length = name.length;
+    return name.data;
+  }
+
+  size_t size() const { return size_.load(std::memory_order_acquire); }
+
+private:
+  struct Name {
+    const char* data;
+    uint32_t length;
+  };
+
+  // Chunk k holds kFirstChunk << k names, enough chunks for every uint32_t.
+  static constexpr size_t kChunks = 32 - 8 + 1;
+  static_assert(kFirstChunk == 1 << 8, "kChunks is for 256 names in the first chunk.");
+
+  static void Locate(TopicId id, size_t* chunk, size_t* offset) {
+    // Chunk k starts at id kFirstChunk * (2^k - 1).
+    const uint64_t slot = static_cast<uint64_t>(id.value) / kFirstChunk + 1;
+    *chunk = 63 - __builtin_clzll(slot);
+    *offset = id.value - kFirstChunk * ((size_t{1} << *chunk) - 1);
+  }
+
+  const char* Store(const char* topic, size_t length) {
+    char* stored;
+    if (length > kBlockSize) {
+      // A block of its own so the current one isn't wasted.
+      blocks_.emplace_back(new char[length]);
+      stored = blocks_.back().get();
+    } else {
+      if (current_ == nullptr || length > kBlockSize - block_used_) {
+        blocks_.emplace_back(new char[kBlockSize]);
+        current_ = blocks_.back().get();
+        block_used_ = 0;
+      }
+      stored = current_ + block_used_;
+      block_used_ += length;
+    }
+    memcpy(stored, topic, length);
+    return stored;
+  }
+
+  mutable std::shared_mutex mutex_;
+  std::atomic<Name*> chunks_[kChunks] = {};
+  std::atomic<uint32_t> size_{0};
+  std::vector<std::unique_ptr<char[]>> blocks_;
+  char* current_ = nullptr;
+  size_t block_used_ = 0;
+  FlatHashMap<std::string_view, TopicId> ids_;
+};
+
+}  // namespace gnat
@@ -0,0 +1,103 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "topic.h"
+
+namespace gnat {
+namespace topic {
+
+// A valid filter taken apart so matching many topics against it, as
+// DataStore::AddObserver does replaying stored values, doesn't parse it for
+// each. Literal filters compare the whole topic, '#' filters without a '+'
+// are a prefix, anything with a '+' a list of the levels to compare, skipping
+// the '+' ones.
+//
+// Points into |filter| rather than copying it, it must outlive this.
+class CompiledFilter {
+public:
+  enum class Kind {
+    kExact,
+    kPrefix,
+    kLevels,
+  };
+
+  CompiledFilter(const char* filter, size_t length)
+      : filter_(filter), wildcard_first_(topic::StartsWithWildcard(filter, length)) {
+    const bool is_prefix = length > 0 && filter[length - 1] == '#';
+    if (memchr(filter, '+', length) == nullptr) {
+      kind_ = is_prefix ? Kind::kPrefix : Kind::kExact;
+      // "a/#" is every topic under "a/", and "a" itself.
+      literal_length_ = is_prefix ? length - 1 : length;
+      return;
+    }
+
+    kind_ = Kind::kLevels;
+    trailing_hash_ = is_prefix;
+    const size_t levels_length = is_prefix ? (length > 1 ? length - 2 : 0) : length;
+    size_t position = 0;
+    while (position <= levels_length) {
+      const size_t level = LevelLength(filter + position, levels_length - position);
+      const bool plus = level == 1 && filter[position] == '+';
+      levels_.push_back({static_cast<uint16_t>(position), static_cast<uint16_t>(level), plus});
+      position += level + 1;
+    }
+  }
+
+  Kind kind() const { return kind_; }
+
+  // Whether |topic| matches, same as MatchesFilter on the filter.
+  bool Matches(const char* topic, size_t length) const {
+    if (wildcard_first_ && topic::IsSystemTopic(topic, length)) return false;
+    switch (kind_) {
+      case Kind::kExact:
+        return length == literal_length_ && memcmp(topic, filter_, length) == 0;
+      case Kind::kPrefix:
+        if (length >= literal_length_) {
+          return memcmp(topic, filter_, literal_length_) == 0;
+        }
+        // The "a" of "a/#".
+        return literal_length_ > 0 && length == literal_length_ - 1 &&
+               memcmp(topic, filter_, length) == 0;
+      case Kind::kLevels:
+        return MatchesLevels(topic, length);
+    }
+    return false;
+  }
+
+private:
+  struct Level {
+    uint16_t offset;
+    uint16_t length;
+    bool plus;
+  };
+
+  bool MatchesLevels(const char* topic, size_t length) const {
+    // Start of the topic's next level, past the end once it has none.
+    size_t position = 0;
+    for (const Level& level : levels_) {
+      if (position > length) return false;
+      const size_t topic_level = LevelLength(topic + position, length - position);
+      if (!level.plus && (topic_level != level.length ||
+                          memcmp(topic + position, filter_ + level.offset, topic_level) != 0)) {
+        return false;
+      }
+      position += topic_level + 1;
+    }
+    // A trailing '#' matches whatever is left, including nothing.
+    return trailing_hash_ || position == length + 1;
+  }
+
+  const char* filter_;
+  bool wildcard_first_;
+  Kind kind_ = Kind::kExact;
+  size_t literal_length_ = 0;
+  bool trailing_hash_ = false;
+  std::vector<Level> levels_;
+};
+
+}  // namespace topic
+}  // namespace gnat
@@ -0,0 +1,210 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+namespace gnat {
+namespace topic {
+
+// What one pass over a topic name or filter found.
+struct ScanResult {
+  // UTF-8 without U+0000, as MQTT requires of both.
+  bool valid_utf8 = true;
+  // Every '+' and '#' takes up a whole level and '#' is the last one.
+  bool valid_wildcards = true;
+  bool has_plus = false;
+  bool has_hash = false;
+};
+
+namespace scan {
+
+constexpr size_t kBlockSize = 16;
+
+// Bit i of each mask is byte i of a block. Bytes past the end of the topic
+// are zero and their bits are clear, except in zero.
+struct BlockMasks {
+  uint32_t slash = 0;
+  uint32_t plus = 0;
+  uint32_t hash = 0;
+  uint32_t non_ascii = 0;
+  uint32_t zero = 0;
+};
+
+// Blocks have a static BlockMasks Load(const char* block, size_t bytes) for
+// the |bytes| <= kBlockSize at |block|.
+
+// A byte at a time, for targets without SSE2 or NEON.
+struct ScalarBlocks {
+  static BlockMasks Load(const char* block, size_t bytes) {
+    BlockMasks masks;
+    for (size_t i = 0; i < bytes; i++) {
+      const uint32_t bit = 1u << i;
+      const uint8_t byte = block[i];
+      if (byte == '/') masks.slash |= bit;
+      if (byte == '+') masks.plus |= bit;
+      if (byte == '#') masks.hash |= bit;
+      if (byte & 0x80) masks.non_ascii |= bit;
+      if (byte == 0) masks.zero |= bit;
+    }
+    return masks;
+  }
+};
+
+// A short block is copied into a zeroed buffer before the load so nothing
+// past the topic is read.
+#if defined(__SSE2__)
+struct VectorBlocks {
+  static BlockMasks Load(const char* block, size_t bytes) {
+    __m128i bytes_in;
+    if (bytes == kBlockSize) {
+      bytes_in = _mm_loadu_si128(reinterpret_cast<const __m128i*>(block));
+    } else {
+      alignas(16) char padded[kBlockSize] = {};
+      memcpy(padded, block, bytes);
+      bytes_in = _mm_load_si128(reinterpret_cast<const __m128i*>(padded));
+    }
+    const auto equal = [bytes_in](char c) {
+      return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes_in, _mm_set1_epi8(c)));
+    };
+    BlockMasks masks;
+    masks.slash = equal('/');
+    masks.plus = equal('+');
+    masks.hash = equal('#');
+    masks.non_ascii = (uint32_t)_mm_movemask_epi8(bytes_in);
+    masks.zero = equal('\0');
+    return masks;
+  }
+};
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+struct VectorBlocks {
+  static BlockMasks Load(const char* block, size_t bytes) {
+    uint8x16_t bytes_in;
+    if (bytes == kBlockSize) {
+      bytes_in = vld1q_u8(reinterpret_cast<const uint8_t*>(block));
+    } else {
+      uint8_t padded[kBlockSize] = {};
+      memcpy(padded, block, bytes);
+      bytes_in = vld1q_u8(padded);
+    }
+    const auto equal = [bytes_in](char c) {
+      return Movemask(vceqq_u8(bytes_in, vdupq_n_u8((uint8_t)c)));
+    };
+    BlockMasks masks;
+    masks.slash = equal('/');
+    masks.plus = equal('+');
+    masks.hash = equal('#');
+    masks.non_ascii = Movemask(vcgeq_u8(bytes_in, vdupq_n_u8(0x80)));
+    masks.zero = equal('\0');
+    return masks;
+  }
+
+  // NEON has no movemask, weigh each lane by its bit and add up each half.
+  static uint32_t Movemask(uint8x16_t lanes) {
+    static const uint8_t kBits[kBlockSize] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                              1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t weighed = vandq_u8(lanes, vld1q_u8(kBits));
+    return vaddv_u8(vget_low_u8(weighed)) | (vaddv_u8(vget_high_u8(weighed)) << 8);
+  }
+};
+#else
+using VectorBlocks = ScalarBlocks;
+#endif
+
+// Whether |text| is UTF-8 without overlong forms, surrogates or code points
+// past U+10FFFF.
+inline bool IsValidUtf8(const char* text, size_t length) {
+  const uint8_t* bytes = reinterpret_cast<const uint8_t*>(text);
+  size_t i = 0;
+  while (i < length) {
+    const uint8_t lead = bytes[i];
+    if (lead < 0x80) {
+      i++;
+      continue;
+    }
+    size_t continuation;
+    uint8_t min = 0x80;
+    uint8_t max = 0xbf;
+    if (lead >= 0xc2 && lead <= 0xdf) {
+      continuation = 1;
+    } else if (lead >= 0xe0 && lead <= 0xef) {
+      continuation = 2;
+      if (lead == 0xe0) min = 0xa0;  // Overlong.
+      if (lead == 0xed) max = 0x9f;  // Surrogates.
+    } else if (lead >= 0xf0 && lead <= 0xf4) {
+      continuation = 3;
+      if (lead == 0xf0) min = 0x90;  // Overlong.
+      if (lead == 0xf4) max = 0x8f;  // Past U+10FFFF.
+    } else {
+      return false;
+    }
+    if (length - i <= continuation) return false;
+    // Only the first continuation byte has the narrower range.
+    if (bytes[i + 1] < min || bytes[i + 1] > max) return false;
+    for (size_t c = 2; c <= continuation; c++) {
+      if ((bytes[i + c] & 0xc0) != 0x80) return false;
+    }
+    i += continuation + 1;
+  }
+  return true;
+}
+
+// Scan with the masks from |Blocks|, see topic::Scan.
+template<typename Blocks>
+ScanResult ScanWith(const char* topic, size_t length) {
+  ScanResult result;
+  // Where the first block with a non ASCII byte starts, the blocks before
+  // are all single byte characters.
+  size_t utf8_from = length;
+  // Whether the byte before this block was a '/', the start counts as one,
+  // and whether it was a wildcard.
+  uint32_t slash_before = 1;
+  uint32_t wildcard_before = 0;
+  for (size_t offset = 0; offset < length; offset += kBlockSize) {
+    const size_t bytes = length - offset < kBlockSize ? length - offset : kBlockSize;
+    const uint32_t valid = (1u << bytes) - 1;
+    const BlockMasks masks = Blocks::Load(topic + offset, bytes);
+    const uint32_t wildcards = masks.plus | masks.hash;
+
+    if (masks.zero & valid) result.valid_utf8 = false;
+    if (masks.non_ascii && utf8_from == length) utf8_from = offset;
+
+    // A wildcard must follow a '/' and be followed by one.
+    const uint32_t after_slash = (masks.slash << 1) | slash_before;
+    const uint32_t after_wildcard = ((wildcards << 1) | wildcard_before) & valid;
+    if ((wildcards & ~after_slash) || (after_wildcard & ~masks.slash)) {
+      result.valid_wildcards = false;
+    }
+    // And a '#' can only be the last byte.
+    if (masks.hash && (offset + bytes != length || masks.hash != 1u << (bytes - 1))) {
+      result.valid_wildcards = false;
+    }
+    result.has_plus |= masks.plus != 0;
+    result.has_hash |= masks.hash != 0;
+
+    slash_before = (masks.slash >> (kBlockSize - 1)) & 1;
+    wildcard_before = (wildcards >> (kBlockSize - 1)) & 1;
+  }
+  if (result.valid_utf8 && utf8_from != length) {
+    result.valid_utf8 = IsValidUtf8(topic + utf8_from, length - utf8_from);
+  }
+  return result;
+}
+
+}  // namespace scan
+
+// Finds the separators and wildcards in |topic| and checks its encoding in
+// one pass, a block of 16 bytes at a time with SSE2 or NEON when built for
+// them.
+inline ScanResult Scan(const char* topic, size_t length) {
+  return scan::ScanWith<scan::VectorBlocks>(topic, length);
+}
+
+}  // namespace topic
+}  // namespace gnat
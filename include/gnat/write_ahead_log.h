@@ -0,0 +1,233 @@
+// Append only log of DataStore changes, for durability between snapshots.
+//
+// Each record is a LogRecord followed by the topic then the payload, native
+// endian and unaligned. The checksum covers the rest of the record so a write
+// torn by a crash is found, recovery stops at the first bad record.
+
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include "change_log.h"
+
+namespace gnat {
+
+struct LogRecord {
+  uint32_t checksum;
+  uint32_t length;
+  uint32_t timestamp;
+  uint16_t topic_length;
+  uint16_t reserved;
+};
+
+// Encodes and decodes the records above.
+class LogFormat {
+public:
+  // |topic_length| must fit in 16 bits, as MQTT topics do.
+  static void Encode(const char* topic, uint16_t topic_length, const uint8_t* data,
+                     uint32_t length, uint32_t timestamp, std::vector<uint8_t>* out) {
+    LogRecord record;
+    memset(&record, 0, sizeof(record));
+    record.length = length;
+    record.timestamp = timestamp;
+    record.topic_length = topic_length;
+    record.checksum = Checksum(record, topic, data);
+
+    const size_t start = out->size();
+    out->resize(start + sizeof(record) + topic_length + length);
+    uint8_t* next = out->data() + start;
+    memcpy(next, &record, sizeof(record));
+    memcpy(next + sizeof(record), topic, topic_length);
+    memcpy(next + sizeof(record) + topic_length, data, length);
+  }
+
+  // Calls |visit(const char* topic, size_t topic_length, const uint8_t* data,
+  // uint32_t length, uint32_t timestamp)| for each good record in order.
+  // Returns the bytes of good records, everything after is torn or corrupt.
+  template<typename Visit>
+  static size_t Decode(const uint8_t* log, size_t size, Visit&& visit) {
+    size_t offset = 0;
+    while (size - offset >= sizeof(LogRecord)) {
+      LogRecord record;
+      memcpy(&record, log + offset, sizeof(record));
+      const size_t body = offset + sizeof(record);
+      if (size - body < (size_t)record.topic_length + record.length) break;
+      const char* topic = reinterpret_cast<const char*>(log + body);
+      const uint8_t* data = log + body + record.topic_length;
+      if (record.checksum != Checksum(record, topic, data)) break;
+
+      visit(topic, record.topic_length, data, record.length, record.timestamp);
+      offset = body + record.topic_length + record.length;
+    }
+    return offset;
+  }
+
+private:
+  // FNV-1a over everything but the checksum itself.
+  static uint32_t Checksum(const LogRecord& record, const char* topic, const uint8_t* data) {
+    uint32_t hash = 2166136261u;
+    const auto add = [&hash](const uint8_t* bytes, size_t size) {
+      for (size_t i = 0; i < size; i++) hash = (hash ^ bytes[i]) * 16777619u;
+    };
+    const auto* header = reinterpret_cast<const uint8_t*>(&record);
+    add(header + sizeof(record.checksum), sizeof(record) - sizeof(record.checksum));
+    add(reinterpret_cast<const uint8_t*>(topic), record.topic_length);
+    add(data, record.length);
+    return hash;
+  }
+};
+
+}  // namespace gnat
+
+#if !defined(ARDUINO) && __has_include(<unistd.h>)
+
+#include <cerrno>
+#include <chrono>
+#include <fcntl.h>
+#include <memory>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "snapshot_file.h"
+
+namespace gnat {
+
+// ChangeLog in a file with group commit: Append only buffers records, Poll
+// writes them with one fsync once |sync_bytes| are waiting or |sync_interval|
+// has passed since the last one, so publishing never waits on the disk. A
+// crash loses at most that window, plus whatever waits for the next Poll.
+//
+// Typical use at startup, after any warm start snapshot is set:
+//   auto log = FileLog::Open("broker.log", &store);  // Replays into store.
+//   store.set_log(log.get());
+// and from the server loop log->Poll(), now and then log->Compact().
+class FileLog : public ChangeLog {
+public:
+  struct Options {
+    std::chrono::milliseconds sync_interval{100};
+    size_t sync_bytes = 64 * 1024;
+  };
+
+  // Opens or creates the log at |path|, first setting everything in it into
+  // |store| which must not have this log set yet. A torn tail is cut off.
+  // Null if the file can't be opened.
+  template<typename DataStore>
+  static std::unique_ptr<FileLog> Open(const char* path, DataStore* store,
+                                       Options options = Options()) {
+    const int fd = open(path, O_RDWR | O_CREAT | O_APPEND, 0644);
+    if (fd < 0) return nullptr;
+    std::unique_ptr<FileLog> log(new FileLog(fd, path, options));
+    if (!log->Recover(store)) return nullptr;
+    return log;
+  }
+
+  ~FileLog() override {
+    Sync();
+    close(fd_);
+  }
+
+  FileLog(const FileLog&) = delete;
+  FileLog& operator=(const FileLog&) = delete;
+
+  void Append(const char* topic, size_t topic_length, const uint8_t* data,
+              uint32_t length, uint32_t timestamp) override {
+    LogFormat::Encode(topic, topic_length, data, length, timestamp, &pending_);
+  }
+
+  // Syncs if a full batch is waiting or records have waited longer than the
+  // interval. Call this from the server loop, between publishes, records are
+  // only written from here or Sync.
+  void Poll() {
+    if (pending_.empty()) return;
+    if (pending_.size() >= options_.sync_bytes ||
+        Clock::now() - last_sync_ >= options_.sync_interval) {
+      Sync();
+    }
+  }
+
+  // Writes and fsyncs everything pending. Returns false on an I/O error, the
+  // records are kept to try again.
+  bool Sync() {
+    last_sync_ = Clock::now();
+    if (pending_.empty()) return true;
+    size_t written = 0;
+    while (written < pending_.size()) {
+      const auto result = write(fd_, pending_.data() + written, pending_.size() - written);
+      if (result < 0) {
+        if (errno == EINTR) continue;
+        // Drop what made it out so it isn't written twice.
+        pending_.erase(pending_.begin(), pending_.begin() + written);
+        return false;
+      }
+      written += result;
+    }
+    pending_.clear();
+    syncs_++;
+    return fsync(fd_) == 0;
+  }
+
+  // Saves |store| as a snapshot at |snapshot_path| and empties the log, whose
+  // records are all in it. A crash in between replays the log over the new
+  // snapshot which ends up the same.
+  template<typename DataStore>
+  bool Compact(const char* snapshot_path, DataStore* store) {
+    if (!Sync() || !MappedSnapshot::Save(snapshot_path, store)) return false;
+    return ftruncate(fd_, 0) == 0 && fsync(fd_) == 0;
+  }
+
+  // Bytes not yet written.
+  size_t pending_bytes() const { return pending_.size(); }
+
+  // Times records were written and synced, for checking batching.
+  uint32_t syncs() const { return syncs_; }
+
+private:
+  using Clock = std::chrono::steady_clock;
+
+  FileLog(int fd, const char* path, Options options)
+      : fd_(fd), path_(path), options_(options), last_sync_(Clock::now()) {}
+
+  template<typename DataStore>
+  bool Recover(DataStore* store) {
+    struct stat info;
+    if (fstat(fd_, &info) != 0) return false;
+    std::vector<uint8_t> log(info.st_size);
+    size_t read_bytes = 0;
+    while (read_bytes < log.size()) {
+      const auto result = pread(fd_, log.data() + read_bytes, log.size() - read_bytes,
+                                read_bytes);
+      if (result < 0 && errno == EINTR) continue;
+      if (result <= 0) return false;
+      read_bytes += result;
+    }
+
+    const size_t good = LogFormat::Decode(log.data(), log.size(),
+        [store](const char* topic, size_t topic_length, const uint8_t* data,
+                uint32_t length, uint32_t timestamp) {
+          store->Update(store->EncodeKey(topic, topic_length), length, timestamp,
+                        [data, length](uint8_t* out) {
+                          memcpy(out, data, length);
+                          return true;
+                        });
+        });
+    if (good == log.size()) return true;
+    LOG("Dropping %u torn bytes from the end of %s\n", (unsigned)(log.size() - good),
+        path_.c_str());
+    return ftruncate(fd_, good) == 0 && fsync(fd_) == 0;
+  }
+
+  int fd_;
+  std::string path_;
+  Options options_;
+  Clock::time_point last_sync_;
+  std::vector<uint8_t> pending_;
+  uint32_t syncs_ = 0;
+};
+
+}  // namespace gnat
+
+#endif  // !ARDUINO
@@ -0,0 +1,142 @@
+#include "buffered-connection.h"
+
+#include <gtest/gtest.h>
+#include "server.h"
+
+namespace {
+
+// Serves a fixed buffer and counts how often it is asked for data.
+struct CountingConnection {
+    CountingConnection(const uint8_t* buffer, size_t size)
+        : buffer_(buffer), size_(size) {}
+
+    bool Read(uint8_t* to, size_t to_size) {
+        reads++;
+        if (to_size > size_ - position_) {
+            return false;
+        }
+        memcpy(to, buffer_ + position_, to_size);
+        position_ += to_size;
+        return true;
+    }
+
+    bool Drain(size_t bytes) {
+        drains++;
+        if (bytes > size_ - position_) {
+            return false;
+        }
+        position_ += bytes;
+        return true;
+    }
+
+    bool Write(uint8_t*, size_t) { return true; }
+    bool WritePartial(uint8_t*, size_t) { return true; }
+    void Close() {}
+    uint32_t id() { return 0; }
+
+    CountingConnection CreateHeapCopy() { return *this; }
+
+    gnat::ConnectionType connection_type() { return type_; }
+    void set_connection_type(gnat::ConnectionType type) { type_ = type; }
+
+    const uint8_t* buffer_;
+    size_t size_;
+    size_t position_ = 0;
+    int reads = 0;
+    int drains = 0;
+    gnat::ConnectionType type_ = gnat::ConnectionType::UNKNOWN;
+};
+
+using Buffered = gnat::BufferedConnection<CountingConnection, 64>;
+
+constexpr uint8_t kConnectData[] = {
+    0x10, 0x1f, 0x00, 0x06, 0x4d, 0x51, 0x49, 0x73,
+    0x64, 0x70, 0x03, 0x02, 0x00, 0x3c, 0x00, 0x11,
+    0x6d, 0x6f, 0x73, 0x71, 0x70, 0x75, 0x62, 0x7c,
+    0x31, 0x35, 0x36, 0x37, 0x35, 0x2d, 0x65, 0x37,
+    0x63};
+
+}  // namespace
+
+TEST(BufferedConnectionTest, ConnectHeaderInTwoReads) {
+    Buffered connection(CountingConnection(kConnectData, sizeof(kConnectData)));
+
+    auto packet = *gnat::Packet<Buffered>::ReadNext(std::move(connection));
+    ASSERT_EQ(packet.type(), gnat::PacketType::CONNECT);
+    ASSERT_EQ(packet.bytes_remaining(), 31);
+
+    const auto header = gnat::proto3::Connect::ReadFrom(&packet);
+    ASSERT_TRUE(header.has_value());
+    EXPECT_EQ(std::string("MQIsdp"),
+              std::string(header->protocol_name.data, header->protocol_name.length));
+    EXPECT_EQ(3, header->protocol_level);
+    EXPECT_EQ(2, header->flags);
+    EXPECT_EQ(60, header->keep_alive);
+
+    // One read for the fixed header, one for the rest of the packet.
+    EXPECT_EQ(2, packet.connection()->wrapped()->reads);
+}
+
+TEST(BufferedConnectionTest, PacketAccountingExact) {
+    // Two packets back to back, reading the first must not consume the second.
+    constexpr uint8_t kData[] = {
+      0x30, 0xC, 0x0, 0x6, 't', '/', 't', 'e', 's', 't', 't', 'e', 's', 't',
+      0xC0, 0x0,
+    };
+
+    Buffered connection(CountingConnection(kData, sizeof(kData)));
+    {
+      auto packet = *gnat::Packet<Buffered>::ReadNext(std::move(connection));
+      ASSERT_EQ(packet.type(), gnat::PacketType::PUBLISH);
+
+      const auto publish = gnat::proto3::Publish::ReadFrom(&packet, packet.type_flags());
+      ASSERT_TRUE(publish.has_value());
+      EXPECT_EQ(4, publish->payload_bytes);
+      EXPECT_EQ(4, packet.bytes_remaining());
+
+      uint8_t payload[4];
+      ASSERT_TRUE(packet.Read(payload, sizeof(payload)));
+      EXPECT_EQ(0, memcmp(payload, "test", 4));
+      EXPECT_EQ(0, packet.bytes_remaining());
+      EXPECT_EQ(0, packet.connection()->buffered());
+      EXPECT_EQ(14, packet.connection()->wrapped()->position_);
+
+      connection = std::move(*packet.connection());
+    }
+
+    auto ping = *gnat::Packet<Buffered>::ReadNext(std::move(connection));
+    EXPECT_EQ(ping.type(), gnat::PacketType::PINGREQ);
+    EXPECT_EQ(0, ping.bytes_remaining());
+}
+
+TEST(BufferedConnectionTest, LargeReadBypassesBuffer) {
+    uint8_t data[200];
+    for (size_t i = 0; i < sizeof(data); i++) data[i] = i;
+
+    Buffered connection(CountingConnection(data, sizeof(data)));
+    connection.ExpectBytes(sizeof(data));
+
+    uint8_t first[4];
+    ASSERT_TRUE(connection.Read(first, sizeof(first)));
+    EXPECT_EQ(3, first[3]);
+    EXPECT_EQ(60, connection.buffered());
+
+    uint8_t rest[196];
+    ASSERT_TRUE(connection.Read(rest, sizeof(rest)));
+    EXPECT_EQ(4, rest[0]);
+    EXPECT_EQ(199, rest[195]);
+    EXPECT_EQ(2, connection.wrapped()->reads);
+}
+
+TEST(BufferedConnectionTest, DrainUsesBufferFirst) {
+    Buffered connection(CountingConnection(kConnectData, sizeof(kConnectData)));
+    auto packet = *gnat::Packet<Buffered>::ReadNext(std::move(connection));
+    uint8_t name_length[2];
+    ASSERT_TRUE(packet.Read(name_length, sizeof(name_length)));
+
+    ASSERT_TRUE(packet.Drain(packet.bytes_remaining()));
+    EXPECT_EQ(0, packet.connection()->buffered());
+    EXPECT_EQ(sizeof(kConnectData), packet.connection()->wrapped()->position_);
+    // Everything was already buffered.
+    EXPECT_EQ(0, packet.connection()->wrapped()->drains);
+}
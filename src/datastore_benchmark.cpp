@@ -0,0 +1,133 @@
+// Time per operation for DataStore<uint64_t> on each of the growable storage
+// policies in storage.h, at a few key counts. Subscribe is an observer for
+// one exact topic, including replaying its value. Then the time to find the
+// observers of a set key, KeyMaskIndex against the SubscriptionIndex trie.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "datastore.h"
+
+namespace {
+
+constexpr char kDigits[] =
+    "0123456789abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+
+// Topics like "s/00a9Z", keys from them share their low bytes as real ones do.
+std::vector<uint64_t> MakeKeys(size_t count) {
+    std::vector<uint64_t> keys;
+    keys.reserve(count);
+    for (size_t i = 0; i < count; i++) {
+      char topic[8] = {'s', '/'};
+      size_t value = i;
+      for (size_t digit = 7; digit >= 2; digit--) {
+        topic[digit] = kDigits[value % 62];
+        value /= 62;
+      }
+      keys.push_back(gnat::key::EncodeString(topic, sizeof(topic)));
+    }
+    return keys;
+}
+
+template<typename Run>
+double NsPerOperation(size_t operations, Run run) {
+    const auto start = std::chrono::steady_clock::now();
+    run();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / operations;
+}
+
+bool Fill(uint8_t* data) {
+    memset(data, 1, 8);
+    return true;
+}
+
+template<typename DataStore>
+void Run(const char* name, const std::vector<uint64_t>& keys,
+         const std::vector<uint64_t>& shuffled) {
+    DataStore store;
+    const double insert = NsPerOperation(keys.size(), [&] {
+      for (const auto key : keys) store.Update(key, 8, 0, Fill);
+    });
+
+    uint64_t sum = 0;
+    const double lookup = NsPerOperation(keys.size(), [&] {
+      for (const auto key : shuffled) sum += store.Get(key).length;
+    });
+
+    const double update = NsPerOperation(keys.size(), [&] {
+      for (const auto key : shuffled) store.Update(key, 8, 1, Fill);
+    });
+
+    // A client subscribing to one topic, replay only looks that key up.
+    constexpr size_t kSubscribes = 1000;
+    size_t replayed = 0;
+    const double subscribe = NsPerOperation(kSubscribes, [&] {
+      for (size_t i = 0; i < kSubscribes; i++) {
+        char scratch[8];
+        size_t length = 0;
+        const char* topic =
+            gnat::KeyTraits<uint64_t>::Topic(shuffled[i % shuffled.size()], scratch, &length);
+        store.AddObserver({1, [&replayed](const uint64_t&, const gnat::DataStoreEntry&) {
+          replayed++;
+          return true;
+        }}, topic, length);
+      }
+    });
+    store.RemoveObserversForClient(1);
+
+    printf("%-16s %8zu keys  insert %7.1f ns  lookup %7.1f ns  update %7.1f ns  "
+           "subscribe %7.1f ns%s\n",
+           name, keys.size(), insert, lookup, update, subscribe,
+           sum == 0 || replayed != kSubscribes ? " (empty)" : "");
+}
+
+// |count| exact subscriptions and one '#' per 16, matched against every key.
+template<typename Index>
+double NotifyNs(size_t count, const std::vector<uint64_t>& keys) {
+    Index index;
+    for (size_t i = 0; i < count; i++) {
+      char scratch[8];
+      size_t length = 0;
+      const char* topic = gnat::KeyTraits<uint64_t>::Topic(keys[i], scratch, &length);
+      index.Insert(topic, length, i);
+      if (i % 16 == 0) index.Insert("s/#", 3, i);
+    }
+    size_t matched = 0;
+    const double ns = NsPerOperation(keys.size(), [&] {
+      for (const auto key : keys) {
+        char scratch[8];
+        size_t length = 0;
+        const char* topic = gnat::KeyTraits<uint64_t>::Topic(key, scratch, &length);
+        index.Match(key, topic, length, [&matched](size_t) { matched++; });
+      }
+    });
+    return matched == 0 ? -1 : ns;
+}
+
+}  // namespace
+
+int main() {
+    for (const size_t count : {1000, 100000, 1000000}) {
+      const auto keys = MakeKeys(count);
+      auto shuffled = keys;
+      std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937(1));
+
+      Run<gnat::DataStore<uint64_t>>("UnorderedStorage", keys, shuffled);
+      Run<gnat::DataStore<uint64_t, gnat::FlatStorage<uint64_t, gnat::DataStoreEntry>>>(
+          "FlatStorage", keys, shuffled);
+      Run<gnat::DataStore<uint64_t, gnat::OrderedStorage<uint64_t, gnat::DataStoreEntry>>>(
+          "OrderedStorage", keys, shuffled);
+    }
+
+    const auto keys = MakeKeys(1000);
+    for (const size_t count : {16, 256, 1000}) {
+      printf("notify %4zu subscriptions  KeyMaskIndex %7.1f ns  SubscriptionIndex %7.1f ns\n",
+             count, NotifyNs<gnat::KeyMaskIndex<size_t>>(count, keys),
+             NotifyNs<gnat::SubscriptionIndex<size_t>>(count, keys));
+    }
+    return 0;
+}
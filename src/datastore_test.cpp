@@ -1,6 +1,9 @@
 
 #include "datastore.h"
 
+#include <algorithm>
+#include <vector>
+
 #include <gtest/gtest.h>
 #include "key.h"
 
@@ -84,3 +87,209 @@ TEST(DataStoreTest, NotifyString) {
     ASSERT_TRUE(value == notified_string)
         << "notified_data: " << notified_string << "\n";
 }
+
+TEST(DataStoreTest, NotifyMatchingFilters) {
+    gnat::DataStore<std::string> store;
+    store.Set("old/value", ToEntry("0"));
+
+    std::vector<std::string> exact, prefix, single;
+    auto observer = [](std::vector<std::string>* out) {
+      return gnat::DataStore<std::string>::ObserverEntry{0,
+          [out](const std::string& key, const gnat::DataStoreEntry&) {
+            out->push_back(key);
+            return true;
+          }};
+    };
+    ASSERT_TRUE(store.AddObserver(observer(&exact), "a/b", 3));
+    ASSERT_TRUE(store.AddObserver(observer(&prefix), "old/#", 5));
+    ASSERT_TRUE(store.AddObserver(observer(&single), "+/b", 3));
+    ASSERT_FALSE(store.AddObserver(observer(&single), "a#", 2));
+
+    store.Set("a/b", ToEntry("1"));
+    store.Set("c/b", ToEntry("2"));
+    store.Set("old/other", ToEntry("3"));
+
+    EXPECT_EQ(std::vector<std::string>({"a/b"}), exact);
+    EXPECT_EQ(std::vector<std::string>({"old/value", "old/other"}), prefix);
+    EXPECT_EQ(std::vector<std::string>({"a/b", "c/b"}), single);
+}
+
+TEST(DataStoreTest, WildcardsSkipSystemTopics) {
+    gnat::DataStore<std::string> store;
+    store.Set("$SYS/uptime", ToEntry("1"));
+
+    std::vector<std::string> all, system;
+    auto observer = [](std::vector<std::string>* out) {
+      return gnat::DataStore<std::string>::ObserverEntry{0,
+          [out](const std::string& key, const gnat::DataStoreEntry&) {
+            out->push_back(key);
+            return true;
+          }};
+    };
+    // Neither replayed nor notified to "#".
+    ASSERT_TRUE(store.AddObserver(observer(&all), "#", 1));
+    ASSERT_TRUE(store.AddObserver(observer(&system), "$SYS/#", 6));
+    store.Set("$SYS/load", ToEntry("2"));
+    store.Set("a", ToEntry("3"));
+
+    EXPECT_EQ(std::vector<std::string>({"a"}), all);
+    EXPECT_EQ(std::vector<std::string>({"$SYS/uptime", "$SYS/load"}), system);
+}
+
+TEST(DataStoreTest, NotifyMatchingFiltersUint) {
+    gnat::DataStore<uint64_t> store;
+
+    std::vector<uint64_t> exact, prefix, cut;
+    auto observer = [](std::vector<uint64_t>* out) {
+      return gnat::DataStore<uint64_t>::ObserverEntry{0,
+          [out](uint64_t key, const gnat::DataStoreEntry&) {
+            out->push_back(key);
+            return true;
+          }};
+    };
+    ASSERT_TRUE(store.AddObserver(observer(&exact), "a/b", 3));
+    ASSERT_TRUE(store.AddObserver(observer(&prefix), "a/#", 3));
+    // Keys only hold 8 bytes of the topic, so this filter matches "sensors/".
+    ASSERT_TRUE(store.AddObserver(observer(&cut), "sensors/temp", 12));
+
+    store.Set(gnat::key::Encode("a/b"), ToEntry("1"));
+    store.Set(gnat::key::Encode("a/c"), ToEntry("2"));
+    store.Set(gnat::key::Encode("sensors/"), ToEntry("3"));
+    store.Set(gnat::key::Encode("b"), ToEntry("4"));
+
+    EXPECT_EQ(std::vector<uint64_t>({gnat::key::Encode("a/b")}), exact);
+    EXPECT_EQ(std::vector<uint64_t>({gnat::key::Encode("a/b"), gnat::key::Encode("a/c")}),
+              prefix);
+    EXPECT_EQ(std::vector<uint64_t>({gnat::key::Encode("sensors/")}), cut);
+}
+
+template<typename Storage>
+std::vector<std::string> Replayed(const char* filter) {
+    gnat::DataStore<std::string, Storage> store;
+    for (const char* key : {"a", "a/b", "a/b/c", "a/c", "ab", "b/b"}) {
+      store.Set(key, ToEntry(key));
+    }
+    std::vector<std::string> replayed;
+    store.AddObserver({0, [&replayed](const std::string& key, const gnat::DataStoreEntry&) {
+      replayed.push_back(key);
+      return true;
+    }}, filter, strlen(filter));
+    std::sort(replayed.begin(), replayed.end());
+    return replayed;
+}
+
+TEST(DataStoreTest, ReplayOnlyMatches) {
+    using Ordered = gnat::OrderedStorage<std::string, gnat::DataStoreEntry>;
+    using Unordered = gnat::UnorderedStorage<std::string, gnat::DataStoreEntry>;
+    for (const auto replayed : {Replayed<Ordered>, Replayed<Unordered>}) {
+      EXPECT_EQ(std::vector<std::string>({"a/b"}), replayed("a/b"));
+      EXPECT_EQ(std::vector<std::string>(), replayed("a/d"));
+      EXPECT_EQ(std::vector<std::string>({"a", "a/b", "a/b/c", "a/c"}), replayed("a/#"));
+      EXPECT_EQ(std::vector<std::string>({"a/b", "a/c"}), replayed("a/+"));
+      EXPECT_EQ(std::vector<std::string>({"a/b", "b/b"}), replayed("+/b"));
+      EXPECT_EQ(6u, replayed("#").size());
+    }
+}
+
+TEST(DataStoreTest, RemoveObserversForClient) {
+    gnat::DataStore<std::string> store;
+    int notified = 0;
+    auto handler = [&notified](const std::string&, const gnat::DataStoreEntry&) {
+      notified++;
+      return true;
+    };
+    store.AddObserver({1, handler}, "a", 1);
+    store.AddObserver({2, handler}, "#", 1);
+
+    store.RemoveObserversForClient(2);
+    store.Set("a", ToEntry("1"));
+    EXPECT_EQ(1, notified);
+}
+
+TEST(DataStoreTest, UpdateInPlace) {
+    gnat::DataStore<std::string> store;
+    int notified = 0;
+    store.AddObserver({0, [&notified](const std::string&, const gnat::DataStoreEntry&) {
+      notified++;
+      return true;
+    }});
+
+    auto fill = [](const char* value) {
+      return [value](uint8_t* data) {
+        memcpy(data, value, strlen(value));
+        return true;
+      };
+    };
+    ASSERT_TRUE(store.Update(kKey, 5, 1, fill("first")));
+    const uint8_t* buffer = store.Get(kKey).data.get();
+
+    // Fits, so the buffer is reused.
+    ASSERT_TRUE(store.Update(kKey, 3, 2, fill("two")));
+    const auto& entry = store.Get(kKey);
+    EXPECT_EQ(buffer, entry.data.get());
+    EXPECT_EQ("two", std::string((const char*)entry.data.get(), entry.length));
+    EXPECT_EQ(2, entry.timestamp);
+    EXPECT_EQ(5, entry.capacity);
+
+    // Grows.
+    ASSERT_TRUE(store.Update(kKey, 6, 3, fill("longer")));
+    EXPECT_EQ("longer", std::string((const char*)store.Get(kKey).data.get(), 6));
+    EXPECT_EQ(3, notified);
+
+    // A half written value is dropped.
+    EXPECT_FALSE(store.Update(kKey, 1, 4, [](uint8_t*) { return false; }));
+    EXPECT_THROW(store.Get(kKey), std::out_of_range);
+    EXPECT_EQ(3, notified);
+}
+
+TEST(DataStoreTest, SetReplaces) {
+    gnat::DataStore<std::string> store;
+    std::string notified;
+    store.AddObserver({0, [&notified](const std::string&, const gnat::DataStoreEntry& entry) {
+      notified = std::string((const char*)entry.data.get(), entry.length);
+      return true;
+    }});
+
+    store.Set(kKey, ToEntry("first"));
+    store.Set(kKey, ToEntry("second"));
+    EXPECT_EQ("second", notified);
+    EXPECT_EQ(6, store.Get(kKey).length);
+}
+
+TEST(DataStoreTest, Snapshots) {
+    gnat::SnapshotTable<std::string> snapshots;
+    gnat::DataStore<std::string> store;
+    store.set_snapshots(&snapshots);
+
+    store.Set(kKey, ToEntry("first"));
+    const auto first = snapshots.Get(kKey);
+    ASSERT_NE(nullptr, first);
+
+    // Outlives the value it was taken from.
+    store.Set(kKey, ToEntry("second"));
+    EXPECT_EQ("first", std::string((const char*)first->data.get(), first->length));
+    const auto second = snapshots.Get(kKey);
+    EXPECT_EQ("second", std::string((const char*)second->data.get(), second->length));
+
+    EXPECT_EQ(nullptr, snapshots.Get("missing"));
+
+    // A value half written in place is gone from the snapshots too.
+    ASSERT_TRUE(store.Update(kKey, 1, 0, [](uint8_t*) { return true; }));
+    EXPECT_FALSE(store.Update(kKey, 1, 0, [](uint8_t*) { return false; }));
+    EXPECT_EQ(nullptr, snapshots.Get(kKey));
+}
+
+TEST(DataStoreTest, SnapshotsForgetEvictedKeys) {
+    gnat::SnapshotTable<std::string> snapshots;
+    gnat::DataStore<std::string, gnat::UnorderedStorage<std::string, gnat::DataStoreEntry>,
+                    gnat::LruEviction<std::string>> store;
+    store.set_snapshots(&snapshots);
+    store.set_limits({.max_bytes = SIZE_MAX, .max_entries = 1});
+
+    for (int i = 0; i < 100; ++i) {
+      ASSERT_TRUE(store.Set("key/" + std::to_string(i), ToEntry("value")));
+    }
+    EXPECT_EQ(1u, snapshots.size());
+    EXPECT_EQ(nullptr, snapshots.Get("key/0"));
+    EXPECT_NE(nullptr, snapshots.Get("key/99"));
+}
@@ -0,0 +1,123 @@
+#include "eviction.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+namespace {
+
+template<typename Eviction>
+using Store = gnat::DataStore<std::string,
+    gnat::UnorderedStorage<std::string, gnat::DataStoreEntry>, Eviction>;
+
+template<typename DataStore>
+bool Put(DataStore* store, const std::string& key, uint32_t length) {
+  return store->Update(key, length, 0, [](uint8_t*) { return true; });
+}
+
+}  // namespace
+
+TEST(EvictionTest, LruOrder) {
+  gnat::LruEviction<int> lru;
+  lru.Touched(1);
+  lru.Touched(2);
+  lru.Touched(3);
+  lru.Touched(1);
+
+  int victim = 0;
+  ASSERT_TRUE(lru.Victim(0, &victim));
+  EXPECT_EQ(2, victim);
+  ASSERT_TRUE(lru.Victim(2, &victim));
+  EXPECT_EQ(3, victim);
+
+  lru.Removed(2);
+  lru.Removed(3);
+  ASSERT_TRUE(lru.Victim(0, &victim));
+  EXPECT_EQ(1, victim);
+  EXPECT_FALSE(lru.Victim(1, &victim));
+}
+
+TEST(EvictionTest, LfuOrder) {
+  gnat::LfuEviction<int> lfu;
+  for (int i = 0; i < 3; i++) lfu.Touched(1);
+  lfu.Touched(2);
+  lfu.Touched(2);
+  lfu.Touched(3);
+  lfu.Touched(4);
+  EXPECT_EQ(3, lfu.count(1));
+  EXPECT_EQ(2, lfu.count(2));
+
+  int victim = 0;
+  // Fewest sets, oldest first.
+  ASSERT_TRUE(lfu.Victim(0, &victim));
+  EXPECT_EQ(3, victim);
+  ASSERT_TRUE(lfu.Victim(3, &victim));
+  EXPECT_EQ(4, victim);
+
+  lfu.Removed(3);
+  lfu.Removed(4);
+  ASSERT_TRUE(lfu.Victim(0, &victim));
+  EXPECT_EQ(2, victim);
+  ASSERT_TRUE(lfu.Victim(2, &victim));
+  EXPECT_EQ(1, victim);
+
+  lfu.Removed(2);
+  lfu.Removed(1);
+  EXPECT_FALSE(lfu.Victim(0, &victim));
+  EXPECT_EQ(0, lfu.count(1));
+}
+
+TEST(EvictionTest, EntryLimit) {
+  Store<gnat::LruEviction<std::string>> store;
+  store.set_limits({.max_bytes = SIZE_MAX, .max_entries = 2});
+
+  ASSERT_TRUE(Put(&store, "a", 1));
+  ASSERT_TRUE(Put(&store, "b", 1));
+  ASSERT_TRUE(Put(&store, "a", 1));
+  ASSERT_TRUE(Put(&store, "c", 1));
+
+  EXPECT_EQ(2, store.size());
+  EXPECT_EQ(nullptr, store.Find("b"));
+  EXPECT_NE(nullptr, store.Find("a"));
+  EXPECT_EQ(1, store.retention_stats().evicted_entries);
+}
+
+TEST(EvictionTest, ByteLimit) {
+  Store<gnat::LfuEviction<std::string>> store;
+  store.set_limits({.max_bytes = 100, .max_entries = SIZE_MAX});
+
+  ASSERT_TRUE(Put(&store, "hot", 40));
+  ASSERT_TRUE(Put(&store, "hot", 40));
+  ASSERT_TRUE(Put(&store, "cold", 40));
+  EXPECT_EQ(80, store.retention_stats().bytes);
+
+  // Evicts the least used to fit.
+  ASSERT_TRUE(Put(&store, "new", 30));
+  EXPECT_EQ(nullptr, store.Find("cold"));
+  EXPECT_EQ(70, store.retention_stats().bytes);
+  EXPECT_EQ(40, store.retention_stats().evicted_bytes);
+
+  // Growing a key counts only the difference.
+  ASSERT_TRUE(Put(&store, "hot", 70));
+  EXPECT_NE(nullptr, store.Find("new"));
+  EXPECT_EQ(100, store.retention_stats().bytes);
+  ASSERT_TRUE(Put(&store, "hot", 71));
+  EXPECT_EQ(nullptr, store.Find("new"));
+  EXPECT_EQ(71, store.retention_stats().bytes);
+
+  // Never fits.
+  EXPECT_FALSE(Put(&store, "huge", 101));
+  EXPECT_EQ(1, store.retention_stats().rejected);
+}
+
+TEST(EvictionTest, NoEvictionRejects) {
+  Store<gnat::NoEviction<std::string>> store;
+  store.set_limits({.max_bytes = SIZE_MAX, .max_entries = 1});
+
+  ASSERT_TRUE(Put(&store, "a", 1));
+  EXPECT_FALSE(Put(&store, "b", 1));
+  // Existing keys still update.
+  EXPECT_TRUE(Put(&store, "a", 2));
+  EXPECT_EQ(1, store.retention_stats().rejected);
+}
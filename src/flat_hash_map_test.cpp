@@ -0,0 +1,99 @@
+#include "flat_hash_map.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <random>
+#include <string>
+#include <unordered_map>
+
+namespace {
+
+// Sends everything to a handful of slots so probes wrap and collide.
+struct CollidingHash {
+  size_t operator()(uint64_t key) const { return key % 3 == 0 ? 15 : key & 0xF; }
+};
+
+template<typename Map>
+void ExpectSame(const std::unordered_map<uint64_t, int>& expected, Map& map) {
+  ASSERT_EQ(expected.size(), map.size());
+  size_t visited = 0;
+  for (const auto& entry : map) {
+    visited++;
+    const auto found = expected.find(entry.first);
+    ASSERT_NE(expected.end(), found) << entry.first;
+    EXPECT_EQ(found->second, entry.second);
+  }
+  EXPECT_EQ(expected.size(), visited);
+  for (const auto& entry : expected) {
+    ASSERT_NE(map.end(), map.find(entry.first)) << entry.first;
+    EXPECT_EQ(entry.second, map.at(entry.first));
+  }
+}
+
+template<typename Map>
+void RandomOperations(Map* map, uint64_t key_range) {
+  std::unordered_map<uint64_t, int> expected;
+  std::mt19937_64 random(1);
+  for (int i = 0; i < 20000; i++) {
+    const uint64_t key = random() % key_range;
+    if (random() % 3 == 0) {
+      EXPECT_EQ(expected.erase(key), map->erase(key));
+    } else {
+      const auto inserted = map->emplace(key, i);
+      EXPECT_EQ(expected.emplace(key, i).second, inserted.second);
+      EXPECT_EQ(key, inserted.first->first);
+    }
+    if (i % 1000 == 0) ExpectSame(expected, *map);
+  }
+  ExpectSame(expected, *map);
+}
+
+}  // namespace
+
+TEST(FlatHashMapTest, MatchesUnorderedMap) {
+  gnat::FlatHashMap<uint64_t, int> map;
+  RandomOperations(&map, 500);
+}
+
+TEST(FlatHashMapTest, Collisions) {
+  gnat::FlatHashMap<uint64_t, int, CollidingHash> map;
+  RandomOperations(&map, 64);
+}
+
+TEST(FlatHashMapTest, EraseIterator) {
+  gnat::FlatHashMap<uint64_t, std::string> map;
+  for (uint64_t i = 0; i < 100; i++) map.emplace(i, std::to_string(i));
+
+  auto found = map.find(42);
+  ASSERT_NE(map.end(), found);
+  EXPECT_EQ("42", found->second);
+  map.erase(found);
+  EXPECT_EQ(map.end(), map.find(42));
+  EXPECT_EQ(99, map.size());
+  EXPECT_THROW(map.at(42), std::out_of_range);
+
+  map.clear();
+  EXPECT_TRUE(map.empty());
+  EXPECT_EQ(map.begin(), map.end());
+}
+
+TEST(FlatHashMapTest, DataStoreStorage) {
+  gnat::DataStore<uint64_t, gnat::FlatHashMap<uint64_t, gnat::DataStoreEntry>> store;
+  int notified = 0;
+  store.AddObserver({0, [&notified](uint64_t, const gnat::DataStoreEntry&) {
+    notified++;
+    return true;
+  }}, "sensors/", 8);
+
+  for (uint32_t i = 0; i < 3; i++) {
+    store.Update(gnat::key::Encode("sensors/"), 4, i, [](uint8_t* data) {
+      memcpy(data, "test", 4);
+      return true;
+    });
+    store.Set(gnat::key::Encode("other"), gnat::DataStoreEntry(i));
+  }
+  EXPECT_EQ(3, notified);
+  EXPECT_EQ(2, store.Get(gnat::key::Encode("sensors/")).timestamp);
+  EXPECT_EQ(2, store.Get(gnat::key::Encode("other")).timestamp);
+}
@@ -0,0 +1,133 @@
+#include "history.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+void Append(gnat::HistoryRing* ring, const std::string& value, uint32_t timestamp) {
+  ring->Append(reinterpret_cast<const uint8_t*>(value.data()), value.size(), timestamp);
+}
+
+// "value@timestamp" for each sample visited.
+class Collect {
+public:
+  explicit Collect(std::vector<std::string>* out) : out_(out) {}
+  void operator()(const gnat::HistorySample& sample) const {
+    out_->push_back(std::string(reinterpret_cast<const char*>(sample.data), sample.length) +
+                    "@" + std::to_string(sample.timestamp));
+  }
+
+private:
+  std::vector<std::string>* out_;
+};
+
+std::vector<std::string> Last(const gnat::HistoryRing& ring, size_t count) {
+  std::vector<std::string> out;
+  ring.ForEachLast(count, Collect(&out));
+  return out;
+}
+
+}  // namespace
+
+TEST(HistoryRingTest, KeepsLastSamples) {
+  gnat::HistoryRing ring(3, 64);
+  Append(&ring, "a", 1);
+  Append(&ring, "b", 2);
+  EXPECT_EQ((std::vector<std::string>{"a@1", "b@2"}), Last(ring, 10));
+
+  Append(&ring, "c", 3);
+  Append(&ring, "d", 4);
+  EXPECT_EQ(3u, ring.size());
+  EXPECT_EQ((std::vector<std::string>{"b@2", "c@3", "d@4"}), Last(ring, 10));
+  EXPECT_EQ((std::vector<std::string>{"c@3", "d@4"}), Last(ring, 2));
+  EXPECT_TRUE(Last(ring, 0).empty());
+}
+
+TEST(HistoryRingTest, WrapsBytes) {
+  gnat::HistoryRing ring(100, 10);
+  Append(&ring, "1111", 1);
+  Append(&ring, "2222", 2);
+  // Doesn't fit in the 2 bytes at the end, wraps over "1111".
+  Append(&ring, "333", 3);
+  EXPECT_EQ((std::vector<std::string>{"2222@2", "333@3"}), Last(ring, 10));
+
+  // Fits after "333" but runs into "2222".
+  Append(&ring, "44", 4);
+  EXPECT_EQ((std::vector<std::string>{"333@3", "44@4"}), Last(ring, 10));
+  // Fits in the space "2222" left.
+  Append(&ring, "555", 5);
+  EXPECT_EQ((std::vector<std::string>{"333@3", "44@4", "555@5"}), Last(ring, 10));
+
+  // Too big to ever fit.
+  EXPECT_FALSE(ring.Append(reinterpret_cast<const uint8_t*>("01234567890"), 11, 6));
+  EXPECT_EQ(3u, ring.size());
+
+  // Fills the whole ring.
+  Append(&ring, "0123456789", 7);
+  EXPECT_EQ((std::vector<std::string>{"0123456789@7"}), Last(ring, 10));
+}
+
+TEST(HistoryRingTest, Since) {
+  gnat::HistoryRing ring(10, 64);
+  Append(&ring, "a", 0xfffffff0u);
+  Append(&ring, "b", 0xfffffffau);
+  // The millisecond clock wrapped.
+  Append(&ring, "c", 5);
+
+  std::vector<std::string> out;
+  ring.ForEachSince(0xfffffff5u, Collect(&out));
+  EXPECT_EQ((std::vector<std::string>{"b@4294967290", "c@5"}), out);
+  out.clear();
+  ring.ForEachSince(6, Collect(&out));
+  EXPECT_TRUE(out.empty());
+}
+
+TEST(HistoryRingTest, EmptyValues) {
+  gnat::HistoryRing ring(8, 10);
+  Append(&ring, "AAAAA", 1);
+  Append(&ring, "", 2);
+  Append(&ring, "BBBBB", 3);
+  Append(&ring, "CCCCC", 4);
+  EXPECT_EQ((std::vector<std::string>{"@2", "BBBBB@3", "CCCCC@4"}), Last(ring, 10));
+
+  // Goes where "BBBBB" was, the empty value before it goes too.
+  Append(&ring, "DDDDD", 5);
+  EXPECT_EQ((std::vector<std::string>{"CCCCC@4", "DDDDD@5"}), Last(ring, 10));
+
+  // Nothing is after an empty newest value, writing at its offset keeps it.
+  gnat::HistoryRing empty_first(8, 10);
+  Append(&empty_first, "", 1);
+  Append(&empty_first, "A", 2);
+  EXPECT_EQ((std::vector<std::string>{"@1", "A@2"}), Last(empty_first, 10));
+}
+
+TEST(HistoryRingTest, DataStore) {
+  gnat::HistoryTable<std::string> history(4, 256);
+  gnat::DataStore<std::string> store;
+  store.set_history(&history);
+
+  std::vector<std::string> out;
+  EXPECT_FALSE(store.HistoryLast("a", 10, Collect(&out)));
+
+  for (uint32_t i = 0; i < 6; i++) {
+    const std::string value = "v" + std::to_string(i);
+    store.Update("a", value.size(), i * 1000, [&value](uint8_t* data) {
+      memcpy(data, value.data(), value.size());
+      return true;
+    });
+  }
+  ASSERT_TRUE(store.HistoryLast("a", 10, Collect(&out)));
+  EXPECT_EQ((std::vector<std::string>{"v2@2000", "v3@3000", "v4@4000", "v5@5000"}), out);
+
+  out.clear();
+  ASSERT_TRUE(store.HistorySince("a", 4000, Collect(&out)));
+  EXPECT_EQ((std::vector<std::string>{"v4@4000", "v5@5000"}), out);
+
+  // A failed update in place removes the key and its history.
+  EXPECT_FALSE(store.Update("a", 1, 0, [](uint8_t*) { return false; }));
+  EXPECT_FALSE(store.HistoryLast("a", 10, Collect(&out)));
+}
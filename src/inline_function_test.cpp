@@ -0,0 +1,62 @@
+#include "inline_function.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+TEST(InlineFunctionTest, Calls) {
+  gnat::InlineFunction<int(int, int)> add = [](int a, int b) { return a + b; };
+  EXPECT_TRUE(add);
+  EXPECT_EQ(5, add(2, 3));
+
+  gnat::InlineFunction<int(int, int)> empty;
+  EXPECT_FALSE(empty);
+  empty = nullptr;
+  EXPECT_FALSE(empty);
+}
+
+TEST(InlineFunctionTest, MutableState) {
+  gnat::InlineFunction<int()> counter = [count = 0]() mutable { return ++count; };
+  EXPECT_EQ(1, counter());
+  EXPECT_EQ(2, counter());
+
+  // Copies carry on from where the original was.
+  auto copy = counter;
+  EXPECT_EQ(3, copy());
+  EXPECT_EQ(3, counter());
+}
+
+TEST(InlineFunctionTest, CopiesAndDestroysCaptures) {
+  auto shared = std::make_shared<int>(7);
+  {
+    gnat::InlineFunction<int()> get = [shared] { return *shared; };
+    EXPECT_EQ(2, shared.use_count());
+
+    auto copy = get;
+    EXPECT_EQ(3, shared.use_count());
+
+    auto moved = std::move(get);
+    EXPECT_FALSE(get);
+    EXPECT_EQ(3, shared.use_count());
+    EXPECT_EQ(7, moved());
+
+    copy = moved;
+    EXPECT_EQ(3, shared.use_count());
+    copy = nullptr;
+    EXPECT_EQ(2, shared.use_count());
+  }
+  EXPECT_EQ(1, shared.use_count());
+}
+
+TEST(InlineFunctionTest, KeyMatchers) {
+  using Store = gnat::DataStore<std::string>;
+  const auto full = Store::FullKeyMatcher("a/b");
+  EXPECT_TRUE(full("a/b"));
+  EXPECT_FALSE(full("a/bc"));
+
+  const auto prefix = Store::PrefixKeyMatcher("a/");
+  EXPECT_TRUE(prefix("a/b"));
+  EXPECT_FALSE(prefix("b/a"));
+}
@@ -0,0 +1,95 @@
+#include "inline_topic.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+using Topic = gnat::InlineTopic<16>;
+
+Topic Make(const std::string& topic) {
+  return Topic(topic.data(), topic.size());
+}
+
+}  // namespace
+
+TEST(InlineTopicTest, CompareAndHash) {
+  const auto a = Make("sensors/a");
+  EXPECT_EQ(a, Make("sensors/a"));
+  EXPECT_NE(a, Make("sensors/b"));
+  EXPECT_NE(a, Make("sensors/"));
+  EXPECT_EQ(a.hash(), Make("sensors/a").hash());
+  EXPECT_NE(a.hash(), Make("sensors/b").hash());
+  EXPECT_EQ("sensors/a", std::string(a.data(), a.size()));
+
+  EXPECT_TRUE(Make("sensors") < Make("sensors/a"));
+  EXPECT_TRUE(Make("sensors/a") < Make("sensors/b"));
+  EXPECT_FALSE(Make("sensors/b") < Make("sensors/a"));
+  EXPECT_FALSE(a < a);
+}
+
+TEST(InlineTopicTest, CutsLongTopics) {
+  const auto topic = Make("0123456789abcdefXYZ");
+  EXPECT_EQ(16u, topic.size());
+  EXPECT_EQ(Make("0123456789abcdef"), topic);
+}
+
+TEST(InlineTopicTest, DataStoreKeys) {
+  using Store = gnat::DataStore<Topic>;
+  Store store;
+
+  std::vector<std::string> seen;
+  ASSERT_TRUE(store.AddObserver({0, [&seen](const Topic& key, const gnat::DataStoreEntry&) {
+    char topic[Topic::kMaxLength];
+    uint16_t length = 0;
+    Store::DecodeKey(key, topic, &length);
+    seen.emplace_back(topic, length);
+    return true;
+  }}, "sensors/+", 9));
+
+  for (const char* topic : {"sensors/a", "sensors/b", "other/a"}) {
+    store.Update(Store::EncodeKey(topic, strlen(topic)), 1, 0, [](uint8_t* data) {
+      *data = 1;
+      return true;
+    });
+  }
+  EXPECT_EQ(3u, store.size());
+  EXPECT_EQ((std::vector<std::string>{"sensors/a", "sensors/b"}), seen);
+
+  const auto full = Store::FullKeyMatcher(Store::EncodeKey("sensors/a", 9));
+  EXPECT_TRUE(full(Store::EncodeKey("sensors/a", 9)));
+  EXPECT_FALSE(full(Store::EncodeKey("sensors/b", 9)));
+  const auto prefix = Store::PrefixKeyMatcher(Store::EncodeKey("sensors/", 8));
+  EXPECT_TRUE(prefix(Store::EncodeKey("sensors/a", 9)));
+  EXPECT_FALSE(prefix(Store::EncodeKey("other/a", 7)));
+}
+
+TEST(InlineTopicTest, OrderedPrefixScan) {
+  using Store = gnat::DataStore<Topic, gnat::OrderedStorage<Topic, gnat::DataStoreEntry>>;
+  Store store;
+  for (const char* topic : {"a/x", "b/x", "b/y", "c/x"}) {
+    store.Set(Store::EncodeKey(topic, strlen(topic)), store.CreateEntry(1, 0));
+  }
+
+  std::vector<std::string> under;
+  store.ForEachPrefix("b/", 2, [&under](const Topic& key, const gnat::DataStoreEntry&) {
+    under.emplace_back(key.data(), key.size());
+  });
+  EXPECT_EQ((std::vector<std::string>{"b/x", "b/y"}), under);
+}
+
+TEST(InlineTopicTest, FiltersAreCut) {
+  using Store = gnat::DataStore<Topic>;
+  Store store;
+  int notified = 0;
+  // Longer than the 16 bytes kept, so it matches the cut key.
+  ASSERT_TRUE(store.AddObserver({0, [&notified](const Topic&, const gnat::DataStoreEntry&) {
+    notified++;
+    return true;
+  }}, "0123456789abcdefXYZ", 19));
+  store.Set(Store::EncodeKey("0123456789abcdefXYZ", 19), store.CreateEntry(1, 0));
+  EXPECT_EQ(1, notified);
+}
@@ -0,0 +1,135 @@
+#include "key_mask_index.h"
+#include "datastore.h"
+#include "subscription_index.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <random>
+#include <string>
+#include <vector>
+
+namespace {
+
+template<typename Index>
+std::vector<int> Match(Index* index, const std::string& topic) {
+  std::vector<int> out;
+  index->Match(topic.data(), topic.size(), [&out](int value) { out.push_back(value); });
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+}  // namespace
+
+TEST(KeyMaskIndexTest, MatchesLikeSubscriptionIndex) {
+  const std::vector<std::string> filters = {
+      "#", "a", "a/b", "a/#", "a/b/#", "/#", "ab", "abcdefgh", "abcdefg/#",
+      "+", "a/+", "+/b", "+/+/#", "a//b", "b/#", "$SYS/#", "$/+", "+/x"};
+  const std::vector<std::string> topics = {
+      "a", "a/", "a/b", "a/bc", "a/b/c", "ab", "ab/c", "b", "b/a", "/", "/a",
+      "abcdefgh", "abcdefg/", "abcdefg", "a//b", "c", "$SYS/x", "$/x", "$"};
+
+  gnat::KeyMaskIndex<int> masks;
+  gnat::SubscriptionIndex<int> trie;
+  for (size_t i = 0; i < filters.size(); i++) {
+    masks.Insert(filters[i].data(), filters[i].size(), i);
+    trie.Insert(filters[i].data(), filters[i].size(), i);
+  }
+  EXPECT_EQ(filters.size(), masks.size());
+
+  for (const auto& topic : topics) {
+    EXPECT_EQ(Match(&trie, topic), Match(&masks, topic)) << topic;
+  }
+}
+
+TEST(KeyMaskIndexTest, SystemTopics) {
+  gnat::KeyMaskIndex<int> index;
+  index.Insert("#", 1, 1);
+  index.Insert("+/x", 3, 2);
+  index.Insert("$SYS/#", 6, 3);
+  EXPECT_EQ((std::vector<int>{3}), Match(&index, "$SYS/x"));
+  EXPECT_EQ((std::vector<int>{1, 2}), Match(&index, "a/x"));
+
+  index.RemoveIf([](int value) { return value == 1; });
+  EXPECT_EQ(2u, index.size());
+  EXPECT_EQ((std::vector<int>{2}), Match(&index, "a/x"));
+}
+
+TEST(KeyMaskIndexTest, RemoveIf) {
+  gnat::KeyMaskIndex<int> index;
+  index.Insert("a/#", 3, 1);
+  index.Insert("a", 1, 2);
+  index.Insert("+/b", 3, 3);
+  index.Insert("a/b", 3, 4);
+
+  int seen = 0;
+  index.RemoveIf([&seen](int value) {
+    seen++;
+    return value == 1 || value == 3;
+  });
+  // The second entry of "a/#" isn't shown to the predicate.
+  EXPECT_EQ(4, seen);
+  EXPECT_EQ(2u, index.size());
+  EXPECT_EQ(std::vector<int>({2}), Match(&index, "a"));
+  EXPECT_EQ(std::vector<int>({4}), Match(&index, "a/b"));
+
+  std::vector<int> all;
+  index.ForEach([&all](int value) { all.push_back(value); });
+  std::sort(all.begin(), all.end());
+  EXPECT_EQ(std::vector<int>({2, 4}), all);
+}
+
+TEST(KeyMaskIndexTest, ManyBlocks) {
+  // Enough subscriptions for a few 64 wide blocks and a partial one.
+  gnat::KeyMaskIndex<int> index;
+  for (int i = 0; i < 200; i++) {
+    const std::string filter = i % 3 == 0 ? "s/#" : "s/" + std::to_string(i);
+    index.Insert(filter.data(), filter.size(), i);
+  }
+  std::vector<int> expected;
+  for (int i = 0; i < 200; i += 3) expected.push_back(i);
+  expected.push_back(77);
+  std::sort(expected.begin(), expected.end());
+  EXPECT_EQ(expected, Match(&index, "s/77"));
+}
+
+TEST(KeyMaskIndexTest, VectorMatchesScalar) {
+  std::mt19937_64 random(7);
+  std::vector<uint64_t> masks(64);
+  std::vector<uint64_t> values(64);
+  for (size_t i = 0; i < masks.size(); i++) {
+    masks[i] = random() & random();
+    values[i] = i % 2 ? 0x1234 & masks[i] : random() & masks[i];
+  }
+  for (size_t count = 0; count <= masks.size(); count++) {
+    for (const uint64_t key : {(uint64_t)0x1234, (uint64_t)random(), ~(uint64_t)0}) {
+      EXPECT_EQ(gnat::mask::MatchScalar(masks.data(), values.data(), count, key),
+                gnat::mask::Match(masks.data(), values.data(), count, key));
+    }
+  }
+}
+
+TEST(KeyMaskIndexTest, DataStore) {
+  using Store = gnat::DataStore<uint64_t, gnat::UnorderedStorage<uint64_t, gnat::DataStoreEntry>,
+                                gnat::NoEviction<uint64_t>, gnat::KeyMaskSubscriptions>;
+  Store store;
+  std::vector<std::string> seen;
+  const auto observe = [&seen](const char* name) {
+    return Store::ObserverEntry{0, [&seen, name](const uint64_t&, const gnat::DataStoreEntry&) {
+      seen.push_back(name);
+      return true;
+    }};
+  };
+  ASSERT_TRUE(store.AddObserver(observe("a/#"), "a/#", 3));
+  ASSERT_TRUE(store.AddObserver(observe("a/b"), "a/b", 3));
+  ASSERT_TRUE(store.AddObserver(observe("+/b"), "+/b", 3));
+
+  for (const char* topic : {"a/b", "c/b", "a/c", "b"}) {
+    store.Update(Store::EncodeKey(topic, strlen(topic)), 1, 0, [](uint8_t* data) {
+      *data = 1;
+      return true;
+    });
+  }
+  std::sort(seen.begin(), seen.end());
+  EXPECT_EQ((std::vector<std::string>{"+/b", "+/b", "a/#", "a/#", "a/b"}), seen);
+}
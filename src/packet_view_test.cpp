@@ -0,0 +1,107 @@
+#include "packet_view.h"
+
+#include <gtest/gtest.h>
+
+namespace {
+
+constexpr uint8_t kConnectData[] = {
+    0x10, 0x1f, 0x00, 0x06, 0x4d, 0x51, 0x49, 0x73,
+    0x64, 0x70, 0x03, 0x02, 0x00, 0x3c, 0x00, 0x11,
+    0x6d, 0x6f, 0x73, 0x71, 0x70, 0x75, 0x62, 0x7c,
+    0x31, 0x35, 0x36, 0x37, 0x35, 0x2d, 0x65, 0x37,
+    0x63};
+
+constexpr uint8_t kPublishData[] = {
+    0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+    0x74, 0x74, 0x65, 0x73, 0x74
+};
+
+std::string ToString(const gnat::StringView& view) {
+    return std::string(view.data, view.length);
+}
+
+}  // namespace
+
+TEST(PacketViewTest, ParseIncomplete) {
+    bool malformed = true;
+    for (size_t size = 0; size < sizeof(kPublishData); size++) {
+      EXPECT_FALSE(gnat::PacketView::Parse(kPublishData, size, &malformed).has_value());
+      EXPECT_FALSE(malformed);
+    }
+
+    const auto packet = gnat::PacketView::Parse(kPublishData, sizeof(kPublishData));
+    ASSERT_TRUE(packet.has_value());
+    EXPECT_EQ(gnat::PacketType::PUBLISH, packet->type());
+    EXPECT_EQ(sizeof(kPublishData), packet->size());
+    EXPECT_EQ(12, packet->body.length);
+}
+
+TEST(PacketViewTest, ParseMalformedSize) {
+    constexpr uint8_t kData[] = {0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x01};
+    bool malformed = false;
+    EXPECT_FALSE(gnat::PacketView::Parse(kData, sizeof(kData), &malformed).has_value());
+    EXPECT_TRUE(malformed);
+}
+
+TEST(PacketViewTest, ParseMultiByteSize) {
+    uint8_t data[3 + 200] = {0x30, 0xC8, 0x01};
+    const auto packet = gnat::PacketView::Parse(data, sizeof(data));
+    ASSERT_TRUE(packet.has_value());
+    EXPECT_EQ(3, packet->header_size);
+    EXPECT_EQ(200, packet->body.length);
+}
+
+TEST(PacketViewTest, Connect) {
+    const auto packet = gnat::PacketView::Parse(kConnectData, sizeof(kConnectData));
+    ASSERT_TRUE(packet.has_value());
+
+    const auto connect = gnat::proto3::ConnectView::ReadFrom(*packet);
+    ASSERT_TRUE(connect.has_value());
+    EXPECT_EQ("MQIsdp", ToString(connect->protocol_name));
+    EXPECT_EQ(3, connect->protocol_level);
+    EXPECT_EQ(2, connect->flags);
+    EXPECT_EQ(60, connect->keep_alive);
+    EXPECT_EQ("mosqpub|15675-e7c", ToString(connect->client_id));
+}
+
+TEST(PacketViewTest, PublishPointsIntoBuffer) {
+    const auto packet = gnat::PacketView::Parse(kPublishData, sizeof(kPublishData));
+    ASSERT_TRUE(packet.has_value());
+
+    const auto publish = gnat::proto3::PublishView::ReadFrom(*packet);
+    ASSERT_TRUE(publish.has_value());
+    EXPECT_EQ("t/test", ToString(publish->topic));
+    EXPECT_EQ((const char*)kPublishData + 4, publish->topic.data);
+    EXPECT_EQ(4, publish->payload.length);
+    EXPECT_EQ(kPublishData + 10, publish->payload.data);
+}
+
+TEST(PacketViewTest, PublishTopicOverrun) {
+    constexpr uint8_t kData[] = {0x30, 0x4, 0x0, 0x6, 't', '/'};
+    const auto packet = gnat::PacketView::Parse(kData, sizeof(kData));
+    ASSERT_TRUE(packet.has_value());
+    EXPECT_FALSE(gnat::proto3::PublishView::ReadFrom(*packet).has_value());
+}
+
+TEST(PacketViewTest, SubscribeTopics) {
+    constexpr uint8_t kData[] = {
+      0b10000010, 15, 0x0, 0x7,
+      0x0, 0x6, 't', '/', 't', 'e', 's', 't', 0,
+      0x0, 0x1, '#', 0,
+    };
+    const auto packet = gnat::PacketView::Parse(kData, sizeof(kData));
+    ASSERT_TRUE(packet.has_value());
+
+    const auto subscribe = gnat::proto3::SubscribeView::ReadFrom(*packet);
+    ASSERT_TRUE(subscribe.has_value());
+    EXPECT_EQ(7, subscribe->packet_id);
+
+    std::vector<std::string> topics;
+    EXPECT_TRUE(subscribe->ForEachTopic([&](const char* topic, size_t length) {
+      topics.emplace_back(topic, length);
+      return true;
+    }));
+    ASSERT_EQ(2, topics.size());
+    EXPECT_EQ("t/test", topics[0]);
+    EXPECT_EQ("#", topics[1]);
+}
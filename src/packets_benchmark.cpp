@@ -0,0 +1,125 @@
+// Counts calls into the connection and time spent parsing common packets, with
+// and without a BufferedConnection in front of the connection.
+
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "buffered-connection.h"
+#include "server.h"
+
+namespace {
+
+// Shared by all copies so the counts survive Packet moving the connection.
+struct Counters {
+    uint64_t reads = 0;
+    uint64_t bytes = 0;
+};
+
+struct CountingConnection {
+    CountingConnection(const std::vector<uint8_t>* data, Counters* counters)
+        : data_(data), counters_(counters) {}
+
+    bool Read(uint8_t* to, size_t to_size) {
+        counters_->reads++;
+        counters_->bytes += to_size;
+        if (to_size > data_->size() - position_) return false;
+        memcpy(to, data_->data() + position_, to_size);
+        position_ += to_size;
+        return true;
+    }
+
+    bool Drain(size_t bytes) {
+        counters_->reads++;
+        if (bytes > data_->size() - position_) return false;
+        position_ += bytes;
+        return true;
+    }
+
+    bool Write(uint8_t*, size_t) { return true; }
+    bool WritePartial(uint8_t*, size_t) { return true; }
+    void Close() {}
+    uint32_t id() { return 0; }
+    CountingConnection CreateHeapCopy() { return *this; }
+    gnat::ConnectionType connection_type() { return gnat::ConnectionType::UNKNOWN; }
+    void set_connection_type(gnat::ConnectionType) {}
+
+    bool done() const { return position_ >= data_->size(); }
+
+    const std::vector<uint8_t>* data_;
+    Counters* counters_;
+    size_t position_ = 0;
+};
+
+const std::vector<uint8_t> kConnect = {
+    0x10, 0x1f, 0x00, 0x06, 0x4d, 0x51, 0x49, 0x73,
+    0x64, 0x70, 0x03, 0x02, 0x00, 0x3c, 0x00, 0x11,
+    0x6d, 0x6f, 0x73, 0x71, 0x70, 0x75, 0x62, 0x7c,
+    0x31, 0x35, 0x36, 0x37, 0x35, 0x2d, 0x65, 0x37,
+    0x63};
+
+const std::vector<uint8_t> kPublish = {
+    0x30, 0x14, 0x0, 0xE, 's', 'e', 'n', 's', 'o', 'r', 's', '/',
+    't', 'e', 'm', 'p', '/', '1', '2', '3', '4', '5'};
+
+const std::vector<uint8_t> kSubscribe = {
+    0b10000010, 17, 0x0, 0x1, 0x0, 0xC,
+    's', 'e', 'n', 's', 'o', 'r', 's', '/', 't', 'e', 'm', 'p', 0,
+    0x0, 0x1, '#', 0};
+
+constexpr int kIterations = 100000;
+
+// Parses one packet the way Server::HandleMessage does.
+template<typename ClientConnection>
+bool ParseOne(ClientConnection connection) {
+    auto packet_opt = gnat::Packet<ClientConnection>::ReadNext(std::move(connection));
+    if (!packet_opt) return false;
+    auto& packet = *packet_opt;
+    switch (packet.type()) {
+      case gnat::PacketType::CONNECT:
+        return gnat::proto3::Connect::ReadFrom(&packet).has_value();
+      case gnat::PacketType::PUBLISH: {
+        const auto publish = gnat::proto3::Publish::ReadFrom(&packet, packet.type_flags());
+        if (!publish) return false;
+        uint8_t payload[64];
+        return packet.Read(payload, publish->payload_bytes);
+      }
+      case gnat::PacketType::SUBSCRIBE:
+        return gnat::proto3::Subscribe::ReadFrom(&packet,
+            [](const char*, size_t) { return true; }).has_value();
+      default:
+        return false;
+    }
+}
+
+template<typename Wrap>
+void Run(const char* name, const char* mode, const std::vector<uint8_t>& data, Wrap wrap) {
+    Counters counters;
+    const auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < kIterations; i++) {
+      if (!ParseOne(wrap(CountingConnection(&data, &counters)))) {
+        printf("%s: parse failed\n", name);
+        return;
+      }
+    }
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    const double ns = std::chrono::duration<double, std::nano>(elapsed).count();
+    printf("%-10s %-10s %6.2f reads/packet %8.1f ns/packet\n", name, mode,
+           (double)counters.reads / kIterations, ns / kIterations);
+}
+
+void RunPacket(const char* name, const std::vector<uint8_t>& data) {
+    Run(name, "direct", data, [](CountingConnection c) { return c; });
+    Run(name, "buffered", data, [](CountingConnection c) {
+      return gnat::BufferedConnection<CountingConnection>(std::move(c));
+    });
+}
+
+}  // namespace
+
+int main() {
+    RunPacket("connect", kConnect);
+    RunPacket("publish", kPublish);
+    RunPacket("subscribe", kSubscribe);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include "payload_allocator.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+TEST(SlabAllocatorTest, ReusesFreedSlots) {
+  gnat::SlabAllocator allocator({{16, 2}, {64, 1}});
+  EXPECT_EQ(16 * 2 + 64, allocator.stats().capacity_bytes);
+
+  uint8_t* first = allocator.Allocate(10);
+  ASSERT_NE(nullptr, first);
+  EXPECT_EQ(1, allocator.free_slots(0));
+  allocator.Free(first);
+  EXPECT_EQ(2, allocator.free_slots(0));
+
+  // Same slot comes straight back.
+  EXPECT_EQ(first, allocator.Allocate(16));
+  allocator.Free(first);
+  EXPECT_EQ(0, allocator.stats().used_slots);
+  EXPECT_EQ(1, allocator.stats().peak_slots);
+  EXPECT_EQ(2, allocator.stats().allocations);
+}
+
+TEST(SlabAllocatorTest, Bounded) {
+  gnat::SlabAllocator allocator({{16, 1}, {64, 1}});
+
+  uint8_t* small = allocator.Allocate(8);
+  // The small class is full so this spills into the large one.
+  uint8_t* spilled = allocator.Allocate(8);
+  ASSERT_NE(nullptr, small);
+  ASSERT_NE(nullptr, spilled);
+  EXPECT_EQ(0, allocator.free_slots(1));
+
+  EXPECT_EQ(nullptr, allocator.Allocate(8));
+  EXPECT_EQ(nullptr, allocator.Allocate(65));
+  EXPECT_EQ(2, allocator.stats().failures);
+  EXPECT_EQ(16 + 64, allocator.stats().used_bytes);
+
+  allocator.Free(spilled);
+  EXPECT_EQ(spilled, allocator.Allocate(33));
+  allocator.Free(small);
+  allocator.Free(spilled);
+  EXPECT_EQ(0, allocator.stats().used_bytes);
+}
+
+TEST(SlabAllocatorTest, DataStoreEntries) {
+  gnat::SlabAllocator allocator({{32, 2}});
+  gnat::DataStore<std::string> store(&allocator);
+
+  for (int i = 0; i < 100; i++) {
+    auto entry = store.CreateEntry(20, i);
+    ASSERT_NE(nullptr, entry.data);
+    memset(entry.data.get(), i, entry.length);
+    store.Set("key", std::move(entry));
+  }
+  // Replacing an entry gives its slot back.
+  EXPECT_EQ(1, allocator.stats().used_slots);
+  EXPECT_EQ(99, store.Get("key").data[0]);
+
+  store.Set("other", store.CreateEntry(20, 0));
+  const auto full = store.CreateEntry(20, 0);
+  EXPECT_EQ(nullptr, full.data);
+  EXPECT_EQ(0, full.length);
+}
+
+TEST(SlabAllocatorTest, HeapEntries) {
+  gnat::DataStore<std::string> store;
+  auto entry = store.CreateEntry(20, 0);
+  ASSERT_NE(nullptr, entry.data);
+  EXPECT_EQ(20, entry.length);
+
+  // Plain heap buffers can still be stored.
+  entry.data = std::make_unique<uint8_t[]>(4);
+  store.Set("key", std::move(entry));
+}
@@ -0,0 +1,96 @@
+#include "posix-connection.h"
+
+#include <gtest/gtest.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include <chrono>
+#include <vector>
+
+namespace {
+
+class FakeClock {
+public:
+    uint32_t timestamp() {
+        return 0;
+    }
+};
+
+class PosixConnectionTest : public ::testing::Test {
+protected:
+    void SetUp() override {
+        ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds_));
+    }
+
+    void TearDown() override {
+        close(fds_[0]);
+        close(fds_[1]);
+    }
+
+    int fds_[2];
+};
+
+}  // namespace
+
+TEST_F(PosixConnectionTest, WriteVGathers) {
+    gnat::posix::Connection writer(fds_[0]);
+    gnat::posix::Connection reader(fds_[1]);
+
+    uint8_t header[] = {'a', 'b'};
+    uint8_t payload[] = {'c', 'd', 'e'};
+    const gnat::IoVec buffers[] = {{header, sizeof(header)}, {payload, sizeof(payload)}};
+    ASSERT_TRUE(writer.WriteV(buffers, 2));
+
+    uint8_t read[5];
+    ASSERT_TRUE(reader.Read(read, sizeof(read)));
+    EXPECT_EQ(0, memcmp("abcde", read, sizeof(read)));
+    EXPECT_EQ(0, reader.ReadAvailable(read, sizeof(read)));
+}
+
+TEST_F(PosixConnectionTest, WriteGivesUpOnStalledReader) {
+    ASSERT_EQ(0, fcntl(fds_[0], F_SETFL, fcntl(fds_[0], F_GETFL) | O_NONBLOCK));
+    gnat::posix::Connection writer(fds_[0]);
+    writer.set_wait_timeout_ms(20);
+
+    // Far more than the socket buffers hold, nobody reads the other end.
+    std::vector<uint8_t> data(8 << 20);
+    const auto start = std::chrono::steady_clock::now();
+    EXPECT_FALSE(writer.Write(data.data(), data.size()));
+    EXPECT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+}
+
+TEST_F(PosixConnectionTest, SubscribePublish) {
+    gnat::DataStore<uint64_t> data;
+    FakeClock clock;
+    gnat::Server<gnat::DataStore<uint64_t>, FakeClock> server(&data, &clock);
+
+    constexpr static uint8_t kSubscribeData[] = {
+      0b10000010, 11, 0x0, 0x1, 0x0, 0x6,
+      't', '/', 't', 'e', 's', 't', 0,
+    };
+    constexpr static uint8_t kPublishData[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+
+    gnat::posix::Connection client(fds_[1]);
+    ASSERT_TRUE(client.Write((uint8_t*)kSubscribeData, sizeof(kSubscribeData)));
+    {
+      auto packet = *gnat::Packet<gnat::posix::Connection>::ReadNext(gnat::posix::Connection(fds_[0]));
+      ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(&packet));
+    }
+
+    uint8_t ack[5];
+    ASSERT_TRUE(client.Read(ack, sizeof(ack)));
+    EXPECT_EQ(0b10010000, ack[0]);
+
+    ASSERT_TRUE(client.Write((uint8_t*)kPublishData, sizeof(kPublishData)));
+    {
+      auto packet = *gnat::Packet<gnat::posix::Connection>::ReadNext(gnat::posix::Connection(fds_[0]));
+      ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(&packet));
+    }
+
+    uint8_t forwarded[sizeof(kPublishData)];
+    ASSERT_TRUE(client.Read(forwarded, sizeof(forwarded)));
+    EXPECT_EQ(0, memcmp(kPublishData, forwarded, sizeof(forwarded)));
+}
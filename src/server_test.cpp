@@ -1,6 +1,7 @@
 #include "server.h"
 
 #include <gtest/gtest.h>
+#include <thread>
 #include "key.h"
 #include "datastore.h"
 
@@ -108,6 +109,38 @@ struct BufferConnection {
     gnat::ConnectionType type_ = gnat::ConnectionType::UNKNOWN;
 };
 
+// Counts how publishes are written when the connection can gather buffers.
+struct VectorConnection : public BufferConnection {
+    using BufferConnection::BufferConnection;
+
+    bool WriteV(const gnat::IoVec* buffers, size_t count) {
+      write_v_calls++;
+      for (size_t i = 0; i < count; i++) {
+        if (!Write(const_cast<uint8_t*>(buffers[i].data), buffers[i].size)) return false;
+      }
+      return true;
+    }
+
+    bool WritePartial(uint8_t*, size_t) {
+      ADD_FAILURE() << "WriteV should be used.";
+      return false;
+    }
+
+    int write_v_calls = 0;
+};
+
+// Brings its own scratch space for serializing.
+struct ContextConnection : public BufferConnection {
+    using BufferConnection::BufferConnection;
+
+    gnat::EncodeContext* encode_context() { return &context; }
+
+    gnat::EncodeContext context;
+};
+
+static_assert(gnat::HasWriteV<VectorConnection>::value, "");
+static_assert(!gnat::HasWriteV<BufferConnection>::value, "");
+
 }  // namespace
 
 
@@ -314,3 +347,426 @@ TEST(ServerTest, SubscribePublishHandling) {
     ASSERT_EQ(kPublishData[sizeof(kPublishData) - 1], data_written->buffer[data_written->position-1]);
 }
 
+
+TEST(ServerTest, PublishViewHandling) {
+    constexpr static uint8_t kData[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+
+    FakeClock clock;
+    clock.time = 7;
+    gnat::DataStore<std::string> data;
+    gnat::Server<gnat::DataStore<std::string>, FakeClock> server(&data, &clock);
+
+    BufferConnection connection(nullptr, 0);
+    const auto packet = gnat::PacketView::Parse(kData, sizeof(kData));
+    ASSERT_TRUE(packet.has_value());
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(*packet, &connection));
+
+    const auto& entry = data.Get("t/test");
+    EXPECT_EQ(7, entry.timestamp);
+    EXPECT_EQ("test", std::string((const char*)entry.data.get(), entry.length));
+}
+
+TEST(ServerTest, PublishToWildcardFails) {
+    // Topic "t/#est".
+    constexpr static uint8_t kData[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x23, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+
+    FakeClock clock;
+    gnat::DataStore<std::string> data;
+    gnat::Server<gnat::DataStore<std::string>, FakeClock> server(&data, &clock);
+
+    BufferConnection connection(nullptr, 0);
+    const auto packet = gnat::PacketView::Parse(kData, sizeof(kData));
+    ASSERT_TRUE(packet.has_value());
+    EXPECT_FALSE(server.HandleMessage(*packet, &connection).IsOk());
+    EXPECT_EQ(0u, data.size());
+}
+
+TEST(ServerTest, PublishViewTopicTooLong) {
+    FakeClock clock;
+    gnat::DataStore<std::string> data;
+    gnat::Server<gnat::DataStore<std::string>, FakeClock> server(&data, &clock);
+
+    constexpr static uint8_t kSubscribeData[] = {
+      0b10000010, 6, 0x0, 0x1, 0x0, 0x1, '#', 0,
+    };
+    // A 300 byte topic, more than a Publish holds, and payload "test".
+    const std::string topic(300, 't');
+    std::vector<uint8_t> publish = {0x30, 0, 0, 0x1, 0x2C};
+    const size_t remaining = 2 + topic.size() + 4;
+    publish[1] = 0x80 | (remaining & 0x7F);
+    publish[2] = remaining >> 7;
+    publish.insert(publish.end(), topic.begin(), topic.end());
+    publish.insert(publish.end(), {'t', 'e', 's', 't'});
+
+    std::shared_ptr<Buffer> data_written(new Buffer);
+    BufferConnection connection(nullptr, 0, data_written);
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kSubscribeData, sizeof(kSubscribeData)), &connection));
+    const size_t ack_length = data_written->position;
+
+    const auto packet = gnat::PacketView::Parse(publish.data(), publish.size());
+    ASSERT_TRUE(packet.has_value());
+    EXPECT_FALSE(server.HandleMessage(*packet, &connection).IsOk());
+    EXPECT_EQ(0u, data.size());
+    EXPECT_EQ(ack_length, data_written->position);
+}
+
+TEST(ServerTest, SubscribePublishViewHandling) {
+    FakeClock clock;
+    gnat::DataStore<uint64_t> data;
+    gnat::Server<gnat::DataStore<uint64_t>, FakeClock> server(&data, &clock);
+
+    constexpr static uint8_t kConnectData[] = {
+        0x10, 0x1f, 0x00, 0x06, 0x4d, 0x51, 0x49, 0x73,
+        0x64, 0x70, 0x03, 0x02, 0x00, 0x3c, 0x00, 0x11,
+        0x6d, 0x6f, 0x73, 0x71, 0x70, 0x75, 0x62, 0x7c,
+        0x31, 0x35, 0x36, 0x37, 0x35, 0x2d, 0x65, 0x37,
+        0x63};
+    constexpr static uint8_t kSubscribeData[] = {
+      0b10000010, 11, 0x0, 0x1, 0x0, 0x6,
+      't', '/', 't', 'e', 's', 't', 0,
+    };
+    constexpr static uint8_t kPublishData[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+
+    std::shared_ptr<Buffer> data_written(new Buffer);
+    BufferConnection connection(nullptr, 0, data_written);
+
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kConnectData, sizeof(kConnectData)), &connection));
+    EXPECT_EQ(gnat::ConnectionType::MQTT_31, connection.type_);
+    // Connect ack, not an error.
+    ASSERT_EQ(4, data_written->position);
+    EXPECT_EQ(0, data_written->buffer[3]);
+
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kSubscribeData, sizeof(kSubscribeData)), &connection));
+    ASSERT_EQ(0b10010000, data_written->buffer[4]);
+    const size_t acks_length = 4 + data_written->buffer[5] + 2;
+    ASSERT_EQ(acks_length, data_written->position);
+
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kPublishData, sizeof(kPublishData)), &connection));
+
+    // The publish is forwarded as is.
+    ASSERT_EQ(acks_length + sizeof(kPublishData), data_written->position);
+    EXPECT_EQ(0, memcmp(kPublishData, data_written->buffer + acks_length, sizeof(kPublishData)));
+}
+
+TEST(ServerTest, SubscribeSingleLevelWildcard) {
+    FakeClock clock;
+    gnat::DataStore<std::string> data;
+    gnat::Server<gnat::DataStore<std::string>, FakeClock> server(&data, &clock);
+
+    // Subscribe to "t/+".
+    constexpr static uint8_t kSubscribeData[] = {
+      0b10000010, 8, 0x0, 0x1, 0x0, 0x3, 't', '/', '+', 0,
+    };
+    // Publish "test" to "t/test", then to "t/a/b".
+    constexpr static uint8_t kPublishData[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+    constexpr static uint8_t kPublishDeeperData[] = {
+      0x30, 0xB, 0x0, 0x5, 't', '/', 'a', '/', 'b', 0x74, 0x65, 0x73, 0x74
+    };
+
+    std::shared_ptr<Buffer> data_written(new Buffer);
+    BufferConnection connection(nullptr, 0, data_written);
+
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kSubscribeData, sizeof(kSubscribeData)), &connection));
+    // Suback with one granted topic.
+    ASSERT_EQ(5, data_written->position);
+    EXPECT_EQ(0b10010000, data_written->buffer[0]);
+    EXPECT_EQ(0, data_written->buffer[4]);
+
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kPublishData, sizeof(kPublishData)), &connection));
+    ASSERT_EQ(5 + sizeof(kPublishData), data_written->position);
+    EXPECT_EQ(0, memcmp(kPublishData, data_written->buffer + 5, sizeof(kPublishData)));
+
+    // One level too deep for '+'.
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kPublishDeeperData, sizeof(kPublishDeeperData)), &connection));
+    EXPECT_EQ(5 + sizeof(kPublishData), data_written->position);
+}
+
+TEST(ServerTest, SubscribeWildcardBeforeKeyCut) {
+    FakeClock clock;
+    gnat::DataStore<uint64_t> data;
+    gnat::Server<gnat::DataStore<uint64_t>, FakeClock> server(&data, &clock);
+
+    // "sensors/+/t", uint64_t keys only keep "sensors/", then "t/test".
+    constexpr static uint8_t kSubscribeData[] = {
+      0b10000010, 25, 0x0, 0x1,
+      0x0, 0xB, 's', 'e', 'n', 's', 'o', 'r', 's', '/', '+', '/', 't', 0,
+      0x0, 0x6, 't', '/', 't', 'e', 's', 't', 0,
+    };
+    // Publish "test" to "t/test".
+    constexpr static uint8_t kPublishData[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+
+    std::shared_ptr<Buffer> data_written(new Buffer);
+    BufferConnection connection(nullptr, 0, data_written);
+
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kSubscribeData, sizeof(kSubscribeData)), &connection));
+    // Only the first filter is refused.
+    ASSERT_EQ(6, data_written->position);
+    EXPECT_EQ(0b10010000, data_written->buffer[0]);
+    EXPECT_EQ(4, data_written->buffer[1]);
+    EXPECT_EQ(0x80, data_written->buffer[4]);
+    EXPECT_EQ(0, data_written->buffer[5]);
+
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kPublishData, sizeof(kPublishData)), &connection));
+    ASSERT_EQ(6 + sizeof(kPublishData), data_written->position);
+    EXPECT_EQ(0, memcmp(kPublishData, data_written->buffer + 6, sizeof(kPublishData)));
+}
+
+TEST(ServerTest, PublishIntoSlabAllocator) {
+    FakeClock clock;
+    gnat::SlabAllocator allocator({{16, 2}});
+    gnat::DataStore<uint64_t> data(&allocator);
+    gnat::Server<gnat::DataStore<uint64_t>, FakeClock> server(&data, &clock);
+
+    constexpr static uint8_t kPublishData[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+    constexpr static uint8_t kPublishAData[] = {
+      0x30, 0x7, 0x0, 0x1, 'a', 0x74, 0x65, 0x73, 0x74
+    };
+    constexpr static uint8_t kPublishBData[] = {
+      0x30, 0x7, 0x0, 0x1, 'b', 0x74, 0x65, 0x73, 0x74
+    };
+
+    BufferConnection connection(nullptr, 0);
+    for (int i = 0; i < 10; i++) {
+      ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+          *gnat::PacketView::Parse(kPublishData, sizeof(kPublishData)), &connection));
+    }
+    // Updates are written over the stored value.
+    EXPECT_EQ(1, allocator.stats().used_slots);
+    EXPECT_EQ(1, allocator.stats().allocations);
+    EXPECT_EQ(0, allocator.stats().failures);
+
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kPublishAData, sizeof(kPublishAData)), &connection));
+    EXPECT_EQ(2, allocator.stats().used_slots);
+
+    // No room left, the publish is dropped but the client is kept.
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+        *gnat::PacketView::Parse(kPublishBData, sizeof(kPublishBData)), &connection));
+    EXPECT_EQ(1, allocator.stats().failures);
+    EXPECT_THROW(data.Get(gnat::key::Encode("b")), std::out_of_range);
+
+    // Same through the streaming parser, which skips the payload.
+    gnat::Server<gnat::DataStore<uint64_t>, FakeClock>::StreamState state;
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleAvailable(
+        kPublishBData, sizeof(kPublishBData), &connection, &state));
+    EXPECT_EQ(2, allocator.stats().failures);
+    ASSERT_EQ(gnat::Status::Ok(), server.HandleAvailable(
+        kPublishAData, sizeof(kPublishAData), &connection, &state));
+    EXPECT_EQ(3, allocator.stats().failures);
+    EXPECT_EQ(2, allocator.stats().used_slots);
+}
+
+TEST(ServerTest, HandleMessagesBatch) {
+    FakeClock clock;
+    gnat::DataStore<std::string> data;
+    gnat::Server<gnat::DataStore<std::string>, FakeClock> server(&data, &clock);
+
+    // Three publishes and a ping back to back.
+    constexpr static uint8_t kData[] = {
+      0x30, 0x5, 0x0, 0x1, 'a', '1', '1',
+      0x30, 0x5, 0x0, 0x1, 'b', '2', '2',
+      0x30, 0x5, 0x0, 0x1, 'a', '3', '3',
+      0xC0, 0x0,
+    };
+
+    // Split the burst at every offset, the result should be the same.
+    for (size_t split = 0; split <= sizeof(kData); split++) {
+      std::shared_ptr<Buffer> data_written(new Buffer);
+      BufferConnection connection(nullptr, 0, data_written);
+      gnat::PacketCarry<16> carry;
+
+      ASSERT_EQ(gnat::Status::Ok(), server.HandleMessages(kData, split, &connection, &carry));
+      ASSERT_EQ(gnat::Status::Ok(),
+                server.HandleMessages(kData + split, sizeof(kData) - split, &connection, &carry));
+      EXPECT_TRUE(carry.empty());
+
+      const auto& a = data.Get("a");
+      EXPECT_EQ("33", std::string((const char*)a.data.get(), a.length)) << split;
+      const auto& b = data.Get("b");
+      EXPECT_EQ("22", std::string((const char*)b.data.get(), b.length)) << split;
+
+      // Ping response.
+      ASSERT_EQ(2, data_written->position);
+      EXPECT_EQ(0xD0, data_written->buffer[0]);
+    }
+}
+
+TEST(ServerTest, HandleMessagesCarryTooSmall) {
+    FakeClock clock;
+    gnat::DataStore<std::string> data;
+    gnat::Server<gnat::DataStore<std::string>, FakeClock> server(&data, &clock);
+
+    constexpr static uint8_t kData[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+
+    BufferConnection connection(nullptr, 0);
+    gnat::PacketCarry<8> carry;
+    EXPECT_FALSE(server.HandleMessages(kData, 10, &connection, &carry).IsOk());
+    EXPECT_TRUE(carry.empty());
+}
+
+TEST(ServerTest, HandleAvailableByteAtATime) {
+    FakeClock clock;
+    gnat::DataStore<uint64_t> data;
+    using Server = gnat::Server<gnat::DataStore<uint64_t>, FakeClock>;
+    Server server(&data, &clock);
+
+    constexpr static uint8_t kData[] = {
+      // Subscribe.
+      0b10000010, 11, 0x0, 0x1, 0x0, 0x6, 't', '/', 't', 'e', 's', 't', 0,
+      // Publish.
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73, 0x74, 0x74, 0x65, 0x73, 0x74,
+      // Ping.
+      0xC0, 0x0,
+    };
+
+    std::shared_ptr<Buffer> data_written(new Buffer);
+    BufferConnection connection(nullptr, 0, data_written);
+    Server::StreamState state;
+    for (size_t i = 0; i < sizeof(kData); i++) {
+      ASSERT_EQ(gnat::Status::Ok(), server.HandleAvailable(kData + i, 1, &connection, &state));
+    }
+
+    // Subscribe ack, the publish forwarded back to us and the ping response.
+    ASSERT_EQ(5 + 14 + 2, data_written->position);
+    EXPECT_EQ(0b10010000, data_written->buffer[0]);
+    EXPECT_EQ(0, memcmp(kData + 13, data_written->buffer + 5, 14));
+    EXPECT_EQ(0xD0, data_written->buffer[19]);
+
+    const auto& entry = data.Get(gnat::key::Encode("t/test"));
+    EXPECT_EQ("test", std::string((const char*)entry.data.get(), entry.length));
+}
+
+TEST(ServerTest, PublishSendOnUsesWriteV) {
+    std::shared_ptr<Buffer> data_written(new Buffer);
+    VectorConnection connection(nullptr, 0, data_written);
+
+    gnat::proto3::Publish publish;
+    memcpy(publish.topic.data, "t/test", 6);
+    publish.topic.length = 6;
+    publish.payload_bytes = 4;
+    uint8_t payload[] = {'t', 'e', 's', 't'};
+    ASSERT_TRUE(publish.SendOn(&connection, payload));
+
+    EXPECT_EQ(1, connection.write_v_calls);
+    constexpr static uint8_t kExpected[] = {
+      0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+      0x74, 0x74, 0x65, 0x73, 0x74
+    };
+    ASSERT_EQ(sizeof(kExpected), data_written->position);
+    EXPECT_EQ(0, memcmp(kExpected, data_written->buffer, sizeof(kExpected)));
+}
+
+TEST(ServerTest, PublishFanOutSharesHeader) {
+    FakeClock clock;
+    gnat::DataStore<std::string> data;
+    gnat::Server<gnat::DataStore<std::string>, FakeClock> server(&data, &clock);
+
+    constexpr static uint8_t kSubscribeData[] = {
+      0b10000010, 6, 0x0, 0x1, 0x0, 0x1, '#', 0,
+    };
+
+    std::vector<std::shared_ptr<Buffer>> subscribers;
+    for (int i = 0; i < 3; i++) {
+      subscribers.emplace_back(new Buffer);
+      BufferConnection connection(nullptr, 0, subscribers.back());
+      ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+          *gnat::PacketView::Parse(kSubscribeData, sizeof(kSubscribeData)), &connection));
+      subscribers.back()->position = 0;
+    }
+
+    // The header changes with the topic and the payload size.
+    const std::vector<std::vector<uint8_t>> publishes = {
+      {0x30, 0x5, 0x0, 0x1, 'a', '1', '1'},
+      {0x30, 0x6, 0x0, 0x1, 'a', '2', '2', '2'},
+      {0x30, 0x6, 0x0, 0x1, 'a', '3', '3', '3'},
+      {0x30, 0x6, 0x0, 0x1, 'b', '4', '4', '4'},
+    };
+    std::vector<uint8_t> expected;
+    for (const auto& publish : publishes) {
+      BufferConnection connection(nullptr, 0);
+      ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+          *gnat::PacketView::Parse(publish.data(), publish.size()), &connection));
+      expected.insert(expected.end(), publish.begin(), publish.end());
+    }
+
+    for (const auto& subscriber : subscribers) {
+      ASSERT_EQ(expected.size(), subscriber->position);
+      EXPECT_EQ(0, memcmp(expected.data(), subscriber->buffer, expected.size()));
+    }
+}
+
+TEST(ServerTest, SendUsesConnectionEncodeContext) {
+    std::shared_ptr<Buffer> data_written(new Buffer);
+    ContextConnection connection(nullptr, 0, data_written);
+    memset(connection.context.buffer, 0xFF, sizeof(connection.context.buffer));
+
+    gnat::proto3::ConnectAck ack;
+    ASSERT_TRUE(ack.SendOn(&connection));
+    ASSERT_EQ(4, data_written->position);
+    EXPECT_EQ(0, memcmp(data_written->buffer, connection.context.buffer, 4));
+}
+
+TEST(ServerTest, ConcurrentSends) {
+    constexpr int kThreads = 4;
+    constexpr int kPublishes = 200;
+
+    std::vector<std::thread> threads;
+    std::vector<std::string> failures(kThreads);
+    for (int t = 0; t < kThreads; t++) {
+      threads.emplace_back([t, &failures]() {
+        for (int i = 0; i < kPublishes; i++) {
+          std::shared_ptr<Buffer> data_written(new Buffer);
+          BufferConnection connection(nullptr, 0, data_written);
+
+          gnat::proto3::Publish publish;
+          publish.topic.length = snprintf(publish.topic.data, 128, "thread/%d/%d", t, i);
+          uint8_t payload[] = {(uint8_t)t};
+          publish.payload_bytes = 1;
+          if (!publish.SendOn(&connection, payload)) {
+            failures[t] = "send failed";
+            return;
+          }
+
+          const std::string topic((const char*)data_written->buffer + 4,
+                                  data_written->buffer[3]);
+          if (topic != std::string(publish.topic.data, publish.topic.length) ||
+              data_written->buffer[data_written->position - 1] != t) {
+            failures[t] = "corrupt publish: " + topic;
+            return;
+          }
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    for (const auto& failure : failures) EXPECT_EQ("", failure);
+}
@@ -0,0 +1,89 @@
+// Publish throughput from 1 to 16 threads, with a plain DataStore behind one
+// mutex as the server needed before and with ShardedDataStore. Each thread
+// updates its own topics and has a client watching them.
+
+#include <chrono>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "sharded_datastore.h"
+
+namespace {
+
+constexpr int kTopicsPerThread = 256;
+constexpr int kUpdatesPerThread = 200000;
+
+// DataStore with every call under one lock.
+class LockedDataStore {
+public:
+    bool AddObserver(gnat::DataStore<uint64_t>::ObserverEntry observer,
+                     const char* filter, size_t length) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return data_.AddObserver(std::move(observer), filter, length);
+    }
+
+    template<typename Fill>
+    bool Update(uint64_t key, uint32_t length, uint32_t timestamp, Fill&& fill) {
+      std::lock_guard<std::mutex> lock(mutex_);
+      return data_.Update(key, length, timestamp, fill);
+    }
+
+private:
+    std::mutex mutex_;
+    gnat::DataStore<uint64_t> data_;
+};
+
+// Topics like "3/0a1", a thread's topics share a prefix its client watches.
+uint64_t Key(int thread, int topic) {
+    char name[8];
+    const int length = snprintf(name, sizeof(name), "%x/%x", thread, topic);
+    return gnat::key::EncodeString(name, length);
+}
+
+template<typename Store>
+void Run(const char* name, int thread_count) {
+    Store store;
+    std::vector<uint64_t> delivered(thread_count * 8);
+    for (int t = 0; t < thread_count; t++) {
+      char filter[8];
+      const int length = snprintf(filter, sizeof(filter), "%x/#", t);
+      uint64_t* count = &delivered[t * 8];
+      store.AddObserver({(uint32_t)t, [count](uint64_t, const gnat::DataStoreEntry&) {
+        (*count)++;
+        return true;
+      }}, filter, length);
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thread_count; t++) {
+      threads.emplace_back([&store, t]() {
+        for (int i = 0; i < kUpdatesPerThread; i++) {
+          store.Update(Key(t, i % kTopicsPerThread), 8, i, [](uint8_t* data) {
+            memset(data, 1, 8);
+            return true;
+          });
+        }
+      });
+    }
+    for (auto& thread : threads) thread.join();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    const double updates = (double)thread_count * kUpdatesPerThread;
+    printf("%-8s %2d threads %8.2f M publishes/s%s\n", name, thread_count,
+           updates / seconds / 1e6, delivered[0] == 0 ? " (nothing delivered)" : "");
+}
+
+}  // namespace
+
+int main() {
+    for (const int threads : {1, 2, 4, 8, 16}) {
+      Run<LockedDataStore>("locked", threads);
+      Run<gnat::ShardedDataStore<uint64_t, 64>>("sharded", threads);
+    }
+    return 0;
+}
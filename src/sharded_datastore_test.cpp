@@ -0,0 +1,215 @@
+#include "sharded_datastore.h"
+#include "server.h"
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+using Store = gnat::ShardedDataStore<std::string, 4>;
+
+gnat::DataStoreEntry ToEntry(const std::string& value) {
+  gnat::DataStoreEntry out;
+  out.length = value.size();
+  out.data = std::make_unique<uint8_t[]>(out.length);
+  memcpy(out.data.get(), value.data(), out.length);
+  return out;
+}
+
+std::string Value(const gnat::DataStoreEntry& entry) {
+  return std::string((const char*)entry.data.get(), entry.length);
+}
+
+// Accepts every write.
+struct NullConnection {
+  bool Read(uint8_t*, size_t) { return false; }
+  bool Write(uint8_t*, size_t) { return true; }
+  bool WritePartial(uint8_t*, size_t) { return true; }
+  bool Drain(size_t) { return true; }
+  void Close() {}
+  uint32_t id() { return 0; }
+  NullConnection CreateHeapCopy() { return *this; }
+  gnat::ConnectionType connection_type() { return gnat::ConnectionType::UNKNOWN; }
+  void set_connection_type(gnat::ConnectionType) {}
+};
+
+}  // namespace
+
+TEST(ShardedDataStoreTest, SetRead) {
+  Store store;
+  for (int i = 0; i < 100; i++) {
+    ASSERT_TRUE(store.Set("topic/" + std::to_string(i), ToEntry(std::to_string(i))));
+  }
+  EXPECT_EQ(100, store.size());
+
+  std::string value;
+  EXPECT_TRUE(store.Read("topic/42", [&value](const gnat::DataStoreEntry& entry) {
+    value = Value(entry);
+  }));
+  EXPECT_EQ("42", value);
+  EXPECT_FALSE(store.Read("missing", [](const gnat::DataStoreEntry&) {}));
+
+  int prefixed = 0;
+  store.ForEachPrefix("topic/1", 7, [&prefixed](const std::string&, const gnat::DataStoreEntry&) {
+    prefixed++;
+  });
+  // 1, 10-19 and 100 is past the end.
+  EXPECT_EQ(11, prefixed);
+}
+
+TEST(ShardedDataStoreTest, Observers) {
+  Store store;
+  store.Set("a/old", ToEntry("0"));
+
+  std::vector<std::string> exact, wildcard;
+  auto observer = [](uint32_t client_id, std::vector<std::string>* out) {
+    return Store::ObserverEntry{client_id,
+        [out](const std::string& key, const gnat::DataStoreEntry&) {
+          out->push_back(key);
+          return true;
+        }};
+  };
+  ASSERT_TRUE(store.AddObserver(observer(1, &exact), "a/1", 3));
+  ASSERT_TRUE(store.AddObserver(observer(2, &wildcard), "a/#", 3));
+  ASSERT_FALSE(store.AddObserver(observer(2, &wildcard), "a/#/b", 5));
+
+  for (int i = 0; i < 20; i++) {
+    store.Set("a/" + std::to_string(i), ToEntry("1"));
+    store.Set("b/" + std::to_string(i), ToEntry("1"));
+  }
+  EXPECT_EQ(std::vector<std::string>({"a/1"}), exact);
+  // The replayed value and every a/ topic.
+  EXPECT_EQ(21, wildcard.size());
+
+  store.RemoveObserversForClient(2);
+  store.Set("a/1", ToEntry("2"));
+  EXPECT_EQ(2, exact.size());
+  EXPECT_EQ(21, wildcard.size());
+}
+
+TEST(ShardedDataStoreTest, ConcurrentPublishes) {
+  Store store;
+  constexpr int kThreads = 8;
+  constexpr int kTopics = 50;
+  constexpr int kRounds = 100;
+
+  // One client watching everything must never see two deliveries at once.
+  std::atomic<int> in_observer(0);
+  std::atomic<bool> overlapped(false);
+  int delivered = 0;
+  store.AddObserver({1, [&](const std::string&, const gnat::DataStoreEntry&) {
+    if (in_observer.fetch_add(1) != 0) overlapped = true;
+    delivered++;
+    in_observer.fetch_sub(1);
+    return true;
+  }});
+
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&store, t]() {
+      for (int round = 0; round < kRounds; round++) {
+        for (int topic = 0; topic < kTopics; topic++) {
+          const std::string key = std::to_string(t) + "/" + std::to_string(topic);
+          store.Update(key, 4, round, [](uint8_t* data) {
+            memcpy(data, "test", 4);
+            return true;
+          });
+        }
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_FALSE(overlapped);
+  EXPECT_EQ(kThreads * kTopics * kRounds, delivered);
+  EXPECT_EQ(kThreads * kTopics, store.size());
+}
+
+TEST(ShardedDataStoreTest, UpdateFillsWithoutLock) {
+  Store store;
+  // A fill stalled on a slow client doesn't hold up the shard.
+  bool other_set = false;
+  EXPECT_TRUE(store.Update("a", 4, 0, [&](uint8_t* data) {
+    auto set = std::async(std::launch::async, [&store]() {
+      return store.Set("a", ToEntry("other"));
+    });
+    other_set = set.wait_for(std::chrono::seconds(5)) == std::future_status::ready && set.get();
+    memcpy(data, "test", 4);
+    return true;
+  }));
+  EXPECT_TRUE(other_set);
+  EXPECT_TRUE(store.Read("a", [](const gnat::DataStoreEntry& entry) {
+    EXPECT_EQ("test", std::string((const char*)entry.data.get(), entry.length));
+  }));
+
+  EXPECT_FALSE(store.Update("a", 4, 0, [](uint8_t*) { return false; }));
+}
+
+TEST(ShardedDataStoreTest, SnapshotsWhilePublishing) {
+  Store store;
+  store.EnableSnapshots();
+  EXPECT_EQ(nullptr, store.Snapshot("a"));
+
+  constexpr int kValues = 5000;
+  std::atomic<bool> done(false);
+  std::thread writer([&]() {
+    for (int i = 0; i < kValues; i++) {
+      // Every value is its own index repeated, so a torn read shows.
+      const std::string value(1 + i % 64, 'a' + i % 26);
+      store.Set(i % 2 ? "a" : "b", ToEntry(value));
+    }
+    done = true;
+  });
+
+  std::vector<std::thread> readers;
+  std::atomic<int> torn(0);
+  for (int r = 0; r < 4; r++) {
+    readers.emplace_back([&, r]() {
+      while (!done) {
+        const auto snapshot = store.Snapshot(r % 2 ? "a" : "b");
+        if (!snapshot) continue;
+        for (uint32_t i = 0; i < snapshot->length; i++) {
+          if (snapshot->data[i] != snapshot->data[0]) torn++;
+        }
+      }
+    });
+  }
+  writer.join();
+  for (auto& reader : readers) reader.join();
+
+  EXPECT_EQ(0, torn);
+  const auto last = store.Snapshot("a");
+  ASSERT_NE(nullptr, last);
+  std::string current;
+  store.Read("a", [&current](const gnat::DataStoreEntry& entry) { current = Value(entry); });
+  EXPECT_EQ(current, std::string((const char*)last->data.get(), last->length));
+}
+
+TEST(ShardedDataStoreTest, Server) {
+  struct FakeClock {
+    uint32_t timestamp() { return 7; }
+  };
+  FakeClock clock;
+  gnat::ShardedDataStore<uint64_t> data;
+  gnat::Server<gnat::ShardedDataStore<uint64_t>, FakeClock> server(&data, &clock);
+
+  constexpr static uint8_t kPublishData[] = {
+    0x30, 0xC, 0x0, 0x6, 0x74, 0x2F, 0x74, 0x65, 0x73,
+    0x74, 0x74, 0x65, 0x73, 0x74
+  };
+  NullConnection connection;
+  ASSERT_EQ(gnat::Status::Ok(), server.HandleMessage(
+      *gnat::PacketView::Parse(kPublishData, sizeof(kPublishData)), &connection));
+
+  uint32_t timestamp = 0;
+  EXPECT_TRUE(data.Read(gnat::key::Encode("t/test"), [&](const gnat::DataStoreEntry& entry) {
+    timestamp = entry.timestamp;
+  }));
+  EXPECT_EQ(7, timestamp);
+}
@@ -0,0 +1,73 @@
+// Time to warm restart a DataStore<std::string> from a mapped snapshot
+// compared with loading every value back in, at a few key counts.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+
+#include "datastore.h"
+#include "snapshot_file.h"
+
+namespace {
+
+constexpr char kPath[] = "/tmp/gnat_snapshot_benchmark";
+
+template<typename Run>
+double Microseconds(Run run) {
+    const auto start = std::chrono::steady_clock::now();
+    run();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+std::string Topic(size_t i) {
+    return "sensors/" + std::to_string(i) + "/value";
+}
+
+void Run(size_t count) {
+    {
+      gnat::DataStore<std::string> store;
+      for (size_t i = 0; i < count; i++) {
+        store.Update(Topic(i), 32, 0, [](uint8_t* data) {
+          memset(data, 1, 32);
+          return true;
+        });
+      }
+      if (!gnat::MappedSnapshot::Save(kPath, &store)) {
+        printf("Couldn't write %s\n", kPath);
+        return;
+      }
+    }
+
+    std::unique_ptr<gnat::MappedSnapshot> snapshot;
+    gnat::DataStore<std::string> warm;
+    const double open = Microseconds([&] {
+      snapshot = gnat::MappedSnapshot::Open(kPath);
+      warm.set_warm_start(snapshot->view());
+    });
+    const std::string middle = Topic(count / 2);
+    size_t length = 0;
+    const double first = Microseconds([&] { length += warm.Get(middle).length; });
+
+    gnat::DataStore<std::string> cold;
+    const double load = Microseconds([&] {
+      snapshot->view()->ForEach([&cold](const gnat::SnapshotEntry& entry) {
+        auto copy = cold.CreateEntry(entry.length, entry.timestamp);
+        memcpy(copy.data.get(), entry.data, entry.length);
+        cold.Set(std::string(entry.topic, entry.topic_length), std::move(copy));
+      });
+    });
+
+    printf("%8zu keys  open %9.1f us  first lookup %6.1f us  full load %11.1f us%s\n",
+           count, open, first, load, length == 0 ? " (empty)" : "");
+}
+
+}  // namespace
+
+int main() {
+    for (const size_t count : {1000, 100000, 1000000}) {
+      Run(count);
+    }
+    remove(kPath);
+    return 0;
+}
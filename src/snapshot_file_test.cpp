@@ -0,0 +1,232 @@
+#include "snapshot_file.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+template<typename DataStore>
+void Put(DataStore* store, const std::string& topic, const std::string& value,
+         uint32_t timestamp = 0) {
+  auto entry = store->CreateEntry(value.size(), timestamp);
+  memcpy(entry.data.get(), value.data(), value.size());
+  store->Set(store->EncodeKey(topic.data(), topic.size()), std::move(entry));
+}
+
+std::string Value(const gnat::DataStoreEntry& entry) {
+  return std::string(reinterpret_cast<const char*>(entry.data.get()), entry.length);
+}
+
+template<typename DataStore>
+std::vector<uint8_t> Snapshot(DataStore* store) {
+  std::vector<uint8_t> out;
+  EXPECT_TRUE(gnat::WriteSnapshot(store, [&out](const uint8_t* data, size_t size) {
+    out.insert(out.end(), data, data + size);
+    return true;
+  }));
+  return out;
+}
+
+class MappedSnapshotTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "gnat_snapshot_test";
+  }
+  void TearDown() override {
+    remove(path_.c_str());
+  }
+
+  std::string path_;
+};
+
+}  // namespace
+
+TEST(SnapshotViewTest, FindsEveryValue) {
+  gnat::DataStore<std::string> store;
+  for (int i = 0; i < 100; i++) {
+    Put(&store, "a/" + std::to_string(i), "value" + std::to_string(i), i);
+  }
+  const auto bytes = Snapshot(&store);
+  const auto view = gnat::SnapshotView::Open(bytes.data(), bytes.size());
+  ASSERT_NE(nullptr, view);
+  EXPECT_EQ(100u, view->size());
+
+  for (int i = 0; i < 100; i++) {
+    const std::string topic = "a/" + std::to_string(i);
+    gnat::SnapshotEntry entry;
+    ASSERT_TRUE(view->Find(topic.data(), topic.size(), &entry));
+    EXPECT_EQ("value" + std::to_string(i),
+              std::string(reinterpret_cast<const char*>(entry.data), entry.length));
+    EXPECT_EQ((uint32_t)i, entry.timestamp);
+  }
+  gnat::SnapshotEntry entry;
+  EXPECT_FALSE(view->Find("a/100", 5, &entry));
+
+  size_t visited = 0;
+  view->ForEach([&visited](const gnat::SnapshotEntry&) { visited++; });
+  EXPECT_EQ(100u, visited);
+}
+
+TEST(SnapshotViewTest, RejectsBadSnapshots) {
+  gnat::DataStore<std::string> store;
+  Put(&store, "a/b", "value");
+  auto bytes = Snapshot(&store);
+
+  EXPECT_EQ(nullptr, gnat::SnapshotView::Open(bytes.data(), 4));
+  // Index cut off.
+  EXPECT_EQ(nullptr, gnat::SnapshotView::Open(bytes.data(), bytes.size() - 8));
+
+  auto bad_magic = bytes;
+  bad_magic[0] = 'X';
+  EXPECT_EQ(nullptr, gnat::SnapshotView::Open(bad_magic.data(), bad_magic.size()));
+
+  // A record claiming to run into the index is never returned.
+  auto bad_record = bytes;
+  gnat::SnapshotRecord record;
+  memcpy(&record, bad_record.data() + sizeof(gnat::SnapshotHeader), sizeof(record));
+  record.length = 1 << 20;
+  memcpy(bad_record.data() + sizeof(gnat::SnapshotHeader), &record, sizeof(record));
+  const auto view = gnat::SnapshotView::Open(bad_record.data(), bad_record.size());
+  ASSERT_NE(nullptr, view);
+  gnat::SnapshotEntry entry;
+  EXPECT_FALSE(view->Find("a/b", 3, &entry));
+  size_t visited = 0;
+  view->ForEach([&visited](const gnat::SnapshotEntry&) { visited++; });
+  EXPECT_EQ(0u, visited);
+}
+
+TEST(SnapshotViewTest, PackedKeys) {
+  gnat::DataStore<uint64_t> store;
+  Put(&store, "abc", "1");
+  Put(&store, "12345678", "2");
+  const auto bytes = Snapshot(&store);
+
+  gnat::DataStore<uint64_t> restored;
+  const auto view = gnat::SnapshotView::Open(bytes.data(), bytes.size());
+  ASSERT_NE(nullptr, view);
+  restored.set_warm_start(view.get());
+  EXPECT_EQ("1", Value(restored.Get(restored.EncodeKey("abc", 3))));
+  EXPECT_EQ("2", Value(restored.Get(restored.EncodeKey("12345678", 8))));
+}
+
+TEST_F(MappedSnapshotTest, WarmStart) {
+  {
+    gnat::DataStore<std::string> store;
+    Put(&store, "a/b", "one", 1);
+    Put(&store, "a/c", "two", 2);
+    Put(&store, "b", "three", 3);
+    ASSERT_TRUE(gnat::MappedSnapshot::Save(path_.c_str(), &store));
+  }
+
+  const auto snapshot = gnat::MappedSnapshot::Open(path_.c_str());
+  ASSERT_NE(nullptr, snapshot);
+  gnat::DataStore<std::string> store;
+  store.set_warm_start(snapshot->view());
+
+  // Nothing is loaded until it is asked for.
+  EXPECT_EQ(0u, store.size());
+  EXPECT_EQ("one", Value(store.Get("a/b")));
+  EXPECT_EQ(1u, store.Get("a/b").timestamp);
+  EXPECT_EQ(1u, store.size());
+  EXPECT_EQ(nullptr, store.Find("missing"));
+  EXPECT_THROW(store.Get("missing"), std::out_of_range);
+
+  // New observers see values from the snapshot, once each.
+  std::vector<std::string> seen;
+  store.AddObserver({1, [&seen](const std::string& key, const gnat::DataStoreEntry& entry) {
+    seen.push_back(key + "=" + Value(entry));
+    return true;
+  }}, "a/#", 3);
+  std::sort(seen.begin(), seen.end());
+  EXPECT_EQ((std::vector<std::string>{"a/b=one", "a/c=two"}), seen);
+
+  // Setting a value replaces the snapshot's, updating writes a new buffer.
+  Put(&store, "a/c", "changed");
+  EXPECT_EQ("changed", Value(store.Get("a/c")));
+  EXPECT_TRUE(store.Update("b", 2, 4, [](uint8_t* data) {
+    memcpy(data, "up", 2);
+    return true;
+  }));
+  EXPECT_EQ("up", Value(store.Get("b")));
+
+  size_t visited = 0;
+  store.ForEachPrefix("a/", 2, [&visited](const std::string&, const gnat::DataStoreEntry&) {
+    visited++;
+  });
+  EXPECT_EQ(2u, visited);
+}
+
+TEST_F(MappedSnapshotTest, RemovedValuesStayRemoved) {
+  {
+    gnat::DataStore<std::string> store;
+    Put(&store, "a", "1");
+    Put(&store, "b", "2");
+    ASSERT_TRUE(gnat::MappedSnapshot::Save(path_.c_str(), &store));
+  }
+  const auto snapshot = gnat::MappedSnapshot::Open(path_.c_str());
+  ASSERT_NE(nullptr, snapshot);
+
+  gnat::DataStore<std::string, gnat::UnorderedStorage<std::string, gnat::DataStoreEntry>,
+                  gnat::LruEviction<std::string>> store;
+  store.set_warm_start(snapshot->view());
+  store.set_limits({.max_bytes = SIZE_MAX, .max_entries = 1});
+  ASSERT_NE(nullptr, store.Find("a"));
+  // Evicts "a", which mustn't come back from the snapshot.
+  Put(&store, "c", "3");
+  EXPECT_EQ(nullptr, store.Find("a"));
+
+  std::vector<std::string> visited;
+  store.ForEachPrefix("", 0, [&visited](const std::string& key, const gnat::DataStoreEntry&) {
+    visited.push_back(key);
+  });
+  std::sort(visited.begin(), visited.end());
+  EXPECT_EQ((std::vector<std::string>{"b", "c"}), visited);
+
+  // Until it is set again.
+  Put(&store, "a", "4");
+  EXPECT_EQ("4", Value(store.Get("a")));
+}
+
+TEST_F(MappedSnapshotTest, WarmValuesKeepLimits) {
+  {
+    gnat::DataStore<std::string> store;
+    Put(&store, "a", "1");
+    Put(&store, "b", "2");
+    Put(&store, "c", "333");
+    ASSERT_TRUE(gnat::MappedSnapshot::Save(path_.c_str(), &store));
+  }
+  const auto snapshot = gnat::MappedSnapshot::Open(path_.c_str());
+  ASSERT_NE(nullptr, snapshot);
+
+  gnat::DataStore<std::string, gnat::UnorderedStorage<std::string, gnat::DataStoreEntry>,
+                  gnat::LruEviction<std::string>> store;
+  store.set_warm_start(snapshot->view());
+  store.set_limits({.max_bytes = 2, .max_entries = SIZE_MAX});
+
+  ASSERT_NE(nullptr, store.Find("a"));
+  ASSERT_NE(nullptr, store.Find("b"));
+  EXPECT_EQ(2u, store.retention_stats().bytes);
+  // Finding "b" again loads nothing, a third value evicts "a".
+  ASSERT_NE(nullptr, store.Find("b"));
+  Put(&store, "d", "4");
+  EXPECT_EQ(2u, store.size());
+  EXPECT_EQ(1u, store.retention_stats().evicted_entries);
+  EXPECT_EQ(nullptr, store.Find("a"));
+
+  // Too big to ever fit.
+  EXPECT_EQ(nullptr, store.Find("c"));
+  EXPECT_LE(store.retention_stats().bytes, 2u);
+}
+
+TEST_F(MappedSnapshotTest, MissingFile) {
+  EXPECT_EQ(nullptr, gnat::MappedSnapshot::Open(path_.c_str()));
+  FILE* file = fopen(path_.c_str(), "wb");
+  fputs("not a snapshot", file);
+  fclose(file);
+  EXPECT_EQ(nullptr, gnat::MappedSnapshot::Open(path_.c_str()));
+}
@@ -0,0 +1,90 @@
+#include "storage.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+template<typename Storage>
+class StorageTest : public ::testing::Test {};
+
+using Storages = ::testing::Types<
+    gnat::UnorderedStorage<std::string, gnat::DataStoreEntry>,
+    gnat::FlatStorage<std::string, gnat::DataStoreEntry>,
+    gnat::OrderedStorage<std::string, gnat::DataStoreEntry>,
+    gnat::StaticArrayStorage<std::string, gnat::DataStoreEntry, 8>>;
+TYPED_TEST_SUITE(StorageTest, Storages);
+
+gnat::DataStoreEntry Entry(uint32_t timestamp) {
+  return gnat::DataStoreEntry(timestamp);
+}
+
+}  // namespace
+
+TYPED_TEST(StorageTest, DataStore) {
+  gnat::DataStore<std::string, TypeParam> store;
+  std::vector<std::string> notified;
+  store.AddObserver({0, [&notified](const std::string& key, const gnat::DataStoreEntry&) {
+    notified.push_back(key);
+    return true;
+  }}, "a/#", 3);
+
+  ASSERT_TRUE(store.Set("a/1", Entry(1)));
+  ASSERT_TRUE(store.Set("b/1", Entry(2)));
+  ASSERT_TRUE(store.Set("a/1", Entry(3)));
+  ASSERT_TRUE(store.Set("a/2", Entry(4)));
+
+  EXPECT_EQ(3, store.size());
+  EXPECT_EQ(3, store.Get("a/1").timestamp);
+  EXPECT_EQ(std::vector<std::string>({"a/1", "a/1", "a/2"}), notified);
+
+  std::vector<std::string> prefixed;
+  store.ForEachPrefix("a/", 2, [&prefixed](const std::string& key, const gnat::DataStoreEntry&) {
+    prefixed.push_back(key);
+  });
+  std::sort(prefixed.begin(), prefixed.end());
+  EXPECT_EQ(std::vector<std::string>({"a/1", "a/2"}), prefixed);
+}
+
+TEST(StaticArrayStorageTest, Full) {
+  gnat::DataStore<uint64_t, gnat::StaticArrayStorage<uint64_t, gnat::DataStoreEntry, 2>> store;
+  EXPECT_TRUE(store.Set(1, Entry(1)));
+  EXPECT_TRUE(store.Set(2, Entry(2)));
+  EXPECT_FALSE(store.Set(3, Entry(3)));
+  EXPECT_FALSE(store.Update(3, 1, 3, [](uint8_t*) { return true; }));
+
+  // Existing keys can still be updated.
+  EXPECT_TRUE(store.Set(2, Entry(4)));
+  EXPECT_EQ(4, store.Get(2).timestamp);
+  EXPECT_THROW(store.Get(3), std::out_of_range);
+}
+
+TEST(StaticArrayStorageTest, EraseReusesSlot) {
+  gnat::StaticArrayStorage<int, int, 2> storage;
+  storage.emplace(1, 10);
+  storage.emplace(2, 20);
+  EXPECT_FALSE(storage.emplace(3, 30).second);
+
+  storage.erase(storage.find(1));
+  EXPECT_EQ(1, storage.size());
+  EXPECT_TRUE(storage.emplace(3, 30).second);
+  EXPECT_EQ(30, storage.at(3));
+  EXPECT_EQ(storage.end(), storage.find(1));
+}
+
+TEST(OrderedStorageTest, PrefixScanIsOrdered) {
+  gnat::DataStore<std::string, gnat::OrderedStorage<std::string, gnat::DataStoreEntry>> store;
+  for (const char* key : {"b", "a/2", "a", "a/1", "ab", "a/1/x"}) {
+    store.Set(key, Entry(0));
+  }
+
+  std::vector<std::string> prefixed;
+  store.ForEachPrefix("a/", 2, [&prefixed](const std::string& key, const gnat::DataStoreEntry&) {
+    prefixed.push_back(key);
+  });
+  EXPECT_EQ(std::vector<std::string>({"a/1", "a/1/x", "a/2"}), prefixed);
+}
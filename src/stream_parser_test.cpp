@@ -0,0 +1,121 @@
+#include "stream_parser.h"
+
+#include <gtest/gtest.h>
+#include <vector>
+
+namespace {
+
+using Result = gnat::StreamParser::Result;
+
+constexpr uint8_t kConnectData[] = {
+    0x10, 0x1f, 0x00, 0x06, 0x4d, 0x51, 0x49, 0x73,
+    0x64, 0x70, 0x03, 0x02, 0x00, 0x3c, 0x00, 0x11,
+    0x6d, 0x6f, 0x73, 0x71, 0x70, 0x75, 0x62, 0x7c,
+    0x31, 0x35, 0x36, 0x37, 0x35, 0x2d, 0x65, 0x37,
+    0x63};
+
+struct Event {
+    Result result;
+    gnat::PacketType type;
+    std::string value;
+};
+
+// Feeds |data| to the parser |chunk| bytes at a time and records the events.
+std::vector<Event> Parse(const std::vector<uint8_t>& data, size_t chunk) {
+    gnat::StreamParser parser;
+    std::vector<Event> events;
+    for (size_t offset = 0; offset < data.size(); offset += chunk) {
+      const uint8_t* position = data.data() + offset;
+      size_t size = std::min(chunk, data.size() - offset);
+      while (true) {
+        size_t consumed = 0;
+        const auto result = parser.Consume(position, size, &consumed);
+        position += consumed;
+        size -= consumed;
+        if (result == Result::NEED_MORE) break;
+
+        Event event{result, parser.type(), ""};
+        if (result == Result::TOPIC) {
+          event.value = std::string(parser.topic().data, parser.topic().length);
+        } else if (result == Result::PACKET && parser.type() == gnat::PacketType::PUBLISH) {
+          const auto payload = parser.TakePayload();
+          event.value = std::string(parser.publish().topic.data, parser.publish().topic.length) +
+              "=" + std::string((const char*)payload.get(), parser.publish().payload_bytes);
+        } else if (result == Result::PACKET && parser.type() == gnat::PacketType::CONNECT) {
+          event.value = std::string(parser.connect().protocol_name.data,
+                                    parser.connect().protocol_name.length);
+        }
+        events.push_back(event);
+        if (result == Result::ERROR) return events;
+      }
+    }
+    return events;
+}
+
+}  // namespace
+
+TEST(StreamParserTest, ResumesAnywhere) {
+    std::vector<uint8_t> data(kConnectData, kConnectData + sizeof(kConnectData));
+
+    // Publish with a two byte remaining size.
+    std::vector<uint8_t> publish = {0x30, 0x88, 0x01, 0x0, 0x2, 'a', '/'};
+    publish.resize(3 + 136, 'x');
+    data.insert(data.end(), publish.begin(), publish.end());
+
+    const std::vector<uint8_t> subscribe = {
+      0b10000010, 12, 0x0, 0x1, 0x0, 0x3, 'a', '/', '#', 0, 0x0, 0x1, 'b', 0};
+    data.insert(data.end(), subscribe.begin(), subscribe.end());
+    data.push_back(0xC0);
+    data.push_back(0x0);
+
+    for (size_t chunk = 1; chunk <= data.size(); chunk++) {
+      const auto events = Parse(data, chunk);
+      ASSERT_EQ(6, events.size()) << chunk;
+
+      EXPECT_EQ(Result::PACKET, events[0].result);
+      EXPECT_EQ(gnat::PacketType::CONNECT, events[0].type);
+      EXPECT_EQ("MQIsdp", events[0].value);
+
+      EXPECT_EQ(Result::PACKET, events[1].result);
+      EXPECT_EQ(gnat::PacketType::PUBLISH, events[1].type);
+      EXPECT_EQ("a/=" + std::string(132, 'x'), events[1].value);
+
+      EXPECT_EQ(Result::TOPIC, events[2].result);
+      EXPECT_EQ("a/#", events[2].value);
+      EXPECT_EQ(Result::TOPIC, events[3].result);
+      EXPECT_EQ("b", events[3].value);
+      EXPECT_EQ(Result::PACKET, events[4].result);
+      EXPECT_EQ(gnat::PacketType::SUBSCRIBE, events[4].type);
+
+      EXPECT_EQ(Result::PACKET, events[5].result);
+      EXPECT_EQ(gnat::PacketType::PINGREQ, events[5].type);
+    }
+}
+
+TEST(StreamParserTest, EmptyPayload) {
+    const auto events = Parse({0x30, 0x3, 0x0, 0x1, 'a'}, 1);
+    ASSERT_EQ(1, events.size());
+    EXPECT_EQ(Result::PACKET, events[0].result);
+    EXPECT_EQ("a=", events[0].value);
+}
+
+TEST(StreamParserTest, RemainingSizeTooLong) {
+    const auto events = Parse({0x30, 0xFF, 0xFF, 0xFF, 0xFF, 0x1}, 2);
+    ASSERT_EQ(1, events.size());
+    EXPECT_EQ(Result::ERROR, events[0].result);
+}
+
+TEST(StreamParserTest, EndsMidField) {
+    // Remaining size cuts the topic short.
+    const auto events = Parse({0x30, 0x3, 0x0, 0x6, 'a', 0xC0, 0x0}, 3);
+    ASSERT_EQ(1, events.size());
+    EXPECT_EQ(Result::ERROR, events[0].result);
+}
+
+TEST(StreamParserTest, TopicTooLong) {
+    std::vector<uint8_t> data = {0x30, 0x86, 0x01, 0x0, 0x84};
+    data.resize(3 + 134, 'x');
+    const auto events = Parse(data, 16);
+    ASSERT_EQ(1, events.size());
+    EXPECT_EQ(Result::ERROR, events[0].result);
+}
@@ -0,0 +1,137 @@
+#include "subscription_index.h"
+#include "topic.h"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+namespace {
+
+bool Matches(const std::string& filter, const std::string& topic) {
+  return gnat::topic::MatchesFilter(filter.data(), filter.size(), topic.data(), topic.size());
+}
+
+bool IsValid(const std::string& filter) {
+  return gnat::topic::IsValidFilter(filter.data(), filter.size());
+}
+
+std::vector<int> Match(gnat::SubscriptionIndex<int>* index, const std::string& topic) {
+  std::vector<int> out;
+  index->Match(topic.data(), topic.size(), [&out](int value) { out.push_back(value); });
+  std::sort(out.begin(), out.end());
+  return out;
+}
+
+}  // namespace
+
+TEST(TopicTest, ValidFilters) {
+  EXPECT_TRUE(IsValid("a"));
+  EXPECT_TRUE(IsValid("a/b"));
+  EXPECT_TRUE(IsValid("#"));
+  EXPECT_TRUE(IsValid("a/#"));
+  EXPECT_TRUE(IsValid("+/b/+"));
+  EXPECT_TRUE(IsValid("a//b"));
+
+  EXPECT_FALSE(IsValid(""));
+  EXPECT_FALSE(IsValid("a#"));
+  EXPECT_FALSE(IsValid("a/#/b"));
+  EXPECT_FALSE(IsValid("a+/b"));
+}
+
+TEST(TopicTest, MatchesFilter) {
+  EXPECT_TRUE(Matches("a/b", "a/b"));
+  EXPECT_FALSE(Matches("a/b", "a/bc"));
+  EXPECT_FALSE(Matches("a/b", "a"));
+  EXPECT_FALSE(Matches("a", "a/b"));
+
+  EXPECT_TRUE(Matches("#", "a/b"));
+  EXPECT_TRUE(Matches("a/#", "a"));
+  EXPECT_TRUE(Matches("a/#", "a/b/c"));
+  EXPECT_FALSE(Matches("a/#", "ab"));
+
+  EXPECT_TRUE(Matches("+/b", "a/b"));
+  EXPECT_TRUE(Matches("a/+", "a/"));
+  EXPECT_FALSE(Matches("a/+", "a"));
+  EXPECT_FALSE(Matches("a/+", "a/b/c"));
+  EXPECT_TRUE(Matches("+/+/#", "a/b"));
+
+  // A wildcard first level doesn't match system topics.
+  EXPECT_FALSE(Matches("#", "$SYS/x"));
+  EXPECT_FALSE(Matches("+/x", "$SYS/x"));
+  EXPECT_FALSE(Matches("+", "$"));
+  EXPECT_TRUE(Matches("$SYS/#", "$SYS/x"));
+  EXPECT_TRUE(Matches("$SYS/+", "$SYS/x"));
+  EXPECT_TRUE(Matches("+/x", "a$/x"));
+}
+
+TEST(TopicTest, LiteralPrefixLength) {
+  const auto prefix = [](const std::string& filter) {
+    return filter.substr(0, gnat::topic::LiteralPrefixLength(filter.data(), filter.size()));
+  };
+  EXPECT_EQ("a/b", prefix("a/b"));
+  EXPECT_EQ("a", prefix("a/#"));
+  EXPECT_EQ("a/", prefix("a/+/c"));
+  EXPECT_EQ("", prefix("#"));
+  EXPECT_EQ("", prefix("+/b"));
+}
+
+TEST(SubscriptionIndexTest, MatchesOnlySubscribers) {
+  gnat::SubscriptionIndex<int> index;
+  index.Insert("a/b", 3, 1);
+  index.Insert("a/#", 3, 2);
+  index.Insert("#", 1, 3);
+  index.Insert("+/b", 3, 4);
+  index.Insert("a/+/c", 5, 5);
+  index.Insert("b", 1, 6);
+  EXPECT_EQ(6, index.size());
+
+  EXPECT_EQ(std::vector<int>({1, 2, 3, 4}), Match(&index, "a/b"));
+  EXPECT_EQ(std::vector<int>({2, 3}), Match(&index, "a"));
+  EXPECT_EQ(std::vector<int>({2, 3, 5}), Match(&index, "a/x/c"));
+  EXPECT_EQ(std::vector<int>({3, 4}), Match(&index, "x/b"));
+  EXPECT_EQ(std::vector<int>({3, 6}), Match(&index, "b"));
+  EXPECT_EQ(std::vector<int>({3}), Match(&index, "c"));
+}
+
+TEST(SubscriptionIndexTest, AgreesWithMatchesFilter) {
+  const std::vector<std::string> filters = {
+    "#", "a", "a/#", "a/b", "a/+", "+", "+/#", "+/b/#", "a//b", "a/+/+", "/a",
+    "$SYS/#", "$SYS/+", "+/x",
+  };
+  const std::vector<std::string> topics = {
+    "a", "b", "a/b", "a/c", "a/b/c", "a//b", "/a", "", "x/b/y", "a/",
+    "$SYS/x", "$SYS", "$", "a/$SYS",
+  };
+
+  gnat::SubscriptionIndex<int> index;
+  for (size_t i = 0; i < filters.size(); i++) {
+    index.Insert(filters[i].data(), filters[i].size(), i);
+  }
+
+  for (const auto& topic : topics) {
+    std::vector<int> expected;
+    for (size_t i = 0; i < filters.size(); i++) {
+      if (Matches(filters[i], topic)) expected.push_back(i);
+    }
+    EXPECT_EQ(expected, Match(&index, topic)) << "topic: " << topic;
+  }
+}
+
+TEST(SubscriptionIndexTest, RemoveIf) {
+  gnat::SubscriptionIndex<int> index;
+  index.Insert("a/b", 3, 1);
+  index.Insert("a/b", 3, 2);
+  index.Insert("a/#", 3, 3);
+  index.Insert("+", 1, 4);
+
+  index.RemoveIf([](int value) { return value % 2 == 1; });
+  EXPECT_EQ(2, index.size());
+  EXPECT_EQ(std::vector<int>({2}), Match(&index, "a/b"));
+  EXPECT_EQ(std::vector<int>({4}), Match(&index, "a"));
+
+  index.RemoveIf([](int) { return true; });
+  EXPECT_EQ(0, index.size());
+  EXPECT_EQ(std::vector<int>(), Match(&index, "a/b"));
+}
@@ -0,0 +1,145 @@
+#include "topic_dictionary.h"
+#include "datastore.h"
+#include "sharded_datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace {
+
+std::string Name(const gnat::TopicDictionary& dictionary, gnat::TopicId id) {
+  size_t length = 0;
+  const char* topic = dictionary.Topic(id, &length);
+  return std::string(topic, length);
+}
+
+gnat::TopicId Intern(gnat::TopicDictionary* dictionary, const std::string& topic) {
+  return dictionary->Intern(topic.data(), topic.size());
+}
+
+}  // namespace
+
+TEST(TopicDictionaryTest, InternsOnce) {
+  gnat::TopicDictionary dictionary;
+  const auto a = Intern(&dictionary, "sensors/a");
+  const auto b = Intern(&dictionary, "sensors/b");
+  EXPECT_EQ(0u, a.value);
+  EXPECT_EQ(1u, b.value);
+  EXPECT_EQ(a, Intern(&dictionary, "sensors/a"));
+  EXPECT_EQ(2u, dictionary.size());
+
+  EXPECT_EQ("sensors/a", Name(dictionary, a));
+  EXPECT_EQ("sensors/b", Name(dictionary, b));
+
+  gnat::TopicId found;
+  EXPECT_TRUE(dictionary.Find("sensors/b", 9, &found));
+  EXPECT_EQ(b, found);
+  EXPECT_FALSE(dictionary.Find("sensors/c", 9, &found));
+  EXPECT_EQ(2u, dictionary.size());
+}
+
+TEST(TopicDictionaryTest, NamesDontMove) {
+  gnat::TopicDictionary dictionary;
+  std::vector<std::string> topics;
+  for (int i = 0; i < 2000; i++) topics.push_back("topic/number/" + std::to_string(i));
+  // Longer than a block.
+  topics.push_back(std::string(gnat::TopicDictionary::kBlockSize + 10, 'x'));
+  topics.push_back("after/long");
+
+  std::vector<const char*> names;
+  for (const auto& topic : topics) {
+    size_t length = 0;
+    names.push_back(dictionary.Topic(Intern(&dictionary, topic), &length));
+  }
+  for (size_t i = 0; i < topics.size(); i++) {
+    const gnat::TopicId id{static_cast<uint32_t>(i)};
+    EXPECT_EQ(topics[i], Name(dictionary, id));
+    size_t length = 0;
+    EXPECT_EQ(names[i], dictionary.Topic(id, &length));
+  }
+}
+
+TEST(TopicDictionaryTest, DataStoreKeys) {
+  using Store = gnat::DataStore<gnat::TopicId>;
+  Store store;
+  // Would be the same uint64_t key.
+  const auto a = Store::EncodeKey("sensors/a", 9);
+  const auto b = Store::EncodeKey("sensors/b", 9);
+  EXPECT_NE(a, b);
+
+  std::vector<std::string> seen;
+  ASSERT_TRUE(store.AddObserver({0, [&seen](const gnat::TopicId& key,
+                                            const gnat::DataStoreEntry&) {
+    char topic[64];
+    uint16_t length = 0;
+    Store::DecodeKey(key, topic, &length);
+    seen.emplace_back(topic, length);
+    return true;
+  }}, "sensors/+", 9));
+
+  for (const auto key : {a, b}) {
+    store.Update(key, 1, 0, [](uint8_t* data) {
+      *data = 1;
+      return true;
+    });
+  }
+  EXPECT_EQ(2u, store.size());
+  EXPECT_EQ((std::vector<std::string>{"sensors/a", "sensors/b"}), seen);
+
+  size_t under = 0;
+  store.ForEachPrefix("sensors/", 8, [&under](const gnat::TopicId&, const gnat::DataStoreEntry&) {
+    under++;
+  });
+  EXPECT_EQ(2u, under);
+}
+
+TEST(TopicDictionaryTest, ConcurrentInterns) {
+  gnat::TopicDictionary dictionary;
+  constexpr int kThreads = 4;
+  constexpr int kTopics = 5000;
+  // Every thread interns the same topics, in a different order, and reads
+  // back names of ids the others added.
+  std::vector<std::vector<gnat::TopicId>> ids(kThreads, std::vector<gnat::TopicId>(kTopics));
+  std::vector<std::thread> threads;
+  for (int t = 0; t < kThreads; t++) {
+    threads.emplace_back([&dictionary, &ids, t] {
+      for (int i = 0; i < kTopics; i++) {
+        const int topic = t % 2 == 0 ? i : kTopics - 1 - i;
+        const auto id = Intern(&dictionary, "topic/" + std::to_string(topic));
+        ids[t][topic] = id;
+        ASSERT_EQ("topic/" + std::to_string(topic), Name(dictionary, id));
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+
+  EXPECT_EQ(static_cast<size_t>(kTopics), dictionary.size());
+  for (int t = 1; t < kThreads; t++) EXPECT_EQ(ids[0], ids[t]);
+}
+
+TEST(TopicDictionaryTest, ShardedDataStoreKeys) {
+  using Store = gnat::ShardedDataStore<gnat::TopicId>;
+  Store store;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < 4; t++) {
+    threads.emplace_back([&store, t] {
+      for (int i = 0; i < 1000; i++) {
+        const std::string topic = "sharded/" + std::to_string(t) + "/" + std::to_string(i);
+        store.Update(Store::EncodeKey(topic.data(), topic.size()), 1, 0, [](uint8_t* data) {
+          *data = 1;
+          return true;
+        });
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  EXPECT_EQ(4000u, store.size());
+
+  char topic[64];
+  uint16_t length = 0;
+  Store::DecodeKey(Store::EncodeKey("sharded/3/999", 13), topic, &length);
+  EXPECT_EQ("sharded/3/999", std::string(topic, length));
+}
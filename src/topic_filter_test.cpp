@@ -0,0 +1,52 @@
+#include "topic_filter.h"
+#include "topic.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+using gnat::topic::CompiledFilter;
+
+CompiledFilter Compile(const std::string& filter) {
+  return CompiledFilter(filter.data(), filter.size());
+}
+
+}  // namespace
+
+TEST(TopicFilterTest, Kinds) {
+  EXPECT_EQ(CompiledFilter::Kind::kExact, Compile("a/b").kind());
+  EXPECT_EQ(CompiledFilter::Kind::kPrefix, Compile("a/#").kind());
+  EXPECT_EQ(CompiledFilter::Kind::kPrefix, Compile("#").kind());
+  EXPECT_EQ(CompiledFilter::Kind::kLevels, Compile("a/+").kind());
+  EXPECT_EQ(CompiledFilter::Kind::kLevels, Compile("+/#").kind());
+}
+
+TEST(TopicFilterTest, MatchesLikeMatchesFilter) {
+  const std::vector<std::string> filters = {
+      "#", "a", "a/b", "a/#", "a/b/#", "/#", "a//b", "+", "+/+", "a/+",
+      "+/b", "a/+/c", "+/#", "+/+/#", "a/+/#", "/+", "+/", "a/+/", "$SYS/#", "$SYS/+",
+      "+/x", "$SYS/x"};
+  const std::vector<std::string> topics = {
+      "", "a", "b", "a/", "/a", "/", "a/b", "a/c", "b/b", "a/b/c", "a/bc/c",
+      "a/b/c/d", "a//b", "a//", "ab", "ab/c", "//", "$SYS/x", "$SYS", "$", "a/$SYS"};
+
+  for (const auto& filter : filters) {
+    const auto compiled = Compile(filter);
+    for (const auto& topic : topics) {
+      EXPECT_EQ(gnat::topic::MatchesFilter(filter.data(), filter.size(),
+                                           topic.data(), topic.size()),
+                compiled.Matches(topic.data(), topic.size()))
+          << filter << " " << topic;
+    }
+  }
+}
+
+TEST(TopicFilterTest, SystemTopics) {
+  EXPECT_FALSE(Compile("#").Matches("$SYS/x", 6));
+  EXPECT_FALSE(Compile("+/x").Matches("$SYS/x", 6));
+  EXPECT_TRUE(Compile("$SYS/#").Matches("$SYS/x", 6));
+  EXPECT_TRUE(Compile("a/#").Matches("a/$SYS", 6));
+}
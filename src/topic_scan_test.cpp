@@ -0,0 +1,121 @@
+#include "topic_scan.h"
+#include "topic.h"
+#include "key.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+namespace {
+
+using gnat::topic::ScanResult;
+
+ScanResult Scan(const std::string& topic) {
+  return gnat::topic::Scan(topic.data(), topic.size());
+}
+
+ScanResult ScanScalar(const std::string& topic) {
+  return gnat::topic::scan::ScanWith<gnat::topic::scan::ScalarBlocks>(
+      topic.data(), topic.size());
+}
+
+bool IsValidUtf8(const std::string& text) {
+  return Scan(text).valid_utf8;
+}
+
+bool IsValidName(const std::string& name) {
+  return gnat::topic::IsValidName(name.data(), name.size());
+}
+
+}  // namespace
+
+TEST(TopicScanTest, Wildcards) {
+  EXPECT_TRUE(Scan("+/b/+").has_plus);
+  EXPECT_FALSE(Scan("+/b/+").has_hash);
+  EXPECT_TRUE(Scan("a/#").has_hash);
+  EXPECT_TRUE(Scan("a/#").valid_wildcards);
+  EXPECT_FALSE(Scan("a/b").has_plus);
+  EXPECT_FALSE(Scan("a/b").has_hash);
+
+  EXPECT_FALSE(Scan("a#").valid_wildcards);
+  EXPECT_FALSE(Scan("#a").valid_wildcards);
+  EXPECT_FALSE(Scan("a/#/b").valid_wildcards);
+  EXPECT_FALSE(Scan("a+/b").valid_wildcards);
+  EXPECT_FALSE(Scan("a/+b").valid_wildcards);
+}
+
+TEST(TopicScanTest, AcrossBlocks) {
+  // Wildcards and their separators on either side of the 16 byte boundary.
+  EXPECT_TRUE(Scan("0123456789abcde/+/x").valid_wildcards);
+  EXPECT_TRUE(Scan("0123456789abcd/+/x").valid_wildcards);
+  EXPECT_TRUE(Scan("0123456789abcdef/#").valid_wildcards);
+  EXPECT_TRUE(Scan("0123456789abcde/#").valid_wildcards);
+  EXPECT_FALSE(Scan("0123456789abcdef+/x").valid_wildcards);
+  EXPECT_FALSE(Scan("0123456789abcde/+x").valid_wildcards);
+  EXPECT_FALSE(Scan("0123456789abcde/#/").valid_wildcards);
+  EXPECT_FALSE(Scan("0123456789abcdef#").valid_wildcards);
+}
+
+TEST(TopicScanTest, Utf8) {
+  EXPECT_TRUE(IsValidUtf8("sensors/temp"));
+  EXPECT_TRUE(IsValidUtf8("k\xc3\xbc" "che/\xe2\x82\xac/\xf0\x9f\x98\x80"));
+  // A character split over the block boundary.
+  EXPECT_TRUE(IsValidUtf8("0123456789abcde\xe2\x82\xac"));
+
+  EXPECT_FALSE(IsValidUtf8(std::string("a\0b", 3)));
+  EXPECT_FALSE(IsValidUtf8("\x80"));
+  EXPECT_FALSE(IsValidUtf8("\xc3"));
+  EXPECT_FALSE(IsValidUtf8("\xc0\xaf"));          // Overlong '/'.
+  EXPECT_FALSE(IsValidUtf8("\xe0\x80\xaf"));      // Overlong '/'.
+  EXPECT_FALSE(IsValidUtf8("\xed\xa0\x80"));      // Surrogate.
+  EXPECT_FALSE(IsValidUtf8("\xf4\x90\x80\x80"));  // Past U+10FFFF.
+  EXPECT_FALSE(IsValidUtf8("0123456789abcdef0123\xff"));
+}
+
+TEST(TopicScanTest, VectorMatchesScalar) {
+  std::vector<std::string> topics = {"", "a", "+", "#", "a/+/#", "a//b"};
+  const std::string alphabet = "a/+#\xc3\xa9";
+  // Every string of the alphabet's bytes up to 4 long, padded so they cross
+  // the block boundary.
+  std::vector<std::string> current = {""};
+  for (int length = 0; length < 4; length++) {
+    std::vector<std::string> next;
+    for (const auto& prefix : current) {
+      for (char c : alphabet) next.push_back(prefix + c);
+    }
+    topics.insert(topics.end(), next.begin(), next.end());
+    current = next;
+  }
+  for (const auto& topic : std::vector<std::string>(topics)) {
+    topics.push_back("0123456789abcd" + topic);
+    topics.push_back("0123456789abcd/" + topic);
+  }
+
+  for (const auto& topic : topics) {
+    const auto vector = Scan(topic);
+    const auto scalar = ScanScalar(topic);
+    EXPECT_EQ(scalar.valid_utf8, vector.valid_utf8) << topic;
+    EXPECT_EQ(scalar.valid_wildcards, vector.valid_wildcards) << topic;
+    EXPECT_EQ(scalar.has_plus, vector.has_plus) << topic;
+    EXPECT_EQ(scalar.has_hash, vector.has_hash) << topic;
+  }
+}
+
+TEST(TopicScanTest, Names) {
+  EXPECT_TRUE(IsValidName("sensors/temp"));
+  EXPECT_TRUE(IsValidName("/"));
+  EXPECT_FALSE(IsValidName(""));
+  EXPECT_FALSE(IsValidName("sensors/+"));
+  EXPECT_FALSE(IsValidName("sensors/#"));
+  EXPECT_FALSE(IsValidName("sensors/\xff"));
+}
+
+TEST(TopicScanTest, EncodeStringMatchesEncode) {
+  EXPECT_EQ(gnat::key::Encode("TESTTEST"), gnat::key::EncodeString("TESTTEST", 8));
+  EXPECT_EQ(gnat::key::Encode("t/te"), gnat::key::EncodeString("t/te", 4));
+  // Only the first 8 bytes are kept.
+  EXPECT_EQ(gnat::key::Encode("TESTTEST"), gnat::key::EncodeString("TESTTESTXY", 10));
+  // Bytes past 0x7f stay in their own byte.
+  EXPECT_EQ(0x0000000000bcc36bull, gnat::key::EncodeString("k\xc3\xbc", 3));
+}
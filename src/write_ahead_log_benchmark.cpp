@@ -0,0 +1,62 @@
+// Publish throughput into a DataStore<std::string> without a log, with a
+// group committed FileLog and with an fsync after every publish.
+
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include "datastore.h"
+#include "write_ahead_log.h"
+
+namespace {
+
+constexpr char kPath[] = "/tmp/gnat_log_benchmark";
+
+bool Fill(uint8_t* data) {
+    memset(data, 1, 32);
+    return true;
+}
+
+void Run(const char* name, const std::vector<std::string>& topics, size_t publishes,
+         const gnat::FileLog::Options* options) {
+    remove(kPath);
+    gnat::DataStore<std::string> store;
+    std::unique_ptr<gnat::FileLog> log;
+    if (options) {
+      log = gnat::FileLog::Open(kPath, &store, *options);
+      store.set_log(log.get());
+    }
+
+    const auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < publishes; i++) {
+      store.Update(topics[i % topics.size()], 32, i, Fill);
+      // As a server loop would between publishes.
+      if (log) log->Poll();
+    }
+    if (log) log->Sync();
+    const auto elapsed = std::chrono::steady_clock::now() - start;
+
+    const double seconds = std::chrono::duration<double>(elapsed).count();
+    printf("%-24s %8zu publishes  %10.0f publishes/s  %6u syncs\n", name, publishes,
+           publishes / seconds, log ? log->syncs() : 0);
+}
+
+}  // namespace
+
+int main() {
+    std::vector<std::string> topics;
+    for (int i = 0; i < 1000; i++) topics.push_back("sensors/" + std::to_string(i));
+
+    Run("no log", topics, 1000000, nullptr);
+
+    gnat::FileLog::Options grouped;
+    Run("group commit 100ms/64k", topics, 1000000, &grouped);
+
+    gnat::FileLog::Options every;
+    every.sync_bytes = 0;
+    Run("fsync every publish", topics, 2000, &every);
+
+    remove(kPath);
+    return 0;
+}
@@ -0,0 +1,191 @@
+#include "write_ahead_log.h"
+#include "datastore.h"
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace {
+
+using Store = gnat::DataStore<std::string>;
+
+void Put(Store* store, const std::string& topic, const std::string& value,
+         uint32_t timestamp = 0) {
+  store->Update(topic, value.size(), timestamp, [&value](uint8_t* data) {
+    memcpy(data, value.data(), value.size());
+    return true;
+  });
+}
+
+std::string Value(Store* store, const std::string& topic) {
+  const auto* entry = store->Find(topic);
+  if (entry == nullptr) return "<missing>";
+  return std::string(reinterpret_cast<const char*>(entry->data.get()), entry->length);
+}
+
+gnat::FileLog::Options Batched() {
+  gnat::FileLog::Options options;
+  options.sync_interval = std::chrono::hours(1);
+  options.sync_bytes = 1 << 20;
+  return options;
+}
+
+class FileLogTest : public ::testing::Test {
+protected:
+  void SetUp() override {
+    path_ = testing::TempDir() + "gnat_log_test";
+    snapshot_path_ = testing::TempDir() + "gnat_log_test_snapshot";
+    remove(path_.c_str());
+  }
+  void TearDown() override {
+    remove(path_.c_str());
+    remove(snapshot_path_.c_str());
+  }
+
+  size_t FileSize() {
+    FILE* file = fopen(path_.c_str(), "rb");
+    fseek(file, 0, SEEK_END);
+    const size_t size = ftell(file);
+    fclose(file);
+    return size;
+  }
+
+  std::string path_;
+  std::string snapshot_path_;
+};
+
+}  // namespace
+
+TEST(LogFormatTest, StopsAtTornRecord) {
+  std::vector<uint8_t> log;
+  gnat::LogFormat::Encode("a/b", 3, reinterpret_cast<const uint8_t*>("one"), 3, 1, &log);
+  const size_t first = log.size();
+  gnat::LogFormat::Encode("c", 1, reinterpret_cast<const uint8_t*>("two"), 3, 2, &log);
+
+  std::vector<std::string> seen;
+  const auto visit = [&seen](const char* topic, size_t topic_length, const uint8_t* data,
+                             uint32_t length, uint32_t timestamp) {
+    seen.push_back(std::string(topic, topic_length) + "=" +
+                   std::string(reinterpret_cast<const char*>(data), length) + "@" +
+                   std::to_string(timestamp));
+  };
+  EXPECT_EQ(log.size(), gnat::LogFormat::Decode(log.data(), log.size(), visit));
+  EXPECT_EQ((std::vector<std::string>{"a/b=one@1", "c=two@2"}), seen);
+
+  seen.clear();
+  EXPECT_EQ(first, gnat::LogFormat::Decode(log.data(), log.size() - 1, visit));
+  EXPECT_EQ((std::vector<std::string>{"a/b=one@1"}), seen);
+
+  // Flipped payload byte.
+  seen.clear();
+  log[first - 1] ^= 1;
+  EXPECT_EQ(0u, gnat::LogFormat::Decode(log.data(), log.size(), visit));
+  EXPECT_TRUE(seen.empty());
+}
+
+TEST_F(FileLogTest, Recovers) {
+  {
+    Store store;
+    auto log = gnat::FileLog::Open(path_.c_str(), &store);
+    ASSERT_NE(nullptr, log);
+    store.set_log(log.get());
+    Put(&store, "a", "1");
+    Put(&store, "b", "2");
+    Put(&store, "a", "3", 7);
+  }
+
+  Store store;
+  auto log = gnat::FileLog::Open(path_.c_str(), &store);
+  ASSERT_NE(nullptr, log);
+  EXPECT_EQ(2u, store.size());
+  EXPECT_EQ("3", Value(&store, "a"));
+  EXPECT_EQ(7u, store.Get("a").timestamp);
+  EXPECT_EQ("2", Value(&store, "b"));
+}
+
+TEST_F(FileLogTest, GroupCommit) {
+  Store store;
+  auto log = gnat::FileLog::Open(path_.c_str(), &store, Batched());
+  ASSERT_NE(nullptr, log);
+  store.set_log(log.get());
+  for (int i = 0; i < 100; i++) Put(&store, "a/" + std::to_string(i), "value");
+
+  // Nothing has hit the disk yet.
+  EXPECT_EQ(0u, log->syncs());
+  EXPECT_EQ(0u, FileSize());
+  log->Poll();
+  EXPECT_EQ(0u, log->syncs());
+
+  ASSERT_TRUE(log->Sync());
+  EXPECT_EQ(1u, log->syncs());
+  EXPECT_EQ(0u, log->pending_bytes());
+  EXPECT_LT(0u, FileSize());
+
+  // A full batch is written by the next Poll, Append never writes.
+  gnat::FileLog::Options small = Batched();
+  small.sync_bytes = 64;
+  Store other;
+  remove(path_.c_str());
+  log = gnat::FileLog::Open(path_.c_str(), &other, small);
+  other.set_log(log.get());
+  Put(&other, "topic", std::string(64, 'x'));
+  EXPECT_EQ(0u, log->syncs());
+  EXPECT_EQ(0u, FileSize());
+  log->Poll();
+  EXPECT_EQ(1u, log->syncs());
+  EXPECT_LT(0u, FileSize());
+}
+
+TEST_F(FileLogTest, CutsTornTail) {
+  {
+    Store store;
+    auto log = gnat::FileLog::Open(path_.c_str(), &store);
+    store.set_log(log.get());
+    Put(&store, "a", "1");
+  }
+  const size_t good = FileSize();
+  FILE* file = fopen(path_.c_str(), "ab");
+  fputs("half a record", file);
+  fclose(file);
+
+  {
+    Store store;
+    auto log = gnat::FileLog::Open(path_.c_str(), &store);
+    ASSERT_NE(nullptr, log);
+    EXPECT_EQ(good, FileSize());
+    EXPECT_EQ("1", Value(&store, "a"));
+    // Records written after the cut are found next time.
+    store.set_log(log.get());
+    Put(&store, "b", "2");
+  }
+
+  Store store;
+  auto log = gnat::FileLog::Open(path_.c_str(), &store);
+  EXPECT_EQ("1", Value(&store, "a"));
+  EXPECT_EQ("2", Value(&store, "b"));
+}
+
+TEST_F(FileLogTest, CompactsIntoSnapshot) {
+  {
+    Store store;
+    auto log = gnat::FileLog::Open(path_.c_str(), &store);
+    store.set_log(log.get());
+    Put(&store, "a", "1");
+    Put(&store, "b", "2");
+    ASSERT_TRUE(log->Compact(snapshot_path_.c_str(), &store));
+    EXPECT_EQ(0u, FileSize());
+    Put(&store, "b", "3");
+  }
+
+  // Snapshot first, then the log since.
+  const auto snapshot = gnat::MappedSnapshot::Open(snapshot_path_.c_str());
+  ASSERT_NE(nullptr, snapshot);
+  Store store;
+  store.set_warm_start(snapshot->view());
+  auto log = gnat::FileLog::Open(path_.c_str(), &store);
+  ASSERT_NE(nullptr, log);
+  EXPECT_EQ("1", Value(&store, "a"));
+  EXPECT_EQ("3", Value(&store, "b"));
+}